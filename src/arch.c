@@ -20,6 +20,22 @@
 */
 
 #include "newick-tools.h"
+#include <cpuid.h>
+
+long mmx_present = 0;
+long sse_present = 0;
+long sse2_present = 0;
+long sse3_present = 0;
+long ssse3_present = 0;
+long sse41_present = 0;
+long sse42_present = 0;
+long popcnt_present = 0;
+long avx_present = 0;
+long avx2_present = 0;
+
+int simd_level = SIMD_NONE;
+
+static const char * simd_names[SIMD_LEVELS] = { "none", "sse4.2", "avx2" };
 
 unsigned long arch_get_memused()
 {
@@ -73,3 +89,75 @@ unsigned long arch_get_memtotal()
 
 #endif
 }
+
+/* Sets the *_present flags from CPUID. AVX and AVX2 also need the operating
+   system to save the upper halves of the YMM registers on context switches,
+   which XGETBV reports in bits 1 and 2 of XCR0 */
+void cpu_features_detect()
+{
+  unsigned int a, b, c, d;
+  unsigned int maxlevel;
+
+  if (!__get_cpuid(0, &a, &b, &c, &d))
+    return;
+  maxlevel = a;
+
+  if (maxlevel >= 1)
+  {
+    __cpuid(1, a, b, c, d);
+    mmx_present    = (d >> 23) & 1;
+    sse_present    = (d >> 25) & 1;
+    sse2_present   = (d >> 26) & 1;
+    sse3_present   = (c >>  0) & 1;
+    ssse3_present  = (c >>  9) & 1;
+    sse41_present  = (c >> 19) & 1;
+    sse42_present  = (c >> 20) & 1;
+    popcnt_present = (c >> 23) & 1;
+
+    /* OSXSAVE and AVX */
+    if (((c >> 27) & 1) && ((c >> 28) & 1))
+    {
+      unsigned int xcr0_low, xcr0_high;
+
+      __asm__ ("xgetbv" : "=a" (xcr0_low), "=d" (xcr0_high) : "c" (0));
+      avx_present = (xcr0_low & 6) == 6;
+    }
+
+    if (maxlevel >= 7 && avx_present)
+    {
+      __cpuid_count(7, 0, a, b, c, d);
+      avx2_present = (b >> 5) & 1;
+    }
+  }
+}
+
+/* Selects the vectorized kernels. By default the best level the processor
+   supports is used; --simd forces a lower one, e.g. for benchmarks */
+void simd_select(const char * level)
+{
+  int i;
+  int best = SIMD_NONE;
+
+  if (sse42_present && ssse3_present)
+    best = SIMD_SSE42;
+  if (avx2_present)
+    best = SIMD_AVX2;
+
+  if (!level)
+  {
+    simd_level = best;
+    return;
+  }
+
+  for (i = 0; i < SIMD_LEVELS; ++i)
+    if (!strcasecmp(level, simd_names[i]))
+      break;
+
+  if (i == SIMD_LEVELS)
+    fatal("Unknown SIMD level %s, expected none, sse4.2 or avx2", level);
+
+  if (i > best)
+    fatal("The processor does not support %s", simd_names[i]);
+
+  simd_level = i;
+}
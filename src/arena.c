@@ -0,0 +1,204 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Node arenas. Every tree owns an arena from which its nodes, the child
+   arrays of n-ary nodes and any per-node data are bump allocated, such that
+   nodes lie next to each other in the order they were created and the whole
+   tree is freed at once by freeing the arena.
+
+   Memory is obtained in blocks of ARENA_SEGMENT aligned segments. The first
+   block is a single segment, which holds the arena itself and suffices for
+   small trees, and every further block is twice as large as the previous
+   one, up to ARENA_BLOCK_MAX segments. Each segment starts with a pointer to
+   its arena, and small allocations never cross a segment boundary, so the
+   arena of a node is found by rounding its address down to the segment.
+   This lets code that only has a node at hand, such as the destructors of
+   the trees or functions that add nodes to an existing tree, allocate from
+   and free the right arena. Allocations too large for a segment are made
+   separately and are kept in a list until the arena is destroyed.
+
+   An arena is not locked, and is only used by one thread at a time */
+
+#define ARENA_SEGMENT    2048
+#define ARENA_BLOCK_MAX  512
+#define ARENA_ALIGN      8
+
+typedef struct segment_header_s
+{
+  arena_t * arena;
+  struct segment_header_s * next_block;   /* only in the first segment */
+} segment_header_t;
+
+typedef struct arena_large_s
+{
+  struct arena_large_s * next;
+  size_t pad;                             /* keeps the data 16-byte aligned */
+  char data[];
+} arena_large_t;
+
+struct arena_s
+{
+  char * cur;                   /* next free byte of the current segment */
+  char * segment_end;
+  char * block_end;
+  void * last;                  /* most recent small allocation */
+  size_t next_block;            /* segments of the next block */
+  segment_header_t * blocks;    /* most recent block first */
+  arena_large_t * large;
+};
+
+#define ARENA_SMALL_MAX (ARENA_SEGMENT - sizeof(segment_header_t))
+
+static segment_header_t * block_create(size_t segments)
+{
+  void * block = NULL;
+
+  if (posix_memalign(&block, ARENA_SEGMENT, segments * ARENA_SEGMENT))
+    fatal("Unable to allocate enough memory.");
+
+  memset(block, 0, segments * ARENA_SEGMENT);
+
+  return (segment_header_t *)block;
+}
+
+/* starts the segment at seg, which is zeroed */
+static void segment_enter(arena_t * arena, char * seg)
+{
+  ((segment_header_t *)seg)->arena = arena;
+  arena->cur = seg + sizeof(segment_header_t);
+  arena->segment_end = seg + ARENA_SEGMENT;
+}
+
+arena_t * arena_create(void)
+{
+  segment_header_t * block = block_create(1);
+  arena_t * arena = (arena_t *)(block + 1);
+
+  segment_enter(arena, (char *)block);
+  arena->cur += sizeof(arena_t);
+  arena->block_end = arena->segment_end;
+  arena->next_block = 2;
+  arena->blocks = block;
+
+  return arena;
+}
+
+/* Returns size bytes of zeroed memory */
+void * arena_alloc(arena_t * arena, size_t size)
+{
+  void * p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (size > ARENA_SMALL_MAX)
+  {
+    arena_large_t * large = (arena_large_t *)xcalloc(1, sizeof(arena_large_t) +
+                                                        size);
+    large->next = arena->large;
+    arena->large = large;
+    return large->data;
+  }
+
+  if (arena->cur + size > arena->segment_end)
+  {
+    if (arena->segment_end == arena->block_end)
+    {
+      segment_header_t * block = block_create(arena->next_block);
+
+      block->next_block = arena->blocks;
+      arena->blocks = block;
+      arena->block_end = (char *)block + arena->next_block * ARENA_SEGMENT;
+      arena->next_block = MIN(2 * arena->next_block, ARENA_BLOCK_MAX);
+
+      segment_enter(arena, (char *)block);
+    }
+    else
+      segment_enter(arena, arena->segment_end);
+  }
+
+  p = arena->cur;
+  arena->cur += size;
+  arena->last = p;
+
+  return p;
+}
+
+/* Grows ptr, of old_size bytes, to size bytes. The most recent allocation
+   grows in place if the segment has room for it, otherwise the contents are
+   copied, and the old memory stays in the arena until it is destroyed */
+void * arena_realloc(arena_t * arena, void * ptr, size_t old_size, size_t size)
+{
+  void * p;
+
+  if (!ptr)
+    return arena_alloc(arena, size);
+
+  if (size <= old_size)
+    return ptr;
+
+  /* the last allocation is in the current segment if the segment was not
+     left for a later allocation */
+  if (ptr == arena->last &&
+      (char *)ptr >= arena->segment_end - ARENA_SEGMENT &&
+      (char *)ptr + size <= arena->segment_end)
+  {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena->cur = MIN((char *)ptr + size, arena->segment_end);
+    return ptr;
+  }
+
+  p = arena_alloc(arena, size);
+  memcpy(p, ptr, old_size);
+
+  return p;
+}
+
+/* Returns the arena of memory obtained from arena_alloc() with a size that
+   fits in a segment, which includes every tree node */
+arena_t * arena_of(const void * ptr)
+{
+  uintptr_t seg = (uintptr_t)ptr & ~(uintptr_t)(ARENA_SEGMENT - 1);
+
+  return ((const segment_header_t *)seg)->arena;
+}
+
+void arena_destroy(arena_t * arena)
+{
+  segment_header_t * block = arena->blocks;
+  arena_large_t * large = arena->large;
+
+  while (large)
+  {
+    arena_large_t * next = large->next;
+    free(large);
+    large = next;
+  }
+
+  /* the first block, which holds the arena, is freed last */
+  while (block)
+  {
+    segment_header_t * next = block->next_block;
+    free(block);
+    block = next;
+  }
+}
@@ -24,64 +24,80 @@
 void cmd_attach_tree(void)
 {
   FILE * out;
+  writer_t * w;
   unsigned int i;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
   /* make sure to do all conversions */ 
 
-  
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
-
-  if (!rtree)
-    fatal("Currently only rooted trees are supported");
-
+  /* load the tree to be attached */
   rtree_t * attachtree = rtree_parse_newick(opt_attach_filename);
   if (!attachtree)
     fatal("Currently only rooted trees are supported");
 
+  double attach_length = attachtree->length;
 
-  rtree_t ** tip_nodes = (rtree_t **)xmalloc(rtree->leaves *
-                                             sizeof(rtree_t *));
+  forest_open(opt_treefile);
 
-  rtree_query_tipnodes(rtree, tip_nodes);
+  /* attempt to open output file */
+  out = opt_outfile ?
+          xopen(opt_outfile,"w") : stdout;
+  w = writer_open(out);
 
-  for (i=0; i < rtree->leaves; ++i)
-    if (!strcmp(tip_nodes[i]->label,opt_attach_at))
-      break;
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("Currently only rooted trees are supported");
 
-  if (i == rtree->leaves)
-    fatal("Attach at tip not found");
-  
-  free(tip_nodes[i]->label);
-  tip_nodes[i]->label = NULL;
+    rtree_t ** tip_nodes = (rtree_t **)xmalloc(rtree->leaves *
+                                               sizeof(rtree_t *));
 
-  if (tip_nodes[i]->parent->left == tip_nodes[i])
-    tip_nodes[i]->parent->left = attachtree;
-  else
-    tip_nodes[i]->parent->right = attachtree;
+    rtree_query_tipnodes(rtree, tip_nodes);
 
-  attachtree->parent  = tip_nodes[i]->parent;
-  attachtree->length += tip_nodes[i]->length;
+    for (i=0; i < rtree->leaves; ++i)
+      if (!strcmp(tip_nodes[i]->label,opt_attach_at))
+        break;
 
-  rtree_destroy(tip_nodes[i]);
+    if (i == rtree->leaves)
+      fatal("Attach at tip not found");
+    
+    rtree_t * tip = tip_nodes[i];
+    rtree_t * parent = tip->parent;
 
-  free(tip_nodes);
+    free(tip_nodes);
 
-  
-  rtree_reset_leaves(rtree);
+    /* replace the tip with the attached tree */
+    if (parent->left == tip)
+      parent->left = attachtree;
+    else
+      parent->right = attachtree;
 
-  /* prepare for output */
-  char * newick = rtree_export_newick(rtree);
+    attachtree->parent  = parent;
+    attachtree->length  = attach_length + tip->length;
+    
+    rtree_reset_leaves(rtree);
 
-  /* attempt to open output file */
-  out = opt_outfile ?
-          xopen(opt_outfile,"w") : stdout;
+    rtree_stream_newick(w, rtree);
+
+    /* detach the attached tree such that it can be re-used for the next
+       tree in the file */
+    if (parent->left == attachtree)
+      parent->left = tip;
+    else
+      parent->right = tip;
+
+    rtree_destroy(rtree);
+  }
 
-  
-  fprintf(out, "%s\n", newick); 
+  forest_close();
+  writer_close(w);
 
   if (opt_outfile)
     fclose(out);
 
-  rtree_destroy(rtree);
-  free(newick);
-  
+  attachtree->parent = NULL;
+  attachtree->length = attach_length;
+  rtree_destroy(attachtree);
 }
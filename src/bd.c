@@ -98,8 +98,11 @@ static void set_branchlength(rtree_t * node, double parent_age)
 void cmd_simulate_bd(void)
 {
   FILE * out;
+  writer_t * w;
   int i;
+  char * label;
   char ** labels = NULL;
+  arena_t * arena = arena_create();
 
   roundfactor = pow(10, opt_precision);
 
@@ -119,12 +122,15 @@ void cmd_simulate_bd(void)
 
   for (i=0; i<opt_simulate_tips; ++i)
   {
-    children[i] = (rtree_t *)xcalloc(1,sizeof(rtree_t));
+    children[i] = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
     children[i]->leaves = 1;
     if (labels)
-      children[i]->label = labels[i];
+      label = labels[i];
     else
-      asprintf(&(children[i]->label), "%d", i+1);
+      asprintf(&label, "%d", i+1);
+
+    children[i]->label = label_intern(label, strlen(label));
+    free(label);
   }
 
   if (labels)
@@ -152,10 +158,14 @@ void cmd_simulate_bd(void)
       s[i] *= scaler;
   }
 
-  /* round to the decimal point specified by opt_precision */
-  t = fround(t);
-  for (i=0; i<opt_simulate_tips-1; ++i)
-    s[i] = fround(s[i]);
+  /* round to the decimal point specified by opt_precision, unless the
+     lengths are written with all their digits */
+  if (opt_precision != PRECISION_SHORTEST)
+  {
+    t = fround(t);
+    for (i=0; i<opt_simulate_tips-1; ++i)
+      s[i] = fround(s[i]);
+  }
 
   /* sort them from smallest to largest */
   qsort((void *)s, opt_simulate_tips-1, sizeof(double), cb_asc);
@@ -174,7 +184,7 @@ void cmd_simulate_bd(void)
     if (r1 > r2) SWAP(r1,r2);
 
     /* create a new inner node */
-    new = (rtree_t *)xmalloc(sizeof(rtree_t));
+    new = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
     new->left   = children[r1];
     new->right  = children[r2];
     new->leaves = new->left->leaves + new->right->leaves;
@@ -231,15 +241,13 @@ void cmd_simulate_bd(void)
 //    assert(new->length > 0);
 //  }
 
-  /* prepare for output */
-  char * newick = rtree_export_newick(new);
-
   /* attempt to open output file */
   out = opt_outfile ?
           xopen(opt_outfile,"w") : stdout;
 
-  
-  fprintf(out, "%s\n", newick); 
+  w = writer_open(out);
+  rtree_stream_newick(w, new);
+  writer_close(w);
 
   if (opt_outfile)
     fclose(out);
@@ -247,5 +255,4 @@ void cmd_simulate_bd(void)
   rtree_destroy(new);
   free(children);
   free(s);
-  free(newick);
 }
@@ -0,0 +1,153 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Copying of selected trees. The trees are never parsed: the boundaries of
+   each tree are found by the same scan over quotes, comments and semicolons
+   that builds the index, and the text of the selected trees is written out
+   byte for byte. Trees before the burn-in or between two selected trees are
+   passed over, or not visited at all if the file has an index.
+
+   Trees of a NEXUS file are copied as whole TREE commands, preceded by the
+   part of the file up to the first TREE command, which holds the TRANSLATE
+   table their tip numbers refer to */
+
+/* Returns the start of the line of pos if only blanks precede pos on that
+   line, such that the indentation of a TREE command is copied as well */
+static size_t line_start(const char * data, size_t pos)
+{
+  size_t start = pos;
+
+  while (start && (data[start-1] == ' ' || data[start-1] == '\t'))
+    --start;
+
+  return (!start || data[start-1] == '\n') ? start : pos;
+}
+
+/* Returns the position of the newick string of the first tree at or after
+   pos, or the file size if there is none, and stores in copy the position
+   the text of the tree is copied from */
+static size_t find_tree(const lexer_t * lexer, size_t pos, size_t * copy)
+{
+  size_t start;
+
+  if (!lexer->nexus)
+    return *copy = lexer_tree_start(lexer, pos);
+
+  *copy = lexer->size;
+  start = nexus_next_tree(lexer->data, lexer->size, pos, copy);
+  *copy = line_start(lexer->data, *copy);
+
+  return start;
+}
+
+void cmd_copy_trees(void)
+{
+  lexer_t lexer;
+  FILE * out;
+  writer_t * w;
+  unsigned long * offsets;
+  long count = 0;
+  long copied = 0;
+  long n = 0;
+  long target;
+  size_t pos = 0;
+  size_t start;
+  size_t copy;
+  size_t end;
+
+  if (snapshot_probe(opt_treefile))
+    fatal("File %s is a snapshot, select its trees with --export_snapshot "
+          "instead", opt_treefile);
+
+  if (!lexer_open(&lexer, opt_treefile))
+    fatal("%s", errmsg);
+
+  offsets = index_load(opt_treefile, &lexer, &count);
+
+  if (BURNIN_RELATIVE)
+    trees_burnin(offsets ? count : lexer_count_trees(&lexer));
+  else
+    trees_burnin(0);
+
+  out = opt_outfile ? xopen(opt_outfile, "w") : stdout;
+  w = writer_open(out);
+
+  while ((target = trees_next_selected(n)))
+  {
+    if (offsets)
+    {
+      if (target > count)
+        break;
+
+      /* the TREE keyword of a NEXUS command lies after the previous tree */
+      pos = target > 1 ? lexer_tree_end(&lexer, offsets[target-2]) : 0;
+      n = target-1;
+    }
+
+    for (; n < target-1; ++n)
+    {
+      pos = lexer_tree_start(&lexer, pos);
+      if (pos == lexer.size)
+        break;
+      pos = lexer_tree_end(&lexer, pos);
+    }
+
+    start = find_tree(&lexer, pos, &copy);
+    if (start == lexer.size)
+      break;
+
+    if (!copied && lexer.nexus)
+    {
+      size_t first;
+
+      find_tree(&lexer, 0, &first);
+      writer_write(w, lexer.data, first);
+    }
+
+    end = lexer_tree_end(&lexer, start);
+    writer_write(w, lexer.data + copy, end - copy);
+    writer_write(w, "\n", 1);
+
+    ++copied;
+    n = target;
+    pos = end;
+  }
+
+  if (copied && lexer.nexus)
+    writer_write(w, "END;\n", 5);
+
+  writer_close(w);
+
+  if (opt_outfile)
+    fclose(out);
+
+  if (!copied)
+    fatal("File %s does not contain any of the selected trees", opt_treefile);
+
+  if (!opt_quiet && opt_outfile)
+    fprintf(stdout, "Copied %ld trees of %s to %s\n",
+            copied, opt_treefile, opt_outfile);
+
+  free(offsets);
+  lexer_close(&lexer);
+}
@@ -24,8 +24,10 @@
 void cmd_randomtree_binary(void)
 {
   FILE * out;
+  writer_t * w;
   int i;
   char * label;
+  arena_t * arena = arena_create();
 
   /* create array of nodes */
   rtree_t ** nodes = (rtree_t **)xmalloc(opt_randomtree_tips *
@@ -34,9 +36,10 @@ void cmd_randomtree_binary(void)
   /* allocate tip nodes */
   for (i = 0; i < opt_randomtree_tips; ++i)
   {
-    nodes[i] = (rtree_t *)xmalloc(sizeof(rtree_t));
+    nodes[i] = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
     asprintf(&label, "%d", i);
-    nodes[i]->label = label;
+    nodes[i]->label = label_intern(label, strlen(label));
+    free(label);
     nodes[i]->leaves = 1;
     nodes[i]->left = nodes[i]->right = NULL;
     nodes[i]->length = rnd_uniform(opt_randomtree_minbranch,
@@ -72,7 +75,7 @@ void cmd_randomtree_binary(void)
     /* decrease number of nodes in list */
     --count;
 
-    nodes[count] = (rtree_t *)xmalloc(sizeof(rtree_t));
+    nodes[count] = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
     nodes[count]->parent = NULL;
     nodes[count]->left = a;
     nodes[count]->right = b;
@@ -89,21 +92,19 @@ void cmd_randomtree_binary(void)
                                          opt_randomtree_maxbranch);
   }
 
-  char * newick = rtree_export_newick(nodes[0]);
-
   /* attempt to open output file */
   out = opt_outfile ?
           xopen(opt_outfile,"w") : stdout;
 
-  
-  fprintf(out, "%s\n", newick); 
+  w = writer_open(out);
+  rtree_stream_newick(w, nodes[0]);
+  writer_close(w);
 
   if (opt_outfile)
     fclose(out);
 
   rtree_destroy(nodes[0]);
   free(nodes);
-  free(newick);
 
 }
 
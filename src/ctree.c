@@ -0,0 +1,357 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Parser of --compact. Trees are read directly from the tokens of the
+   lexer into compact flat trees (see ftree.c), without building any node
+   records. A node is numbered once its text has been read completely, which
+   happens in postorder, so the root is the last node. The only other state
+   is a stack with the open parentheses, and the parser does not recurse,
+   such that the depth of a tree is only limited by the available memory.
+
+   Commands that work on the flat tree itself (--info, --extract_tips,
+   --export_newick and --export_snapshot) never need more memory per node
+   than that. All other commands convert each tree to the structure they
+   work with, see forest.c */
+
+#define CTREE_INITIAL_NODES 64
+
+struct ctree_parser_s
+{
+  lexer_t lexer;
+  ftree_t * tree;               /* tree being parsed */
+  int alloc;                    /* room for nodes in the arrays of tree */
+  trav_stack_t open;            /* open parentheses */
+  int nonbinary_cnt;
+  int eof_reached;
+  char errmsg[200];
+  size_t error_pos;             /* start of the token the error occurred at */
+  size_t tree_pos;              /* lexer position before the current tree */
+  int tree_seek;                /* whether the lexer was moved to the tree */
+};
+
+/* tokens expected where parsing can fail, as the ntree parser names them.
+   In place of a tree it only names the end of the input */
+static const int expect_tree[] = {LEX_EOF};
+static const int expect_subtree[] = {LEX_OPAR, LEX_STRING, LEX_NUMBER};
+static const int expect_length[] = {LEX_NUMBER};
+static const int expect_end[] = {LEX_SEMICOLON};
+static const int expect_next[] = {LEX_CPAR, LEX_COMMA};
+
+ctree_parser_t * ctree_parser_create(void)
+{
+  return (ctree_parser_t *)xcalloc(1, sizeof(ctree_parser_t));
+}
+
+void ctree_parser_destroy(ctree_parser_t * parser)
+{
+  lexer_close(&parser->lexer);
+  trav_stack_free(&parser->open);
+  free(parser);
+}
+
+/* as ntree_parser_open(), a compressed file is read through the window of
+   the lexer */
+int ctree_parser_open(ctree_parser_t * parser, const char * filename)
+{
+  parser->eof_reached = 0;
+  parser->errmsg[0] = 0;
+
+  return lexer_open_stream(&parser->lexer, filename);
+}
+
+/* appends a node without children, length or label to the tree */
+static int node_add(ctree_parser_t * parser)
+{
+  ftree_t * tree = parser->tree;
+  int i = tree->node_count;
+
+  if (i == parser->alloc)
+  {
+    if (parser->alloc > INT_MAX / 2)
+      fatal("Tree has too many nodes");
+    parser->alloc *= 2;
+    ftree_resize(tree, parser->alloc);
+  }
+
+  tree->parent[i] = -1;
+  tree->left[i] = -1;
+  tree->sibling[i] = -1;
+  tree->taxon[i] = -1;
+  tree->flength[i] = 0;
+  tree->has_length[i >> 3] &= (unsigned char)~(1 << (i & 7));
+  tree->node_count++;
+
+  return i;
+}
+
+/* Appends the completed node as the next child of the innermost open
+   parenthesis. The child of its frame is the last node attached so far,
+   and the sibling links of the attached nodes lead back to the first one
+   until the parenthesis is closed */
+static void node_attach(ctree_parser_t * parser, int node)
+{
+  trav_frame_t * f = parser->open.frames + parser->open.top - 1;
+
+  parser->tree->sibling[node] = f->child;
+  f->child = node;
+}
+
+/* closes the innermost parenthesis and returns the new inner node, whose
+   children are put back in their order */
+static int node_close(ctree_parser_t * parser)
+{
+  int c = parser->open.frames[--parser->open.top].child;
+  int node = node_add(parser);
+  ftree_t * tree = parser->tree;
+  int count = 0;
+
+  while (c != -1)
+  {
+    int prev = tree->sibling[c];
+
+    tree->sibling[c] = tree->left[node];
+    tree->left[node] = c;
+    tree->parent[c] = node;
+    c = prev;
+    ++count;
+  }
+
+  if (count != 2)
+    ++parser->nonbinary_cnt;
+
+  return node;
+}
+
+static void open_push(ctree_parser_t * parser)
+{
+  TRAV_PUSH(&parser->open, NULL);
+  parser->open.frames[parser->open.top - 1].child = -1;
+}
+
+static void parse_error(ctree_parser_t * parser,
+                        int token,
+                        const int * expected,
+                        int count)
+{
+  ntree_syntax_error(parser->errmsg, 200, token, expected, count);
+  parser->error_pos = parser->lexer.token;
+}
+
+/* Parses an optional ":length" starting at token and stores the length of
+   the node. Returns the token that follows, or -1 on error */
+static int parse_length(ctree_parser_t * parser, int token, int node)
+{
+  lexeme_t lexeme;
+
+  if (token != LEX_COLON)
+    return token;
+
+  token = lexer_next(&parser->lexer, &lexeme);
+  if (token != LEX_NUMBER)
+  {
+    parse_error(parser, token, expect_length, 1);
+    return -1;
+  }
+  ftree_set_length(parser->tree, node, lexeme.number);
+
+  return lexer_next(&parser->lexer, &lexeme);
+}
+
+/* Parses the tokens of one tree. Returns 0 on success */
+static int parse_tree(ctree_parser_t * parser)
+{
+  lexer_t * lexer = &parser->lexer;
+  lexeme_t lexeme;
+  char * label;
+  int token;
+  int node;
+
+  token = lexer_next(lexer, &lexeme);
+  if (token == LEX_EOF)
+  {
+    parser->eof_reached = 1;
+    return 0;
+  }
+
+  if (token != LEX_OPAR && token != LEX_STRING && token != LEX_NUMBER)
+  {
+    parse_error(parser, token, expect_tree, 1);
+    return 1;
+  }
+
+  while (1)
+  {
+    /* a subtree starts with its opening parentheses and the first tip */
+    while (token == LEX_OPAR)
+    {
+      open_push(parser);
+      token = lexer_next(lexer, &lexeme);
+    }
+
+    if (token != LEX_STRING && token != LEX_NUMBER)
+    {
+      parse_error(parser, token, expect_subtree, 3);
+      return 1;
+    }
+
+    node = node_add(parser);
+    if ((label = lexer_tip_label(lexer, lexeme)))
+      parser->tree->taxon[node] = label_id(label);
+    parser->tree->tip_count++;
+
+    token = parse_length(parser, lexer_next(lexer, &lexeme), node);
+    if (token == -1)
+      return 1;
+
+    /* close the parentheses that end at this node */
+    while (1)
+    {
+      if (!parser->open.top)
+      {
+        if (token != LEX_SEMICOLON)
+        {
+          parse_error(parser, token, expect_end, 1);
+          return 1;
+        }
+        return 0;
+      }
+
+      node_attach(parser, node);
+
+      if (token == LEX_COMMA)
+        break;
+
+      if (token != LEX_CPAR)
+      {
+        parse_error(parser, token, expect_next, 2);
+        return 1;
+      }
+
+      node = node_close(parser);
+
+      token = lexer_next(lexer, &lexeme);
+      if (token == LEX_STRING || token == LEX_NUMBER)
+      {
+        if ((label = lexeme_intern(lexeme)))
+          parser->tree->taxon[node] = label_id(label);
+        token = lexer_next(lexer, &lexeme);
+      }
+
+      token = parse_length(parser, token, node);
+      if (token == -1)
+        return 1;
+    }
+
+    token = lexer_next(lexer, &lexeme);
+  }
+}
+
+/* Returns the next tree, or NULL at the end of the input or when the tree
+   cannot be parsed, which can be told apart with ctree_parser_eof() */
+ftree_t * ctree_parser_next(ctree_parser_t * parser)
+{
+  ftree_t * tree;
+  int root_degree;
+
+  if (parser->eof_reached) return NULL;
+
+  parser->tree_pos = parser->lexer.pos;
+  parser->tree_seek = parser->lexer.in_tree;
+  parser->errmsg[0] = 0;
+  parser->nonbinary_cnt = 0;
+  parser->open.top = 0;
+
+  parser->alloc = CTREE_INITIAL_NODES;
+  parser->tree = tree = ftree_create(parser->alloc, 1);
+  tree->node_count = 0;
+  tree->tip_count = 0;
+
+  if (parse_tree(parser) || parser->eof_reached)
+  {
+    ftree_destroy(tree);
+    parser->tree = NULL;
+    return NULL;
+  }
+
+  /* give back the room of the last doubling */
+  ftree_resize(tree, tree->node_count);
+  tree->root = tree->node_count - 1;
+
+  /* the degree of the root was counted like that of other inner nodes */
+  root_degree = 0;
+  if (tree->left[tree->root] != -1)
+  {
+    int c;
+
+    for (c = tree->left[tree->root]; c != -1; c = tree->sibling[c])
+      ++root_degree;
+    if (root_degree != 2)
+      --parser->nonbinary_cnt;
+  }
+
+  tree->tree_type = TREE_NARY;
+  if (!parser->nonbinary_cnt && root_degree == 2)
+    tree->tree_type = TREE_ROOTED;
+  else if (!parser->nonbinary_cnt && root_degree == 3)
+    tree->tree_type = TREE_UNROOTED;
+
+  parser->tree = NULL;
+  return tree;
+}
+
+int ctree_parser_eof(ctree_parser_t * parser)
+{
+  return parser->eof_reached;
+}
+
+const char * ctree_parser_error(ctree_parser_t * parser)
+{
+  return parser->errmsg;
+}
+
+size_t ctree_parser_error_pos(ctree_parser_t * parser)
+{
+  return parser->error_pos;
+}
+
+/* Once ctree_parser_next() failed, moves past the tree it could not parse
+   and stores its extent in start and end, like ntree_parser_skip() */
+void ctree_parser_skip(ctree_parser_t * parser, size_t * start, size_t * end)
+{
+  lexer_t * lexer = &parser->lexer;
+
+  *start = parser->tree_pos;
+  if (!lexer->nexus || !parser->tree_seek)
+    *start = lexer_tree_start(lexer, *start);
+
+  *end = lexer_tree_end(lexer, *start);
+
+  lexer->pos = *end;
+  lexer->in_tree = 0;
+  parser->eof_reached = 0;
+}
+
+lexer_t * ctree_parser_lexer(ctree_parser_t * parser)
+{
+  return &parser->lexer;
+}
@@ -0,0 +1,686 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+#include <poll.h>
+#include <sys/inotify.h>
+
+/* Following a growing tree file, such as the sample of a running MCMC
+   analysis. The file is read with read() from where the last read stopped,
+   and the new bytes are appended to the text not yet processed. A tree is
+   processed once its terminating semicolon has arrived, and everything up
+   to the end of the last processed tree is then dropped from the buffer, so
+   memory usage does not grow with the file.
+
+   Between reads we sleep until inotify reports a change of the file, or at
+   most FOLLOW_POLL_MS milliseconds, which is all the waiting there is on
+   systems or file systems without inotify. Following stops once the TREES
+   block of a NEXUS file ends, once the last tree selected by --trees has
+   been read, or when the file is deleted or renamed.
+
+   A rolling summary of the trees processed so far is printed after every
+   read that completed at least one selected tree. It covers the tree
+   length and the frequencies of the splits (bipartitions of the tips) that
+   the trees share, and with --output_file the frequency of every split is
+   written to that file each time. Trees that cannot be parsed are reported
+   and skipped like in any other command.
+
+   The tips of the first tree are numbered in postorder, and a split is the
+   bit set of the tips on the side of a branch that does not hold tip 0.
+   The sets of all nodes of a tree are built bottom up, which takes a bit
+   per tip for each node, and looked up in a hash table of the distinct
+   splits seen so far. Branches to tips and, in rooted trees, the second
+   branch below the root, which splits the tips in the same way as the
+   first, are not counted. Consensus trees are not built */
+
+#define FOLLOW_POLL_MS    1000
+#define FOLLOW_READ_SIZE  1048576
+
+typedef struct split_table_s
+{
+  int tips;                     /* tips of the first tree, 0 before it */
+  int words;                    /* 64-bit words per set */
+  int disabled;                 /* set if the first tree has unusable tips */
+  int * tip_index;              /* number of each label id, -1 if none */
+  int tip_index_size;
+  int * tip_label;              /* label id of each tip number */
+  long trees;                   /* trees whose splits were counted */
+  long skipped;                 /* trees with other tips, not counted */
+
+  uint64_t * sets;              /* words of each split */
+  long * count;                 /* trees each split occurs in */
+  long * last_tree;             /* last tree each split was counted for */
+  double * reported;            /* frequency at the last summary */
+  long split_count;
+  long split_alloc;
+
+  long * slots;                 /* split of each slot, or -1 */
+  long slot_count;
+} split_table_t;
+
+typedef struct follow_stats_s
+{
+  long trees;
+  int tips;
+  double length;                /* tree length of the last tree */
+  double mean;
+  double m2;                    /* sum of squared deviations from the mean */
+  double min;
+  double max;
+} follow_stats_t;
+
+/* Sum of the branch lengths of the tree, not counting the branch above the
+   root */
+static double tree_length(const ftree_t * tree)
+{
+  int i;
+  double length = 0;
+
+  for (i = 0; i < tree->node_count; ++i)
+    if (i != tree->root && FTREE_HAS_LENGTH(tree, i))
+      length += FTREE_LENGTH(tree, i);
+
+  return length;
+}
+
+/* adds a tree to the running mean and variance (Welford's method) */
+static void stats_add(follow_stats_t * stats, const ftree_t * tree, int tips)
+{
+  double length = tree_length(tree);
+  double delta = length - stats->mean;
+
+  stats->trees++;
+  stats->tips = tips;
+  stats->length = length;
+  stats->mean += delta / stats->trees;
+  stats->m2 += delta * (length - stats->mean);
+
+  if (stats->trees == 1 || length < stats->min)
+    stats->min = length;
+  if (stats->trees == 1 || length > stats->max)
+    stats->max = length;
+}
+
+static void stats_print(const follow_stats_t * stats, long n)
+{
+  double sd = stats->trees > 1 ?
+              sqrt(stats->m2 / (stats->trees - 1)) : 0;
+
+  fprintf(stdout,
+          "Tree %ld: %ld trees processed, %d tips, tree length %f "
+          "(mean %f, sd %f, min %f, max %f)\n",
+          n, stats->trees, stats->tips, stats->length,
+          stats->mean, sd, stats->min, stats->max);
+  fflush(stdout);
+}
+
+static unsigned int hash_set(const uint64_t * set, int words)
+{
+  unsigned int hash = 2166136261U;
+  const unsigned char * p = (const unsigned char *)set;
+  size_t i;
+
+  for (i = 0; i < words * sizeof(uint64_t); ++i)
+  {
+    hash ^= p[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+/* returns the slot holding the split, or the empty slot where it belongs */
+static long find_slot(const split_table_t * t, const uint64_t * set)
+{
+  long mask = t->slot_count - 1;
+  long i = (long)(hash_set(set, t->words) & (unsigned int)mask);
+  size_t size = t->words * sizeof(uint64_t);
+
+  while (t->slots[i] != -1 &&
+         memcmp(t->sets + t->slots[i] * t->words, set, size))
+    i = (i+1) & mask;
+
+  return i;
+}
+
+static void rehash(split_table_t * t)
+{
+  long i;
+
+  free(t->slots);
+  t->slot_count = t->slot_count ? 2*t->slot_count : 1024;
+  t->slots = (long *)xmalloc(t->slot_count * sizeof(long));
+
+  for (i = 0; i < t->slot_count; ++i)
+    t->slots[i] = -1;
+  for (i = 0; i < t->split_count; ++i)
+    t->slots[find_slot(t, t->sets + i * t->words)] = i;
+}
+
+/* counts a split for tree n, unless it was counted for that tree already */
+static void split_insert(split_table_t * t, const uint64_t * set, long n)
+{
+  long slot;
+  long i;
+
+  if (2 * (t->split_count + 1) > t->slot_count)
+    rehash(t);
+
+  slot = find_slot(t, set);
+  i = t->slots[slot];
+  if (i == -1)
+  {
+    if (t->split_count == t->split_alloc)
+    {
+      t->split_alloc = t->split_alloc ? 2*t->split_alloc : 1024;
+      t->sets = (uint64_t *)xrealloc(t->sets, t->split_alloc * t->words *
+                                              sizeof(uint64_t));
+      t->count = (long *)xrealloc(t->count, t->split_alloc * sizeof(long));
+      t->last_tree = (long *)xrealloc(t->last_tree,
+                                      t->split_alloc * sizeof(long));
+      t->reported = (double *)xrealloc(t->reported,
+                                       t->split_alloc * sizeof(double));
+    }
+
+    i = t->split_count++;
+    memcpy(t->sets + i * t->words, set, t->words * sizeof(uint64_t));
+    t->count[i] = 0;
+    t->last_tree[i] = 0;
+    t->reported[i] = 0;
+    t->slots[slot] = i;
+  }
+
+  if (t->last_tree[i] != n)
+  {
+    t->count[i]++;
+    t->last_tree[i] = n;
+  }
+}
+
+/* numbers the tips of the first tree. Returns 0 if a tip has no label or
+   shares it with another tip */
+static int splits_init(split_table_t * t, const ftree_t * tree)
+{
+  int i;
+
+  t->words = (tree->tip_count + 63) / 64;
+  t->tip_label = (int *)xmalloc(tree->tip_count * sizeof(int));
+
+  for (i = 0; i < tree->node_count; ++i)
+    if (tree->left[i] == -1 && tree->taxon[i] >= t->tip_index_size)
+      t->tip_index_size = tree->taxon[i] + 1;
+
+  t->tip_index = (int *)xmalloc((t->tip_index_size + 1) * sizeof(int));
+  for (i = 0; i < t->tip_index_size; ++i)
+    t->tip_index[i] = -1;
+
+  for (i = 0; i < tree->node_count; ++i)
+  {
+    int id = tree->taxon[i];
+
+    if (tree->left[i] != -1)
+      continue;
+
+    if (id == -1 || t->tip_index[id] != -1)
+      return 0;
+
+    t->tip_index[id] = t->tips;
+    t->tip_label[t->tips++] = id;
+  }
+
+  return 1;
+}
+
+/* Counts the splits of tree n, which is the first tree or has the same tips
+   as the first tree */
+static void splits_add(split_table_t * t, const ftree_t * tree, long n)
+{
+  int i, k;
+  int words;
+  uint64_t last_mask;
+
+  if (t->disabled)
+    return;
+
+  if (!t->tips && !splits_init(t, tree))
+  {
+    fprintf(stderr, "Warning: Tips of tree %ld are not labelled uniquely, "
+                    "split frequencies are not computed\n", n);
+    t->disabled = 1;
+    return;
+  }
+
+  words = t->words;
+
+  uint64_t * sets = (uint64_t *)xcalloc((size_t)tree->node_count * words,
+                                        sizeof(uint64_t));
+  int * size = (int *)xcalloc(tree->node_count, sizeof(int));
+  int tips = 0;
+
+  /* children have smaller numbers than their parent, so each set is
+     complete when it is added to the set of the parent */
+  for (i = 0; i < tree->node_count; ++i)
+  {
+    uint64_t * set = sets + (size_t)i * words;
+    int p = tree->parent[i];
+
+    if (tree->left[i] == -1)
+    {
+      int id = tree->taxon[i];
+      int tip = (id == -1 || id >= t->tip_index_size) ? -1 : t->tip_index[id];
+
+      if (tip == -1 || (set[tip / 64] >> (tip % 64) & 1))
+        break;
+      set[tip / 64] |= (uint64_t)1 << (tip % 64);
+      size[i] = 1;
+      ++tips;
+    }
+
+    if (p != -1)
+    {
+      for (k = 0; k < words; ++k)
+        sets[(size_t)p * words + k] |= set[k];
+      size[p] += size[i];
+    }
+  }
+
+  if (i < tree->node_count || tips != t->tips ||
+      size[tree->root] != t->tips)
+  {
+    if (!t->skipped++)
+      fprintf(stderr, "Warning: Tree %ld does not have the tips of the first "
+                      "tree, the splits of such trees are not counted\n", n);
+    free(sets);
+    free(size);
+    return;
+  }
+
+  last_mask = (t->tips % 64) ? ((uint64_t)1 << (t->tips % 64)) - 1 :
+                               ~(uint64_t)0;
+
+  for (i = 0; i < tree->node_count; ++i)
+  {
+    uint64_t * set = sets + (size_t)i * words;
+
+    if (i == tree->root || size[i] < 2 || size[i] > t->tips - 2)
+      continue;
+
+    /* take the side without tip 0 */
+    if (set[0] & 1)
+    {
+      for (k = 0; k < words; ++k)
+        set[k] = ~set[k];
+      set[words-1] &= last_mask;
+    }
+
+    split_insert(t, set, n);
+  }
+
+  t->trees++;
+
+  free(sets);
+  free(size);
+}
+
+/* table whose splits are being sorted */
+static const split_table_t * splits_sorted;
+
+static int cb_count_desc(const void * a, const void * b)
+{
+  long x = *(const long *)a;
+  long y = *(const long *)b;
+  long cx = splits_sorted->count[x];
+  long cy = splits_sorted->count[y];
+
+  if (cx != cy)
+    return cx > cy ? -1 : 1;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Writes the frequency of every split to --output_file, most frequent
+   first. A split is written as a string with a star for each tip in the
+   set and a dot for every other tip, in the order listed before */
+static void splits_write(split_table_t * t)
+{
+  long i;
+  int k;
+  long * order;
+  FILE * out = xopen(opt_outfile, "w");
+
+  fprintf(out, "Trees: %ld\nTips:\n", t->trees);
+  for (k = 0; k < t->tips; ++k)
+    fprintf(out, "%d %s\n", k + 1, label_string(t->tip_label[k]));
+
+  order = (long *)xmalloc((t->split_count + 1) * sizeof(long));
+  for (i = 0; i < t->split_count; ++i)
+    order[i] = i;
+  splits_sorted = t;
+  qsort(order, t->split_count, sizeof(long), cb_count_desc);
+
+  fprintf(out, "Splits:\n");
+  for (i = 0; i < t->split_count; ++i)
+  {
+    const uint64_t * set = t->sets + order[i] * t->words;
+
+    for (k = 0; k < t->tips; ++k)
+      fputc((set[k / 64] >> (k % 64) & 1) ? '*' : '.', out);
+    fprintf(out, " %ld %f\n", t->count[order[i]],
+            (double)t->count[order[i]] / t->trees);
+  }
+
+  free(order);
+  fclose(out);
+}
+
+/* Prints the number of distinct splits, those in more than half of the
+   trees, and the largest change of a split frequency since the previous
+   summary */
+static void splits_print(split_table_t * t)
+{
+  long i;
+  long majority = 0;
+  double change = 0;
+
+  if (t->disabled || !t->trees)
+    return;
+
+  for (i = 0; i < t->split_count; ++i)
+  {
+    double freq = (double)t->count[i] / t->trees;
+
+    if (2 * t->count[i] > t->trees)
+      ++majority;
+    change = MAX(change, fabs(freq - t->reported[i]));
+    t->reported[i] = freq;
+  }
+
+  fprintf(stdout,
+          "  %ld distinct splits, %ld in more than half of the trees, "
+          "largest change in frequency %f\n",
+          t->split_count, majority, change);
+  if (t->skipped)
+    fprintf(stdout, "  %ld trees with other tips were left out\n",
+            t->skipped);
+  fflush(stdout);
+
+  if (opt_outfile)
+    splits_write(t);
+}
+
+static void splits_free(split_table_t * t)
+{
+  free(t->tip_index);
+  free(t->tip_label);
+  free(t->sets);
+  free(t->count);
+  free(t->last_tree);
+  free(t->reported);
+  free(t->slots);
+}
+
+/* Appends the bytes written to the file since the last call to the buffer,
+   which is kept terminated by a zero byte. Returns the number of bytes */
+static size_t read_appended(int fd,
+                            char ** buffer,
+                            size_t * len,
+                            size_t * alloc)
+{
+  size_t total = 0;
+  ssize_t bytes;
+
+  while (1)
+  {
+    if (*alloc - *len < FOLLOW_READ_SIZE + 1)
+    {
+      *alloc = MAX(2 * *alloc, *len + FOLLOW_READ_SIZE + 1);
+      *buffer = (char *)xrealloc(*buffer, *alloc);
+    }
+
+    bytes = read(fd, *buffer + *len, FOLLOW_READ_SIZE);
+    if (bytes < 0)
+    {
+      if (errno == EINTR) continue;
+      fatal("Unable to read %s (%s)", opt_treefile, strerror(errno));
+    }
+    if (!bytes)
+      break;
+
+    *len += (size_t)bytes;
+    total += (size_t)bytes;
+  }
+
+  (*buffer)[*len] = 0;
+  return total;
+}
+
+/* Sleeps until the file changes or the polling interval has passed.
+   Returns 0 if the file was deleted or moved away */
+static int wait_for_change(int watch_fd)
+{
+  struct pollfd pfd;
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  ssize_t i;
+
+  if (watch_fd == -1)
+  {
+    poll(NULL, 0, FOLLOW_POLL_MS);
+    return 1;
+  }
+
+  pfd.fd = watch_fd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, FOLLOW_POLL_MS) <= 0)
+    return 1;
+
+  len = read(watch_fd, events, sizeof(events));
+  for (i = 0; i < len; )
+  {
+    struct inotify_event * event = (struct inotify_event *)(events + i);
+
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+      return 0;
+
+    i += (ssize_t)(sizeof(struct inotify_event) + event->len);
+  }
+
+  return 1;
+}
+
+void cmd_follow(void)
+{
+  follow_stats_t stats;
+  split_table_t splits;
+  ntree_parser_t * parser;
+  nexus_t * nexus = NULL;
+  lexer_t scan;
+  struct stat st;
+  char * buffer = NULL;
+  size_t len = 0;
+  size_t alloc = 0;
+  size_t offset = 0;            /* bytes of the file read so far */
+  long lines = 0;               /* line breaks before the buffer */
+  size_t pos;
+  size_t start;
+  size_t end;
+  int format_known = 0;
+  int done = 0;
+  int watch_fd;
+  long n = 0;
+  long next;
+  long reported = 0;
+
+  if (BURNIN_RELATIVE)
+    fatal("The number of trees of a file that is still growing is unknown, "
+          "give --burnin as a number of trees");
+  trees_burnin(0);
+
+  int fd = open(opt_treefile, O_RDONLY);
+  if (fd == -1)
+    fatal("Unable to open file %s (%s)", opt_treefile, strerror(errno));
+
+  watch_fd = inotify_init1(IN_CLOEXEC);
+  if (watch_fd != -1 &&
+      inotify_add_watch(watch_fd, opt_treefile,
+                        IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                        IN_DELETE_SELF | IN_MOVE_SELF) == -1)
+  {
+    close(watch_fd);
+    watch_fd = -1;
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  memset(&splits, 0, sizeof(splits));
+  parser = ntree_parser_create();
+  reject_open();
+  next = trees_next_selected(0);
+
+  while (!done)
+  {
+    offset += read_appended(fd, &buffer, &len, &alloc);
+
+    if (fstat(fd, &st))
+      fatal("Unable to read %s (%s)", opt_treefile, strerror(errno));
+
+    if ((size_t)st.st_size < offset)
+      fatal("File %s was truncated while following it", opt_treefile);
+
+    if (!format_known && len)
+    {
+      size_t first = 0;
+
+      while (first < len && isspace((unsigned char)buffer[first]))
+        ++first;
+
+      if (first < len && buffer[first] == 0x1f)
+        fatal("File %s is compressed, which cannot be followed", opt_treefile);
+
+      /* a NEXUS file is processed once its first TREE command has arrived,
+         as the TRANSLATE table precedes it */
+      if (first < len && buffer[first] != '#')
+        format_known = 1;
+      else if (nexus_probe(buffer, len))
+      {
+        if (nexus_next_tree(buffer, len, 0, NULL) < len)
+        {
+          nexus = nexus_create(buffer, len);
+          format_known = 1;
+        }
+      }
+      else if (len - first >= 6)
+        format_known = 1;
+    }
+
+    if (format_known)
+    {
+      lexer_init(&scan, buffer, len, nexus);
+
+      for (pos = 0; !done; pos = end)
+      {
+        ntree_t * tree;
+        int tips;
+        int type;
+
+        start = lexer_tree_start(&scan, pos);
+        if (start == len)
+        {
+          done = nexus && nexus_block_end(buffer, len, pos);
+          break;
+        }
+
+        end = lexer_tree_end(&scan, start);
+        if (buffer[end-1] != ';')
+          break;
+
+        ++n;
+        if (n != next)
+          continue;
+
+        ntree_parser_set_buffer(parser, buffer + pos, end - pos, nexus);
+        tree = ntree_parser_next(parser, &tips, &type);
+        if (!tree)
+        {
+          size_t error = pos + ntree_parser_error_pos(parser);
+
+          /* the semicolon may belong to a quoted label still being written */
+          if (end == len)
+          {
+            --n;
+            break;
+          }
+
+          reject_tree(n, offset - len + error,
+                      lines + 1 + lexer_count_lines(&scan, 0, error),
+                      ntree_parser_error(parser), buffer + start, end - start);
+          next = trees_next_selected(n);
+          if (!next)
+            done = 1;
+          continue;
+        }
+
+        ftree_t * ftree = ftree_from_ntree(tree);
+
+        ntree_destroy(tree);
+        stats_add(&stats, ftree, tips);
+        splits_add(&splits, ftree, n);
+        ftree_destroy(ftree);
+
+        next = trees_next_selected(n);
+        if (!next)
+          done = 1;
+      }
+
+      /* keep only the text of the trees that are not complete yet */
+      lines += lexer_count_lines(&scan, 0, pos);
+      memmove(buffer, buffer + pos, len - pos + 1);
+      len -= pos;
+      lexer_close(&scan);
+    }
+
+    if (stats.trees > reported)
+    {
+      stats_print(&stats, n);
+      splits_print(&splits);
+      reported = stats.trees;
+    }
+
+    /* a deleted file is only reported by inotify (IN_DELETE_SELF) once we
+       close it, so check its link count, which works when polling too */
+    if (!done && (!st.st_nlink || !wait_for_change(watch_fd)))
+      break;
+  }
+
+  if (!opt_quiet)
+    fprintf(stdout, "Stopped following %s after %ld trees\n",
+            opt_treefile, n);
+
+  if (watch_fd != -1)
+    close(watch_fd);
+  close(fd);
+
+  reject_close();
+  splits_free(&splits);
+  ntree_parser_destroy(parser);
+  if (nexus)
+    nexus_destroy(nexus);
+  free(buffer);
+}
@@ -0,0 +1,931 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Trees of a file are either parsed one after the other by the calling
+   thread, or, with more than one thread, in parallel: the file is split into
+   chunks of consecutive trees, each chunk is parsed by a worker thread with
+   its own parser instance, and the trees are handed out in file order by
+   forest_next(). The number of chunks parsed ahead of the caller is bounded
+   to keep the memory usage in check.
+
+   With --trees or --burnin, only the selected trees are parsed, by the
+   calling thread. The others are skipped with a scan for the semicolon
+   ending them, or, if the file has an index, not read at all.
+
+   A compressed file read by the calling thread is inflated a window at a
+   time, which is moved forward before each tree (see lexer_window()). It
+   is inflated as a whole for the parallel reader, which splits it into
+   chunks, to count its trees for a relative --burnin, and to seek to the
+   offsets of its index.
+
+   With --compact, trees are read sequentially into compact flat trees (see
+   ctree.c), which forest_next_ftree() returns as they are, and the other
+   functions convert to the structure the command works with.
+
+   A tree that cannot be parsed does not end the run: the error is reported
+   together with its byte offset and line, the tree is skipped up to its
+   semicolon, and the trees after it are read as usual. The number of
+   skipped trees is reported when the file is closed, and with --quarantine
+   their text is collected in a separate file */
+
+#define FOREST_CHUNK_SIZE 1048576
+
+typedef struct forest_tree_s
+{
+  rtree_t * rtree;
+  utree_t * utree;
+  ntree_t * ntree;
+  int tree_type;
+  int tip_count;
+} forest_tree_t;
+
+/* a tree of a chunk that could not be parsed, with positions in the file */
+typedef struct chunk_error_s
+{
+  int before;                   /* number of trees of the chunk preceding it */
+  size_t start;
+  size_t end;
+  size_t pos;
+  char errmsg[200];
+} chunk_error_t;
+
+typedef struct chunk_s
+{
+  size_t start;
+  size_t end;
+  forest_tree_t * trees;
+  int count;
+  int alloc;
+  int done;
+  chunk_error_t * errors;
+  int error_count;
+} chunk_t;
+
+/* number of the last tree of the file that was read */
+static long tree_index = 0;
+
+/* number of trees handed out to the caller */
+static long trees_loaded = 0;
+
+/* trees that could not be parsed */
+static long rejected = 0;
+static FILE * quarantine = NULL;
+
+/* line number of file position line_pos, for locating errors without
+   counting the lines from the start of the file every time */
+static size_t line_pos;
+static long line_count;
+
+/* whether the trees are read from a binary snapshot instead of parsed */
+static int from_snapshot = 0;
+
+/* whether worker threads convert binary trees to rtree_t and utree_t */
+static int convert_trees;
+
+static int parallel = 0;
+static lexer_t source;
+static pthread_t * workers;
+static pthread_mutex_t forest_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t chunk_claimable = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t chunk_done = PTHREAD_COND_INITIALIZER;
+
+/* chunk i is stored in ring[i % ring_size] */
+static chunk_t * ring;
+static long ring_size;
+static long chunks_claimed;
+static long chunks_consumed;
+static size_t split_pos;
+static int stop_workers;
+
+/* position of the caller within the current chunk */
+static int chunk_tree;
+static int chunk_error;
+static int forest_eof;
+
+/* selection of trees with --trees */
+static ntree_parser_t * select_parser = NULL;
+static ctree_parser_t * compact_parser = NULL;
+static unsigned long * select_offsets;
+static long select_offsets_count;
+static long file_tree;
+static int select_done;
+
+/* Returns the end of the chunk starting at pos, which is the position after
+   the first semicolon at least FOREST_CHUNK_SIZE bytes after pos, or the end
+   of the file. Semicolons inside quoted labels and comments are skipped by
+   following the same rules as the lexer */
+static size_t next_boundary(size_t pos)
+{
+  const char * data = source.data;
+  size_t size = source.size;
+  size_t target = pos + FOREST_CHUNK_SIZE;
+  char quote;
+
+  while (pos < size)
+  {
+    switch (data[pos])
+    {
+      case '\'':
+      case '"':
+        quote = data[pos++];
+        while (pos < size && data[pos] != quote)
+        {
+          if (data[pos] == '\\' && pos+1 < size &&
+              (data[pos+1] == '\\' || data[pos+1] == quote))
+            ++pos;
+          ++pos;
+        }
+        break;
+
+      case '[':
+        while (pos < size && data[pos] != ']')
+          ++pos;
+        break;
+
+      case ';':
+        if (pos >= target)
+          return pos+1;
+        break;
+    }
+
+    if (pos < size)
+      ++pos;
+  }
+
+  return size;
+}
+
+static void chunk_parse(ntree_parser_t * parser, chunk_t * chunk)
+{
+  forest_tree_t * t;
+  ntree_t * tree;
+  int tip_count;
+  int tree_type;
+
+  ntree_parser_set_buffer(parser,
+                          source.data + chunk->start,
+                          chunk->end - chunk->start,
+                          source.nexus);
+
+  while (1)
+  {
+    tree = ntree_parser_next(parser, &tip_count, &tree_type);
+    if (!tree)
+    {
+      chunk_error_t * e;
+
+      if (ntree_parser_eof(parser))
+        break;
+
+      chunk->errors = (chunk_error_t *)xrealloc(chunk->errors,
+                                                (chunk->error_count + 1) *
+                                                sizeof(chunk_error_t));
+      e = chunk->errors + chunk->error_count++;
+      e->before = chunk->count;
+      e->pos = chunk->start + ntree_parser_error_pos(parser);
+      snprintf(e->errmsg, 200, "%s", ntree_parser_error(parser));
+
+      ntree_parser_skip(parser, &e->start, &e->end);
+      e->start += chunk->start;
+      e->end += chunk->start;
+      continue;
+    }
+
+    if (chunk->count == chunk->alloc)
+    {
+      chunk->alloc = chunk->alloc ? 2*chunk->alloc : 64;
+      chunk->trees = (forest_tree_t *)xrealloc(chunk->trees,
+                                               chunk->alloc *
+                                               sizeof(forest_tree_t));
+    }
+
+    t = chunk->trees + chunk->count++;
+    memset(t, 0, sizeof(forest_tree_t));
+    t->tree_type = tree_type;
+    t->tip_count = tip_count;
+
+    if (convert_trees && tree_type == TREE_ROOTED)
+      t->rtree = ntree_binary_to_rtree(tree);
+    else if (convert_trees && tree_type == TREE_UNROOTED)
+      t->utree = ntree_binary_to_utree(tree);
+    else
+      t->ntree = tree;
+  }
+}
+
+static void * worker(void * arg)
+{
+  ntree_parser_t * parser = ntree_parser_create();
+  chunk_t * chunk;
+
+  pthread_mutex_lock(&forest_mutex);
+
+  while (1)
+  {
+    while (!stop_workers && split_pos < source.size &&
+           chunks_claimed - chunks_consumed >= ring_size)
+      pthread_cond_wait(&chunk_claimable, &forest_mutex);
+
+    if (stop_workers || split_pos == source.size)
+      break;
+
+    chunk = ring + chunks_claimed++ % ring_size;
+    memset(chunk, 0, sizeof(chunk_t));
+    chunk->start = split_pos;
+    chunk->end = next_boundary(split_pos);
+    split_pos = chunk->end;
+
+    pthread_mutex_unlock(&forest_mutex);
+
+    chunk_parse(parser, chunk);
+
+    pthread_mutex_lock(&forest_mutex);
+    chunk->done = 1;
+    pthread_cond_broadcast(&chunk_done);
+  }
+
+  pthread_mutex_unlock(&forest_mutex);
+
+  ntree_parser_destroy(parser);
+
+  return NULL;
+}
+
+/* Reports a tree of the file that could not be parsed, whose text is
+   data[start..end-1], and counts it as read. Positions are in the buffer
+   of the lexer, which starts at offset base of the file */
+static void forest_reject(const lexer_t * file,
+                          size_t start,
+                          size_t end,
+                          size_t pos,
+                          const char * msg)
+{
+  /* errors are reported in file order, so the count of lines continues
+     from the previous error, unless its text has left the buffer */
+  if (file->base + pos < line_pos || line_pos < file->base)
+  {
+    line_pos = file->base;
+    line_count = file->base_lines;
+  }
+  line_count += lexer_count_lines(file, line_pos - file->base, pos);
+  line_pos = file->base + pos;
+
+  reject_tree(++tree_index, line_pos, line_count + 1, msg,
+              file->data + start, end - start);
+}
+
+static void forest_tree_destroy(forest_tree_t * t)
+{
+  if (t->rtree)
+    rtree_destroy(t->rtree);
+  else if (t->utree)
+    utree_destroy(t->utree);
+  else if (t->ntree)
+    ntree_destroy(t->ntree);
+}
+
+static void parallel_open(const char * filename)
+{
+  long i;
+
+  if (!lexer_open(&source, filename))
+    fatal("%s", errmsg);
+
+  parallel = 1;
+  ring_size = 2*opt_threads;
+  ring = (chunk_t *)xcalloc((size_t)ring_size, sizeof(chunk_t));
+  chunks_claimed = chunks_consumed = 0;
+  split_pos = 0;
+  stop_workers = 0;
+  chunk_tree = 0;
+  chunk_error = 0;
+  forest_eof = 0;
+
+  workers = (pthread_t *)xmalloc((size_t)opt_threads * sizeof(pthread_t));
+  for (i = 0; i < opt_threads; ++i)
+    if (pthread_create(workers+i, NULL, worker, NULL))
+      fatal("Unable to create thread");
+}
+
+/* Returns the next tree parsed by the workers, or NULL after the last tree.
+   Trees the workers could not parse are reported when their turn comes */
+static forest_tree_t * parallel_next(void)
+{
+  chunk_t * chunk;
+
+  pthread_mutex_lock(&forest_mutex);
+
+  while (1)
+  {
+    if (chunks_consumed == chunks_claimed && split_pos == source.size)
+    {
+      forest_eof = 1;
+      break;
+    }
+
+    chunk = ring + chunks_consumed % ring_size;
+
+    while (chunks_consumed == chunks_claimed || !chunk->done)
+      pthread_cond_wait(&chunk_done, &forest_mutex);
+
+    while (chunk_error < chunk->error_count &&
+           chunk->errors[chunk_error].before == chunk_tree)
+    {
+      chunk_error_t * e = chunk->errors + chunk_error++;
+      forest_reject(&source, e->start, e->end, e->pos, e->errmsg);
+    }
+
+    if (chunk_tree < chunk->count)
+    {
+      pthread_mutex_unlock(&forest_mutex);
+      return chunk->trees + chunk_tree++;
+    }
+
+    /* the trees of the chunk were handed out and their ownership passed to
+       the caller, so the slot can be reused */
+    free(chunk->trees);
+    free(chunk->errors);
+    chunk->trees = NULL;
+    chunk->errors = NULL;
+    chunk_tree = 0;
+    chunk_error = 0;
+    ++chunks_consumed;
+    pthread_cond_broadcast(&chunk_claimable);
+  }
+
+  pthread_mutex_unlock(&forest_mutex);
+
+  return NULL;
+}
+
+static void parallel_close(void)
+{
+  long i;
+  long j;
+
+  pthread_mutex_lock(&forest_mutex);
+  stop_workers = 1;
+  pthread_cond_broadcast(&chunk_claimable);
+  pthread_mutex_unlock(&forest_mutex);
+
+  for (i = 0; i < opt_threads; ++i)
+    pthread_join(workers[i], NULL);
+
+  /* deallocate the trees that were not handed out */
+  for (i = chunks_consumed; i < chunks_claimed; ++i)
+  {
+    chunk_t * chunk = ring + i % ring_size;
+
+    for (j = (i == chunks_consumed) ? chunk_tree : 0; j < chunk->count; ++j)
+      forest_tree_destroy(chunk->trees + j);
+    free(chunk->trees);
+    free(chunk->errors);
+  }
+
+  free(ring);
+  free(workers);
+  lexer_close(&source);
+  parallel = 0;
+}
+
+/* Opens the file for parsing its trees in the calling thread. Without
+   --trees and --burnin, every tree is selected and none is skipped */
+static void select_open(const char * filename)
+{
+  lexer_t * lexer;
+
+  if (opt_compact)
+  {
+    compact_parser = ctree_parser_create();
+    if (!ctree_parser_open(compact_parser, filename))
+      fatal("%s", errmsg);
+
+    lexer = ctree_parser_lexer(compact_parser);
+  }
+  else
+  {
+    select_parser = ntree_parser_create();
+    if (!ntree_parser_open(select_parser, filename))
+      fatal("%s", errmsg);
+
+    lexer = ntree_parser_lexer(select_parser);
+  }
+
+  if ((BURNIN_RELATIVE || (opt_trees && index_exists(filename))) &&
+      !lexer_load(lexer))
+    fatal("%s", errmsg);
+
+  select_offsets = NULL;
+  if (opt_trees)
+    select_offsets = index_load(filename, lexer, &select_offsets_count);
+
+  /* a relative burn-in needs the number of trees */
+  if (BURNIN_RELATIVE)
+    trees_burnin(select_offsets ? select_offsets_count :
+                                  lexer_count_trees(lexer));
+  else
+    trees_burnin(0);
+}
+
+static void select_window(lexer_t * lexer)
+{
+  if (!lexer_window(lexer))
+    fatal("%s", errmsg);
+}
+
+/* Moves the lexer to the next selected tree, through the index or by
+   skipping the trees in between. Returns 0 if there are no more selected
+   trees */
+static int select_seek(lexer_t * lexer)
+{
+  long target = trees_next_selected(tree_index);
+
+  if (!target)
+  {
+    select_done = 1;
+    return 0;
+  }
+
+  if (select_offsets)
+  {
+    if (target > select_offsets_count)
+    {
+      select_done = 1;
+      return 0;
+    }
+    lexer_seek(lexer, select_offsets[target-1]);
+  }
+  else
+  {
+    for (; file_tree < target-1; ++file_tree)
+    {
+      select_window(lexer);
+      if (!lexer_skip_tree(lexer))
+      {
+        select_done = 1;
+        return 0;
+      }
+    }
+  }
+
+  select_window(lexer);
+
+  tree_index = target-1;
+  file_tree = target;
+
+  return 1;
+}
+
+/* Parses the next selected tree. Selected trees that cannot be parsed are
+   reported and passed over. Returns NULL when there are no more selected
+   trees */
+static ntree_t * select_next(int * tip_count, int * tree_type)
+{
+  lexer_t * lexer = ntree_parser_lexer(select_parser);
+  ntree_t * tree;
+  size_t start;
+  size_t end;
+
+  while (select_seek(lexer))
+  {
+    tree = ntree_parser_next(select_parser, tip_count, tree_type);
+    if (tree)
+      return tree;
+
+    if (ntree_parser_eof(select_parser))
+    {
+      select_done = 1;
+      return NULL;
+    }
+
+    ntree_parser_skip(select_parser, &start, &end);
+    forest_reject(lexer, start, end, ntree_parser_error_pos(select_parser),
+                  ntree_parser_error(select_parser));
+  }
+
+  return NULL;
+}
+
+/* same as select_next() for --compact */
+static ftree_t * select_next_compact(void)
+{
+  lexer_t * lexer = ctree_parser_lexer(compact_parser);
+  ftree_t * tree;
+  size_t start;
+  size_t end;
+
+  while (select_seek(lexer))
+  {
+    tree = ctree_parser_next(compact_parser);
+    if (tree)
+      return tree;
+
+    if (ctree_parser_eof(compact_parser))
+    {
+      select_done = 1;
+      return NULL;
+    }
+
+    ctree_parser_skip(compact_parser, &start, &end);
+    forest_reject(lexer, start, end, ctree_parser_error_pos(compact_parser),
+                  ctree_parser_error(compact_parser));
+  }
+
+  return NULL;
+}
+
+static void select_close(void)
+{
+  if (compact_parser)
+    ctree_parser_destroy(compact_parser);
+  else
+    ntree_parser_destroy(select_parser);
+  free(select_offsets);
+  select_parser = NULL;
+  compact_parser = NULL;
+  select_offsets = NULL;
+}
+
+/* Reads the next record of a snapshot that is selected by --trees, passing
+   over the others without building their trees */
+static int snapshot_select(snapshot_tree_t * record)
+{
+  long target = opt_trees ? trees_next_selected(tree_index) : tree_index + 1;
+
+  if (!target)
+  {
+    select_done = 1;
+    return 0;
+  }
+
+  for (; file_tree < target; ++file_tree)
+    if (!snapshot_next(record))
+      return 0;
+
+  tree_index = target-1;
+
+  return 1;
+}
+
+static void forest_start(const char * filename, int convert)
+{
+  tree_index = 0;
+  trees_loaded = 0;
+  file_tree = 0;
+  select_done = 0;
+  line_pos = 0;
+  line_count = 0;
+  convert_trees = convert;
+  from_snapshot = snapshot_probe(filename);
+
+  if (from_snapshot)
+  {
+    if (!snapshot_open(filename))
+      fatal("%s", errmsg);
+
+    if (BURNIN_RELATIVE)
+    {
+      snapshot_tree_t record;
+      long count = 0;
+
+      while (snapshot_next(&record))
+        ++count;
+      snapshot_close();
+      if (!snapshot_open(filename))
+        fatal("%s", errmsg);
+      trees_burnin(count);
+    }
+    else
+      trees_burnin(0);
+  }
+  else if (opt_threads > 1 && !opt_trees && !opt_compact)
+    parallel_open(filename);
+  else
+    select_open(filename);
+
+  reject_open();
+}
+
+/* Opens a file containing one or more trees, either in newick format or as a
+   binary snapshot written by --export_snapshot. The trees are loaded one at
+   a time with forest_next() */
+void forest_open(const char * filename)
+{
+  forest_start(filename, 1);
+}
+
+/* Opens a file whose trees are loaded with forest_next_ntree() */
+void forest_open_ntree(const char * filename)
+{
+  forest_start(filename, 0);
+}
+
+/* Loads the next tree of the file with the n-ary parser. The parser records
+   the degree of each node, and binary rooted (resp. unrooted) trees are then
+   converted directly to rtree_t (resp. utree_t), without a second pass over
+   the file. N-ary trees are returned as ntree_t when ntree is not NULL, and
+   otherwise deallocated such that the caller only gets the tree type.
+   Returns the type of the tree, or TREE_NONE after the last tree */
+int forest_next(rtree_t ** rtree,
+                utree_t ** utree,
+                int * tip_count,
+                ntree_t ** ntree)
+{
+  int tree_type;
+  ntree_t * tree;
+
+  *rtree = NULL;
+  *utree = NULL;
+  if (ntree)
+    *ntree = NULL;
+
+  if (from_snapshot)
+  {
+    snapshot_tree_t record;
+
+    if (!snapshot_select(&record))
+      return TREE_NONE;
+
+    ++tree_index;
+    ++trees_loaded;
+
+    *tip_count = record.tip_count;
+    if (record.tree_type == TREE_ROOTED)
+      *rtree = snapshot_tree_rtree(&record);
+    else if (record.tree_type == TREE_UNROOTED)
+      *utree = snapshot_tree_utree(&record);
+    else if (ntree)
+      *ntree = snapshot_tree_ntree(&record);
+
+    return record.tree_type;
+  }
+
+  if (parallel)
+  {
+    forest_tree_t * t = parallel_next();
+    if (!t)
+      return TREE_NONE;
+
+    ++tree_index;
+    ++trees_loaded;
+
+    *rtree = t->rtree;
+    *utree = t->utree;
+    *tip_count = t->tip_count;
+    if (ntree)
+      *ntree = t->ntree;
+    else if (t->ntree)
+      ntree_destroy(t->ntree);
+
+    return t->tree_type;
+  }
+
+  if (opt_compact)
+  {
+    ftree_t * ftree = select_next_compact();
+    if (!ftree)
+      return TREE_NONE;
+
+    ++tree_index;
+    ++trees_loaded;
+
+    tree_type = ftree->tree_type;
+    *tip_count = ftree->tip_count;
+    if (tree_type == TREE_ROOTED)
+      *rtree = ftree_to_rtree(ftree);
+    else if (tree_type == TREE_UNROOTED)
+      *utree = ftree_to_utree(ftree);
+    else if (ntree)
+      *ntree = ftree_to_ntree(ftree);
+
+    ftree_destroy(ftree);
+    return tree_type;
+  }
+
+  tree = select_next(tip_count, &tree_type);
+  if (!tree)
+    return TREE_NONE;
+
+  ++tree_index;
+  ++trees_loaded;
+
+  if (tree_type == TREE_ROOTED)
+    *rtree = ntree_binary_to_rtree(tree);
+  else if (tree_type == TREE_UNROOTED)
+    *utree = ntree_binary_to_utree(tree);
+  else if (ntree)
+    *ntree = tree;
+  else
+    ntree_destroy(tree);
+
+  return tree_type;
+}
+
+/* Loads the next tree of a file opened with forest_open_ntree() as an n-ary
+   tree regardless of its degrees, and stores its type in tree_type. Returns
+   NULL after the last tree */
+ntree_t * forest_next_ntree(int * tree_type)
+{
+  ntree_t * tree;
+
+  if (from_snapshot)
+  {
+    snapshot_tree_t record;
+
+    tree = NULL;
+    if (snapshot_select(&record))
+    {
+      tree = snapshot_tree_ntree(&record);
+      *tree_type = record.tree_type;
+    }
+  }
+  else if (parallel)
+  {
+    forest_tree_t * t = parallel_next();
+
+    tree = t ? t->ntree : NULL;
+    if (t)
+      *tree_type = t->tree_type;
+  }
+  else if (opt_compact)
+  {
+    ftree_t * ftree = select_next_compact();
+
+    tree = NULL;
+    if (ftree)
+    {
+      tree = ftree_to_ntree(ftree);
+      *tree_type = ftree->tree_type;
+      ftree_destroy(ftree);
+    }
+  }
+  else
+    tree = select_next(NULL, tree_type);
+
+  if (tree)
+  {
+    ++tree_index;
+    ++trees_loaded;
+  }
+
+  return tree;
+}
+
+/* Loads the next tree of a file opened with forest_open_ntree() as a flat
+   tree. With --compact, trees are parsed into compact flat trees directly,
+   and trees of a snapshot are made compact after the conversion from their
+   n-ary tree. Returns NULL after the last tree */
+ftree_t * forest_next_ftree(void)
+{
+  int tree_type;
+  ntree_t * ntree;
+  ftree_t * tree;
+
+  if (opt_compact && !from_snapshot)
+  {
+    tree = select_next_compact();
+    if (tree)
+    {
+      ++tree_index;
+      ++trees_loaded;
+    }
+    return tree;
+  }
+
+  ntree = forest_next_ntree(&tree_type);
+  if (!ntree)
+    return NULL;
+
+  tree = ftree_from_ntree(ntree);
+  tree->tree_type = tree_type;
+  ntree_destroy(ntree);
+
+  if (opt_compact)
+    ftree_compact(tree);
+
+  return tree;
+}
+
+/* Closes the file once forest_next() returned TREE_NONE. If that happened
+   before the end of the file, then the next tree could not be read and we
+   fail */
+void forest_close(void)
+{
+  int eof;
+  long skipped;
+
+  if (from_snapshot)
+  {
+    eof = select_done || snapshot_eof();
+    snapshot_close();
+  }
+  else if (parallel)
+  {
+    eof = forest_eof;
+    parallel_close();
+  }
+  else
+  {
+    eof = select_done;
+    select_close();
+  }
+
+  skipped = reject_close();
+
+  if (!eof)
+    fatal("Error while reading tree %ld of %s (%s)",
+          tree_index+1, opt_treefile, errmsg);
+
+  if (!trees_loaded && skipped)
+    fatal("None of the trees of %s could be parsed", opt_treefile);
+
+  if (!trees_loaded && opt_trees)
+    fatal("File %s does not contain any of the selected trees",
+          opt_treefile);
+
+  if (!trees_loaded)
+    fatal("File %s does not contain any trees", opt_treefile);
+}
+
+/* Starts counting the trees that cannot be parsed, and creates the file
+   given with --quarantine that collects them */
+void reject_open(void)
+{
+  rejected = 0;
+
+  if (opt_quarantine)
+    quarantine = xopen(opt_quarantine, "w");
+}
+
+/* Reports that tree number tree could not be parsed because of msg, at the
+   given byte offset and line, and writes its text to the quarantine file */
+void reject_tree(long tree,
+                 size_t offset,
+                 long line,
+                 const char * msg,
+                 const char * text,
+                 size_t len)
+{
+  ++rejected;
+
+  while (len && isspace((unsigned char)*text))
+  {
+    ++text;
+    --len;
+  }
+
+  fprintf(stderr,
+          "Warning: Skipping tree %ld of %s, %s at byte %ld (line %ld)\n",
+          tree, opt_treefile, msg, (long)offset, line);
+
+  if (quarantine)
+  {
+    if (fwrite(text, 1, len, quarantine) != len ||
+        fputc('\n', quarantine) == EOF)
+      fatal("Unable to write to %s", opt_quarantine);
+  }
+}
+
+/* Closes the quarantine file, summarizes the skipped trees, and returns
+   their number */
+long reject_close(void)
+{
+  if (quarantine)
+  {
+    fclose(quarantine);
+    quarantine = NULL;
+  }
+
+  if (rejected)
+  {
+    if (opt_quarantine)
+      fprintf(stderr, "Warning: Skipped %ld trees of %s that could not be "
+              "parsed, which were written to %s\n",
+              rejected, opt_treefile, opt_quarantine);
+    else
+      fprintf(stderr, "Warning: Skipped %ld trees of %s that could not be "
+              "parsed\n", rejected, opt_treefile);
+  }
+
+  return rejected;
+}
@@ -0,0 +1,263 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Formatting of doubles with a fixed number of decimals. printf("%.*f")
+   prints the exact binary value rounded to the requested digits, ties to
+   even. For up to 19 decimals and results below 2^64 we compute the same
+   rounding with integer arithmetic: x = m * 2^e with a 53-bit mantissa m, so
+   x * 10^p = m * 10^p * 2^e, where m * 10^p fits in 128 bits and the shift
+   by e yields the integer part and the remainder deciding the rounding.
+   Anything else (large values, more decimals, infinities, NaN) is left to
+   snprintf */
+
+#define FORMAT_MAX_FAST_PRECISION 19
+
+static const unsigned long pow10_int[] =
+ {
+   1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL,
+   100000000UL, 1000000000UL, 10000000000UL, 100000000000UL,
+   1000000000000UL, 10000000000000UL, 100000000000000UL,
+   1000000000000000UL, 10000000000000000UL, 100000000000000000UL,
+   1000000000000000000UL, 10000000000000000000UL
+ };
+
+/* Stores |x| * 10^precision rounded to the nearest integer, ties to even, in
+   result. The exact product m * 10^precision and the number of bits it is
+   shifted right by (zero for integers) are stored in product and shift.
+   Returns 0 if the result does not fit in 64 bits */
+static int scale(double x, int precision, unsigned long * result,
+                 unsigned __int128 * product, int * shift)
+{
+  int e;
+  unsigned __int128 q;
+
+  double f = frexp(fabs(x), &e);
+  unsigned long m = (unsigned long)ldexp(f, 53);
+
+  e -= 53;
+  *product = (unsigned __int128)m * pow10_int[precision];
+  *shift = e < 0 ? -e : 0;
+
+  if (e >= 0)
+  {
+    if (e >= 64 || (*product >> (64 - e)))
+      return 0;
+    q = *product << e;
+  }
+  else if (-e >= 128)
+  {
+    /* the product is below 2^117, i.e. less than half a unit */
+    q = 0;
+  }
+  else
+  {
+    unsigned __int128 one = 1;
+    unsigned __int128 rem = *product & ((one << -e) - 1);
+    unsigned __int128 half = one << (-e - 1);
+
+    q = *product >> -e;
+    if (rem > half || (rem == half && (q & 1)))
+      ++q;
+  }
+
+  if (q >> 64)
+    return 0;
+
+  *result = (unsigned long)q;
+  return 1;
+}
+
+static int scaled_integer(double x, int precision, unsigned long * result)
+{
+  unsigned __int128 product;
+  int shift;
+
+  return scale(x, precision, result, &product, &shift);
+}
+
+/* writes q / 10^precision with exactly precision decimals into out */
+static size_t print_scaled(char * out, int negative, unsigned long q,
+                           int precision)
+{
+  char digits[24];
+  size_t len = 0;
+  int n = 0;
+  int i;
+
+  do
+  {
+    digits[n++] = (char)('0' + q % 10);
+    q /= 10;
+  }
+  while (q);
+
+  while (n <= precision)
+    digits[n++] = '0';
+
+  if (negative)
+    out[len++] = '-';
+
+  for (i = n-1; i >= 0; --i)
+  {
+    out[len++] = digits[i];
+    if (i == precision && precision)
+      out[len++] = '.';
+  }
+  out[len] = 0;
+
+  return len;
+}
+
+/* copies the formatted number into buf with snprintf semantics */
+static size_t copy_out(char * buf, size_t size, const char * s, size_t len)
+{
+  if (size)
+  {
+    size_t n = MIN(len, size-1);
+    memcpy(buf, s, n);
+    buf[n] = 0;
+  }
+
+  return len;
+}
+
+/* reads the candidate back the slow way, when q * 2^shift
+   does not fit in 128 bits */
+static int strtod_check(double x, int precision, unsigned long q)
+{
+  char tmp[32];
+
+  print_scaled(tmp, 0, q, precision);
+
+  return strtod(tmp, NULL) == fabs(x);
+}
+
+/* Checks whether q / 10^precision is read back as x. With x = m / 2^shift,
+   the neighbouring doubles are one unit of 2^-shift away, so the decimal is
+   read as x if it is closer than half a unit, i.e. if
+   |q * 2^shift - m * 10^precision| < 10^precision / 2, scaled by 2^shift.
+   Below a power of two the neighbour is only half a unit away, and at
+   exactly half a unit the tie goes to the even mantissa */
+static int reads_back(double x, int precision, unsigned long q,
+                      unsigned __int128 product, int shift)
+{
+  unsigned __int128 scaled;
+  unsigned __int128 diff;
+  unsigned __int128 ten = pow10_int[precision];
+  unsigned long m = (unsigned long)(product / ten);
+  int below;
+
+  /* integers are scaled exactly */
+  if (!shift)
+    return 1;
+
+  if (shift >= 127 || (q >> (127 - shift)))
+    return strtod_check(x, precision, q);
+
+  scaled = (unsigned __int128)q << shift;
+  below = scaled < product;
+  diff = below ? product - scaled : scaled - product;
+
+  if (below && m == (1UL << 52))
+    diff *= 2;
+
+  if (2*diff < ten)
+    return 1;
+
+  return 2*diff == ten && !(m & 1);
+}
+
+/* Shortest fixed notation that reads back as the same double. Values that
+   need more than 17 decimals, or are too large, are written in exponent
+   notation with 17 significant digits, which always identify a double */
+static size_t format_shortest(char * buf, size_t size, double x)
+{
+  char tmp[32];
+  unsigned long q;
+  unsigned __int128 product;
+  int shift;
+  int p;
+
+  if (isfinite(x))
+  {
+    for (p = 0; p <= 17; ++p)
+    {
+      if (!scale(x, p, &q, &product, &shift))
+        break;
+
+      if (reads_back(x, p, q, product, shift))
+        return copy_out(buf, size, tmp,
+                        print_scaled(tmp, signbit(x), q, p));
+    }
+  }
+
+  return (size_t)snprintf(buf, size, "%.16e", x);
+}
+
+/* Formats x like snprintf(buf, size, "%.*f", precision, x), and returns the
+   length of the formatted number. A precision of PRECISION_SHORTEST selects
+   the shortest representation that is read back as the same value */
+size_t format_double(char * buf, size_t size, double x, int precision)
+{
+  char tmp[32];
+  unsigned long q;
+
+  if (precision == PRECISION_SHORTEST)
+    return format_shortest(buf, size, x);
+
+  if (precision >= 0 && precision <= FORMAT_MAX_FAST_PRECISION &&
+      isfinite(x) && scaled_integer(x, precision, &q))
+    return copy_out(buf, size, tmp, print_scaled(tmp, signbit(x), q,
+                                                 precision));
+
+  return (size_t)snprintf(buf, size, "%.*f", precision, x);
+}
+
+/* Formats a single precision value, such as a branch length of --compact,
+   like format_double(). The shortest representation is the shortest one
+   that reads back as the same float, as the digits beyond that only
+   describe the binary approximation of what was read */
+size_t format_float(char * buf, size_t size, float x, int precision)
+{
+  char tmp[32];
+  size_t n;
+  int p;
+
+  if (precision != PRECISION_SHORTEST)
+    return format_double(buf, size, x, precision);
+
+  if (isfinite(x))
+  {
+    for (p = 0; p <= 17; ++p)
+    {
+      n = format_double(tmp, sizeof(tmp), x, p);
+      if (n >= sizeof(tmp))
+        break;
+
+      if (strtof(tmp, NULL) == x)
+        return copy_out(buf, size, tmp, n);
+    }
+  }
+
+  return (size_t)snprintf(buf, size, "%.8e", x);
+}
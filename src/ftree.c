@@ -0,0 +1,527 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Flat trees. A flat tree keeps every property of its nodes in an array
+   indexed by node number. Nodes are numbered in postorder, so the children
+   of a node have smaller numbers than the node itself, the root is the last
+   node, and a loop over the node numbers visits the tree in postorder. The
+   preorder array lists the nodes in preorder.
+
+   Compact trees, which the parser of --compact reads (see ctree.c), are
+   flat trees with single precision lengths and without the right, preorder
+   and length arrays, which takes 20 bytes per node and one bit for whether
+   the length was given. Everything else only uses the arrays both kinds of
+   trees have, and FTREE_LENGTH() for the lengths.
+
+   The conversions from pointer-based trees list the nodes from an explicit
+   stack, starting at the root and continuing with the last child of every
+   node, which is postorder reversed. Neither direction recurses, so trees of
+   any depth are converted in time linear in their size. Labels are stored
+   as their id in the label pool, which every parser interns them in */
+
+typedef struct ftree_walk_s
+{
+  const void ** stack;
+  int * stack_parent;
+  int top;
+  int stack_alloc;
+
+  const void ** node;           /* nodes in reverse postorder */
+  int * parent;                 /* position of the parent in node, or -1 */
+  int count;
+  int alloc;
+} ftree_walk_t;
+
+static void walk_init(ftree_walk_t * w)
+{
+  w->top = 0;
+  w->count = 0;
+  w->stack_alloc = 64;
+  w->alloc = 64;
+  w->stack = (const void **)xmalloc(w->stack_alloc * sizeof(void *));
+  w->stack_parent = (int *)xmalloc(w->stack_alloc * sizeof(int));
+  w->node = (const void **)xmalloc(w->alloc * sizeof(void *));
+  w->parent = (int *)xmalloc(w->alloc * sizeof(int));
+}
+
+static void walk_destroy(ftree_walk_t * w)
+{
+  free(w->stack);
+  free(w->stack_parent);
+  free(w->node);
+  free(w->parent);
+}
+
+static void walk_push(ftree_walk_t * w, const void * node, int parent)
+{
+  if (w->top == w->stack_alloc)
+  {
+    w->stack_alloc *= 2;
+    w->stack = (const void **)xrealloc(w->stack,
+                                       w->stack_alloc * sizeof(void *));
+    w->stack_parent = (int *)xrealloc(w->stack_parent,
+                                      w->stack_alloc * sizeof(int));
+  }
+
+  w->stack[w->top] = node;
+  w->stack_parent[w->top++] = parent;
+}
+
+/* moves the node on top of the stack to the list and returns its position,
+   which its children are pushed with */
+static int walk_pop(ftree_walk_t * w)
+{
+  if (w->count == w->alloc)
+  {
+    w->alloc *= 2;
+    w->node = (const void **)xrealloc(w->node, w->alloc * sizeof(void *));
+    w->parent = (int *)xrealloc(w->parent, w->alloc * sizeof(int));
+  }
+
+  --w->top;
+  w->node[w->count] = w->stack[w->top];
+  w->parent[w->count] = w->stack_parent[w->top];
+
+  return w->count++;
+}
+
+/* Sets the number of nodes the arrays have room for */
+void ftree_resize(ftree_t * tree, int n)
+{
+  tree->parent  = (int32_t *)xrealloc(tree->parent, n * sizeof(int32_t));
+  tree->left    = (int32_t *)xrealloc(tree->left, n * sizeof(int32_t));
+  tree->sibling = (int32_t *)xrealloc(tree->sibling, n * sizeof(int32_t));
+  tree->taxon   = (int32_t *)xrealloc(tree->taxon, n * sizeof(int32_t));
+  tree->has_length = (unsigned char *)xrealloc(tree->has_length,
+                                               (size_t)(n + 7) / 8);
+
+  if (tree->compact)
+  {
+    tree->flength = (float *)xrealloc(tree->flength, n * sizeof(float));
+    return;
+  }
+
+  tree->right    = (int32_t *)xrealloc(tree->right, n * sizeof(int32_t));
+  tree->preorder = (int32_t *)xrealloc(tree->preorder, n * sizeof(int32_t));
+  tree->length   = (double *)xrealloc(tree->length, n * sizeof(double));
+}
+
+/* Allocates a tree of n nodes without lengths, whose other fields are left
+   to the caller */
+ftree_t * ftree_create(int n, int compact)
+{
+  ftree_t * tree = (ftree_t *)xcalloc(1, sizeof(ftree_t));
+
+  tree->compact = compact;
+  ftree_resize(tree, n);
+  memset(tree->has_length, 0, (size_t)(n + 7) / 8);
+  tree->node_count = n;
+  tree->root = n - 1;
+
+  return tree;
+}
+
+void ftree_destroy(ftree_t * tree)
+{
+  if (!tree) return;
+
+  free(tree->parent);
+  free(tree->left);
+  free(tree->right);
+  free(tree->sibling);
+  free(tree->taxon);
+  free(tree->preorder);
+  free(tree->length);
+  free(tree->flength);
+  free(tree->has_length);
+  free(tree);
+}
+
+void ftree_set_length(ftree_t * tree, int node, double length)
+{
+  if (tree->compact)
+    tree->flength[node] = (float)length;
+  else
+    tree->length[node] = length;
+  tree->has_length[node >> 3] |= (unsigned char)(1 << (node & 7));
+}
+
+/* Turns a tree into a compact one, rounding its lengths to single
+   precision */
+void ftree_compact(ftree_t * tree)
+{
+  int i;
+
+  if (tree->compact) return;
+
+  tree->flength = (float *)xmalloc(tree->node_count * sizeof(float));
+  for (i = 0; i < tree->node_count; ++i)
+    tree->flength[i] = (float)tree->length[i];
+
+  free(tree->right);
+  free(tree->preorder);
+  free(tree->length);
+  tree->right = NULL;
+  tree->preorder = NULL;
+  tree->length = NULL;
+  tree->compact = 1;
+}
+
+/* Creates the flat tree of the listed nodes, with the links between nodes,
+   the preorder and the tree type set. Node k of the list becomes node
+   n-1-k of the tree */
+static ftree_t * walk_finish(ftree_walk_t * w)
+{
+  int i, c;
+  int n = w->count;
+  int root_degree = 0;
+  int nonbinary = 0;
+  ftree_t * tree = ftree_create(n, 0);
+
+  for (i = 0; i < n; ++i)
+  {
+    int k = n - 1 - i;
+
+    tree->parent[i] = w->parent[k] == -1 ? -1 : n - 1 - w->parent[k];
+    tree->left[i] = -1;
+    tree->right[i] = -1;
+    tree->sibling[i] = -1;
+  }
+
+  /* children are numbered in their order, so appending each node to the
+     children of its parent keeps that order */
+  for (i = 0; i < n; ++i)
+  {
+    int p = tree->parent[i];
+
+    if (p == -1)
+      continue;
+
+    if (tree->left[p] == -1)
+      tree->left[p] = i;
+    else
+      tree->sibling[tree->right[p]] = i;
+    tree->right[p] = i;
+  }
+
+  /* count tips and find whether the tree is binary */
+  tree->tip_count = 0;
+  for (i = 0; i < n; ++i)
+  {
+    int degree = 0;
+
+    for (c = tree->left[i]; c != -1; c = tree->sibling[c])
+      ++degree;
+
+    if (!degree)
+      ++tree->tip_count;
+    else if (i == tree->root)
+      root_degree = degree;
+    else if (degree != 2)
+      ++nonbinary;
+  }
+
+  tree->tree_type = TREE_NARY;
+  if (!nonbinary && root_degree == 2)
+    tree->tree_type = TREE_ROOTED;
+  else if (!nonbinary && root_degree == 3)
+    tree->tree_type = TREE_UNROOTED;
+
+  /* The subtree of node i occupies the numbers i-size[i]+1 to i. In
+     preorder, the first child of a node follows it and every other child
+     follows the subtree of the previous one */
+  int * size = (int *)xmalloc(2 * n * sizeof(int));
+  int * rank = size + n;
+
+  for (i = 0; i < n; ++i)
+    size[i] = 1;
+  for (i = 0; i < n; ++i)
+    if (tree->parent[i] != -1)
+      size[tree->parent[i]] += size[i];
+
+  rank[tree->root] = 0;
+  for (i = n - 1; i >= 0; --i)
+  {
+    int next = rank[i] + 1;
+
+    for (c = tree->left[i]; c != -1; c = tree->sibling[c])
+    {
+      rank[c] = next;
+      next += size[c];
+    }
+    tree->preorder[rank[i]] = i;
+  }
+
+  free(size);
+
+  return tree;
+}
+
+static char * taxon_label(const ftree_t * tree, int node)
+{
+  return tree->taxon[node] == -1 ? NULL :
+                                   (char *)label_string(tree->taxon[node]);
+}
+
+ftree_t * ftree_from_rtree(rtree_t * root)
+{
+  ftree_walk_t w;
+  int i, k;
+
+  walk_init(&w);
+  walk_push(&w, root, -1);
+  while (w.top)
+  {
+    k = walk_pop(&w);
+    const rtree_t * node = (const rtree_t *)w.node[k];
+
+    if (node->left)
+    {
+      walk_push(&w, node->left, k);
+      walk_push(&w, node->right, k);
+    }
+  }
+
+  ftree_t * tree = walk_finish(&w);
+
+  for (i = 0; i < w.count; ++i)
+  {
+    const rtree_t * node = (const rtree_t *)w.node[w.count - 1 - i];
+
+    ftree_set_length(tree, i, node->length);
+    tree->taxon[i] = node->label ? label_id(node->label) : -1;
+  }
+
+  walk_destroy(&w);
+  return tree;
+}
+
+/* The root of an unrooted tree is an inner node whose three records each
+   lead to a subtree. Every other node is represented by the record facing
+   its parent, and the branch to the root has no length of its own */
+ftree_t * ftree_from_utree(utree_t * root)
+{
+  ftree_walk_t w;
+  int i, k;
+
+  if (!root->next)
+    root = root->back;
+
+  walk_init(&w);
+  walk_push(&w, root, -1);
+  while (w.top)
+  {
+    k = walk_pop(&w);
+    const utree_t * node = (const utree_t *)w.node[k];
+
+    if (!k)
+      walk_push(&w, node->back, k);
+
+    if (node->next)
+    {
+      walk_push(&w, node->next->back, k);
+      walk_push(&w, node->next->next->back, k);
+    }
+  }
+
+  ftree_t * tree = walk_finish(&w);
+
+  for (i = 0; i < w.count; ++i)
+  {
+    const utree_t * node = (const utree_t *)w.node[w.count - 1 - i];
+
+    tree->length[i] = 0;
+    if (i != tree->root)
+      ftree_set_length(tree, i, node->length);
+    tree->taxon[i] = node->label ? label_id(node->label) : -1;
+  }
+
+  walk_destroy(&w);
+  return tree;
+}
+
+ftree_t * ftree_from_ntree(ntree_t * root)
+{
+  ftree_walk_t w;
+  int i, j, k;
+
+  walk_init(&w);
+  walk_push(&w, root, -1);
+  while (w.top)
+  {
+    k = walk_pop(&w);
+    const ntree_t * node = (const ntree_t *)w.node[k];
+
+    for (j = 0; j < node->children_count; ++j)
+      walk_push(&w, node->children[j], k);
+  }
+
+  ftree_t * tree = walk_finish(&w);
+
+  for (i = 0; i < w.count; ++i)
+  {
+    const ntree_t * node = (const ntree_t *)w.node[w.count - 1 - i];
+
+    tree->length[i] = node->length;
+    if (node->has_length)
+      ftree_set_length(tree, i, node->length);
+    tree->taxon[i] = node->label ? label_id(node->label) : -1;
+  }
+
+  walk_destroy(&w);
+  return tree;
+}
+
+/* Builds the rooted binary tree of a flat tree of type TREE_ROOTED. Missing
+   branch lengths are set to 1 as in parse_rtree.y */
+rtree_t * ftree_to_rtree(const ftree_t * tree)
+{
+  int i;
+  arena_t * arena = arena_create();
+  rtree_t ** nodes = (rtree_t **)xmalloc(tree->node_count *
+                                         sizeof(rtree_t *));
+
+  assert(tree->tree_type == TREE_ROOTED);
+
+  for (i = 0; i < tree->node_count; ++i)
+  {
+    rtree_t * node = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
+
+    node->label = taxon_label(tree, i);
+    node->length = FTREE_HAS_LENGTH(tree, i) ? FTREE_LENGTH(tree, i) : 1;
+
+    if (tree->left[i] == -1)
+      node->leaves = 1;
+    else
+    {
+      node->left = nodes[tree->left[i]];
+      node->right = nodes[tree->sibling[tree->left[i]]];
+      node->left->parent = node;
+      node->right->parent = node;
+      node->leaves = node->left->leaves + node->right->leaves;
+    }
+
+    nodes[i] = node;
+  }
+
+  rtree_t * root = nodes[tree->root];
+  free(nodes);
+
+  return root;
+}
+
+/* Builds the unrooted binary tree of a flat tree of type TREE_UNROOTED,
+   setting missing branch lengths to 0.1 as for n-ary trees. The children
+   of each inner node are attached to the two records following the one that
+   faces the parent, and the three children of the root to its three
+   records */
+utree_t * ftree_to_utree(const ftree_t * tree)
+{
+  int i;
+  arena_t * arena = arena_create();
+  utree_t ** nodes = (utree_t **)xmalloc(tree->node_count *
+                                         sizeof(utree_t *));
+
+  assert(tree->tree_type == TREE_UNROOTED);
+
+  for (i = 0; i < tree->node_count; ++i)
+  {
+    utree_t * node;
+    utree_t * slot;
+    int c;
+
+    if (tree->left[i] == -1)
+      node = (utree_t *)arena_alloc(arena, sizeof(utree_t));
+    else
+      node = utree_inner_create(arena);
+
+    node->label = taxon_label(tree, i);
+    node->length = FTREE_HAS_LENGTH(tree, i) ? FTREE_LENGTH(tree, i) : 0.1;
+
+    if (node->next)
+    {
+      node->next->label = node->label;
+      node->next->next->label = node->label;
+      node->height = 0;
+
+      slot = (i == tree->root) ? node : node->next;
+      for (c = tree->left[i]; c != -1; c = tree->sibling[c])
+      {
+        slot->back = nodes[c];
+        slot->length = nodes[c]->length;
+        nodes[c]->back = slot;
+        node->height = MAX(node->height, nodes[c]->height + 1);
+        slot = slot->next;
+      }
+
+      node->next->height = node->height;
+      node->next->next->height = node->height;
+    }
+
+    nodes[i] = node;
+  }
+
+  utree_t * root = nodes[tree->root];
+  free(nodes);
+
+  return root;
+}
+
+ntree_t * ftree_to_ntree(const ftree_t * tree)
+{
+  int i, j, c;
+  arena_t * arena = arena_create();
+  ntree_t ** nodes = (ntree_t **)xmalloc(tree->node_count *
+                                         sizeof(ntree_t *));
+
+  for (i = 0; i < tree->node_count; ++i)
+  {
+    ntree_t * node = (ntree_t *)arena_alloc(arena, sizeof(ntree_t));
+
+    node->label = taxon_label(tree, i);
+    node->length = FTREE_LENGTH(tree, i);
+    node->has_length = FTREE_HAS_LENGTH(tree, i);
+
+    for (c = tree->left[i]; c != -1; c = tree->sibling[c])
+      ++node->children_count;
+
+    if (node->children_count)
+    {
+      node->children = (ntree_t **)arena_alloc(arena,
+                                               node->children_count *
+                                               sizeof(ntree_t *));
+      for (j = 0, c = tree->left[i]; c != -1; c = tree->sibling[c], ++j)
+      {
+        node->children[j] = nodes[c];
+        nodes[c]->parent = node;
+      }
+    }
+
+    nodes[i] = node;
+  }
+
+  ntree_t * root = nodes[tree->root];
+  free(nodes);
+
+  return root;
+}
@@ -0,0 +1,232 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Tree index. The index of a tree file lists the byte offset at which each
+   tree starts, such that --trees can seek to the selected trees directly.
+   It is stored next to the tree file, with the suffix INDEX_SUFFIX, and
+   consists of a header followed by one 64-bit offset per tree, in the byte
+   order of the machine that wrote it. The size of the tree file is recorded
+   in the header. A file that has grown since, e.g. the output of a running
+   analysis, keeps its trees at the indexed offsets, so the index is used
+   for them and only the rest of the file is scanned. An index of a larger
+   file is ignored.
+
+   The selection of trees by --trees and --burnin is also kept here, since
+   it is shared by the readers of whole trees and by --copy_trees */
+
+#define INDEX_MAGIC      "NWKINDX"
+#define INDEX_VERSION    1
+#define INDEX_BYTE_ORDER 0x01020304
+#define INDEX_SUFFIX     ".idx"
+
+typedef struct index_header_s
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int byte_order;
+  unsigned long file_size;
+  unsigned long tree_count;
+} index_header_t;
+
+/* number of trees discarded from the start of the file by --burnin */
+static long burnin_trees = 0;
+
+static char * index_filename(const char * treefile)
+{
+  char * filename = (char *)xmalloc(strlen(treefile) +
+                                    strlen(INDEX_SUFFIX) + 1);
+
+  strcpy(filename, treefile);
+  strcat(filename, INDEX_SUFFIX);
+
+  return filename;
+}
+
+/* Appends the offsets of the trees starting at pos or later to offsets,
+   which holds count offsets and has room for alloc */
+static unsigned long * scan_trees(const lexer_t * lexer,
+                                  size_t pos,
+                                  unsigned long * offsets,
+                                  size_t * count,
+                                  size_t * alloc)
+{
+  while ((pos = lexer_tree_start(lexer, pos)) < lexer->size)
+  {
+    if (*count == *alloc)
+    {
+      *alloc = *alloc ? 2 * *alloc : 1024;
+      offsets = (unsigned long *)xrealloc(offsets,
+                                          *alloc * sizeof(unsigned long));
+    }
+    offsets[(*count)++] = pos;
+
+    pos = lexer_tree_end(lexer, pos);
+  }
+
+  return offsets;
+}
+
+/* Loads the index of the tree file read by lexer, which holds the whole
+   file, and stores the number of trees in count. Returns NULL if the file
+   has no usable index */
+unsigned long * index_load(const char * treefile,
+                           const lexer_t * lexer,
+                           long * count)
+{
+  index_header_t header;
+  unsigned long * offsets;
+  size_t alloc;
+  size_t n;
+  char * filename = index_filename(treefile);
+  FILE * fp = fopen(filename, "r");
+
+  if (!fp)
+  {
+    free(filename);
+    return NULL;
+  }
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) ||
+      header.version != INDEX_VERSION ||
+      header.byte_order != INDEX_BYTE_ORDER)
+    fatal("File %s is not a tree index", filename);
+
+  if (header.file_size > lexer->size)
+  {
+    fprintf(stderr,
+            "Warning: Index %s is of a larger file than %s and is ignored, "
+            "rebuild it with --build_index\n", filename, treefile);
+    fclose(fp);
+    free(filename);
+    return NULL;
+  }
+
+  alloc = MAX(header.tree_count, 1);
+  offsets = (unsigned long *)xmalloc(alloc * sizeof(unsigned long));
+
+  if (fread(offsets, sizeof(unsigned long), header.tree_count, fp) !=
+      header.tree_count)
+    fatal("Index %s is truncated", filename);
+
+  fclose(fp);
+  free(filename);
+
+  /* the last indexed tree may have been incomplete when it was indexed */
+  n = header.tree_count;
+  if (header.file_size < lexer->size)
+    offsets = scan_trees(lexer,
+                         n ? lexer_tree_end(lexer, offsets[n-1]) : 0,
+                         offsets,
+                         &n,
+                         &alloc);
+
+  *count = (long)n;
+  return offsets;
+}
+
+/* Tells whether the tree file has an index, without reading it */
+int index_exists(const char * treefile)
+{
+  char * filename = index_filename(treefile);
+  int exists = !access(filename, F_OK);
+
+  free(filename);
+  return exists;
+}
+
+/* Finds the start of every tree in one pass over the file, following only
+   quotes, comments and semicolons, and writes the offsets to the index */
+void cmd_build_index(void)
+{
+  lexer_t lexer;
+  index_header_t header;
+  unsigned long * offsets = NULL;
+  size_t alloc = 0;
+  size_t count = 0;
+  char * filename;
+  FILE * out;
+
+  if (snapshot_probe(opt_treefile))
+    fatal("File %s is a snapshot, which needs no index", opt_treefile);
+
+  if (!lexer_open(&lexer, opt_treefile))
+    fatal("%s", errmsg);
+
+  offsets = scan_trees(&lexer, 0, offsets, &count, &alloc);
+
+  if (!count)
+    fatal("File %s does not contain any trees", opt_treefile);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.version = INDEX_VERSION;
+  header.byte_order = INDEX_BYTE_ORDER;
+  header.file_size = lexer.size;
+  header.tree_count = count;
+
+  filename = index_filename(opt_treefile);
+  out = xopen(filename, "w");
+
+  if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+      fwrite(offsets, sizeof(unsigned long), count, out) != count)
+    fatal("Unable to write index %s", filename);
+
+  fclose(out);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Indexed %ld trees of %s in %s\n",
+            (long)count, opt_treefile, filename);
+
+  free(filename);
+  free(offsets);
+  lexer_close(&lexer);
+}
+
+/* Sets the number of trees discarded by --burnin. A burn-in below one is a
+   fraction of the count trees of the file, of which the integer part is
+   discarded */
+void trees_burnin(long count)
+{
+  if (opt_burnin < 1)
+    burnin_trees = (long)(opt_burnin * count);
+  else
+    burnin_trees = (long)opt_burnin;
+}
+
+/* Returns the number of the first tree selected by --trees and --burnin
+   after tree number n, or 0 if there is none */
+long trees_next_selected(long n)
+{
+  long next = MAX(n, burnin_trees) + 1;
+
+  if (next < opt_trees_first)
+    next = opt_trees_first;
+  else if ((next - opt_trees_first) % opt_trees_step)
+    next += opt_trees_step - (next - opt_trees_first) % opt_trees_step;
+
+  if (opt_trees_last && next > opt_trees_last)
+    return 0;
+
+  return next;
+}
@@ -40,137 +40,123 @@ static void show_tree_info(int tip_count,
          max_inner_degree);
 }
 
-static void rtree_info(rtree_t * root)
+static void show_length_stats(double * lengths, int count)
 {
-  int tip_count = root->leaves;
-  int inner_count = tip_count - 1;
-  int max_inner_degree = 3;
-  int min_inner_degree = 2;
-
-  show_tree_info(tip_count,
-                 inner_count,
-                 min_inner_degree,
-                 max_inner_degree);
-
-  double * outbuffer = (double *)xmalloc((tip_count+inner_count-1) * 
-                                          sizeof(double));
-
-  int count = rtree_query_branch_lengths(root, outbuffer);
-
   double min,max,mean,median,var,stdev;
-  stats(outbuffer,count,&min,&max,&mean,&median,&var,&stdev);
+
+  stats(lengths,count,&min,&max,&mean,&median,&var,&stdev);
   printf("Min. branch length: %f\n", min);
   printf("Max. branch length: %f\n", max);
   printf("Mean branch length: %f\n", mean);
   printf("Median branch length: %f\n", median);
   printf("Variance branch length: %f\n", var);
   printf("Standard deviation branch length: %f\n", stdev);
-  printf("Longest lineage: %f\n", rtree_longest_path(root));
-
-  free(outbuffer);
-
 }
 
-static void utree_info(utree_t * node, int tip_count)
+/* Shows the numbers of nodes and their degrees, and for binary trees the
+   statistics of the branch lengths, as well as the longest lineage of rooted
+   trees. Missing lengths count as 1 in rooted and as 0.1 in unrooted trees,
+   which is what they are set to in rtree_t and utree_t */
+static void ftree_info(ftree_t * tree)
 {
-  int inner_count = tip_count - 2;
-  int max_inner_degree = 3;
-  int min_inner_degree = 3;
+  int i, c;
+  int n = tree->node_count;
+  int tip_count = tree->tip_count;
+  int min_inner_degree = 0;
+  int max_inner_degree = 0;
+  double missing = tree->tree_type == TREE_ROOTED ? 1 : 0.1;
+
+  if (tree->tree_type == TREE_ROOTED)
+  {
+    min_inner_degree = 2;
+    max_inner_degree = 3;
+  }
+  else if (tree->tree_type == TREE_UNROOTED)
+  {
+    min_inner_degree = 3;
+    max_inner_degree = 3;
+  }
+  else if (n > 1)
+  {
+    /* the degree of the root is its number of children, and the other inner
+       nodes also have a parent */
+    min_inner_degree = INT_MAX;
+    for (i = 0; i < n; ++i)
+    {
+      int degree = i != tree->root;
+
+      if (tree->left[i] == -1)
+        continue;
+
+      for (c = tree->left[i]; c != -1; c = tree->sibling[c])
+        ++degree;
+
+      min_inner_degree = MIN(min_inner_degree, degree);
+      max_inner_degree = MAX(max_inner_degree, degree);
+    }
+  }
 
   show_tree_info(tip_count,
-                 inner_count,
+                 n - tip_count,
                  min_inner_degree,
                  max_inner_degree);
 
-  double * outbuffer = (double *)xmalloc((tip_count+inner_count-1) * 
-                                          sizeof(double));
+  if (tree->tree_type == TREE_NARY)
+    return;
 
-  int count = utree_query_branch_lengths(node, outbuffer, tip_count+inner_count );
-  double min,max,mean,median,var,stdev;
-  stats(outbuffer,count,&min,&max,&mean,&median,&var,&stdev);
-  printf("Min. branch length: %f\n", min);
-  printf("Max. branch length: %f\n", max);
-  printf("Mean branch length: %f\n", mean);
-  printf("Median branch length: %f\n", median);
-  printf("Variance branch length: %f\n", var);
-  printf("Standard deviation branch length: %f\n", stdev);
+  /* branch lengths of all nodes but the root, which is the last node */
+  double * lengths = (double *)xmalloc(n * sizeof(double));
 
-  free(outbuffer);
-}
+  for (i = 0; i < n; ++i)
+    lengths[i] = FTREE_HAS_LENGTH(tree, i) ? FTREE_LENGTH(tree, i) : missing;
 
-static void ntree_info(ntree_t * root)
-{
-  int tip_count;
-  int inner_count;
-  int max_inner_degree;
-  int min_inner_degree;
+  show_length_stats(lengths, n - 1);
 
-  ntree_node_count(root,
-                   &inner_count,
-                   &tip_count,
-                   &min_inner_degree,
-                   &max_inner_degree);
+  if (tree->tree_type == TREE_ROOTED)
+  {
+    /* Parents have higher numbers, so nodes are visited after their parent
+       when going down from the root. The lineage of a tip includes the
+       branch above the root, as in rtree_longest_path() */
+    double longest = 0;
 
-  show_tree_info(tip_count,
-                 inner_count,
-                 min_inner_degree,
-                 max_inner_degree);
+    for (i = n - 1; i >= 0; --i)
+    {
+      lengths[i] = FTREE_HAS_LENGTH(tree, i) ? FTREE_LENGTH(tree, i) : missing;
+      if (i != tree->root)
+        lengths[i] += lengths[tree->parent[i]];
+      if (tree->left[i] == -1)
+        longest = MAX(longest, lengths[i]);
+    }
+    printf("Longest lineage: %f\n", longest);
+  }
 
+  free(lengths);
 }
 
 void cmd_info(void)
 {
+  ftree_t * tree;
+
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open_ntree(opt_treefile);
 
-  if (rtree)
+  while ((tree = forest_next_ftree()))
   {
     if (!opt_quiet)
-      printf("Loaded binary rooted tree...\n");
+      printf(tree->tree_type == TREE_ROOTED ?
+               "Loaded binary rooted tree...\n" :
+             tree->tree_type == TREE_UNROOTED ?
+               "Loaded unrooted binary tree...\n" : "Loaded n-ary tree\n");
 
     /* show info */
-    rtree_info(rtree);
+    ftree_info(tree);
 
     /* deallocate tree structure */
-    rtree_destroy(rtree);
+    ftree_destroy(tree);
   }
-  else
-  {
-    int tip_count;
-
-    utree_t * utree = utree_parse_newick(opt_treefile, &tip_count);
-    if (utree)
-    {
-      if (!opt_quiet)
-        printf("Loaded unrooted binary tree...\n");
-
-      /* show info */
-      utree_info(utree, tip_count);
 
-      /* deallocate tree structure */
-      utree_destroy(utree);
-
-    }
-    else
-    {
-      ntree_t * ntree = ntree_parse_newick(opt_treefile);
-      if (ntree)
-      {
-        if (!opt_quiet)
-          printf ("Loaded n-ary tree\n");
-
-        /* show info */
-        ntree_info(ntree);
-
-        /* deallocate tree structure */
-        ntree_destroy(ntree);
-      }
-      else
-        fatal("Failed loading tree");
-    }
-  }
+  forest_close();
 }
-
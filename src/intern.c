@@ -0,0 +1,257 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Pool of interned labels. Every label is stored once, preceded by a header
+   holding its id, such that the labels of all trees point into the pool and
+   equal labels are equal pointers. Ids are dense integers assigned in the
+   order the labels are first seen. Lookups take a read lock and insertions a
+   write lock, such that several threads may parse trees at the same time */
+
+#define POOL_BLOCK_SIZE 1048576
+#define POOL_ALIGN      8
+
+typedef struct label_entry_s
+{
+  unsigned int id;
+  unsigned int hash;
+  char str[];
+} label_entry_t;
+
+typedef struct pool_block_s
+{
+  struct pool_block_s * prev;
+  size_t used;
+  size_t size;
+  char data[];
+} pool_block_t;
+
+static pthread_rwlock_t pool_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static pool_block_t * block_list = NULL;
+
+/* open addressing hash table of entries, with a power of two size */
+static label_entry_t ** slots = NULL;
+static size_t slot_count = 0;
+
+/* entries indexed by id */
+static label_entry_t ** entries = NULL;
+static size_t entries_alloc = 0;
+static size_t entries_count = 0;
+
+static unsigned int hash_fnv(const char * s, size_t len)
+{
+  unsigned int hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+  {
+    hash ^= (unsigned char)s[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+/* returns the slot holding the label, or the empty slot where it belongs */
+static size_t find_slot(const char * s, size_t len, unsigned int hash)
+{
+  size_t mask = slot_count - 1;
+  size_t i = hash & mask;
+
+  while (slots[i])
+  {
+    if (slots[i]->hash == hash &&
+        !strncmp(slots[i]->str, s, len) && !slots[i]->str[len])
+      break;
+    i = (i+1) & mask;
+  }
+
+  return i;
+}
+
+static void rehash(void)
+{
+  size_t i;
+  label_entry_t ** old = slots;
+  size_t old_count = slot_count;
+
+  slot_count = slot_count ? 2*slot_count : 1024;
+  slots = (label_entry_t **)xcalloc(slot_count, sizeof(label_entry_t *));
+
+  for (i = 0; i < old_count; ++i)
+  {
+    if (!old[i]) continue;
+
+    size_t j = old[i]->hash & (slot_count - 1);
+    while (slots[j])
+      j = (j+1) & (slot_count - 1);
+    slots[j] = old[i];
+  }
+
+  free(old);
+}
+
+static label_entry_t * entry_alloc(size_t len)
+{
+  size_t size = sizeof(label_entry_t) + len + 1;
+
+  size = (size + POOL_ALIGN - 1) & ~((size_t)POOL_ALIGN - 1);
+
+  if (!block_list || block_list->used + size > block_list->size)
+  {
+    size_t block_size = MAX(size, POOL_BLOCK_SIZE);
+    pool_block_t * block = (pool_block_t *)xmalloc(sizeof(pool_block_t) +
+                                                   block_size);
+    block->prev = block_list;
+    block->used = 0;
+    block->size = block_size;
+    block_list = block;
+  }
+
+  label_entry_t * entry = (label_entry_t *)(block_list->data +
+                                            block_list->used);
+  block_list->used += size;
+
+  return entry;
+}
+
+/* Returns the pooled copy of the label s[0..len-1], adding it to the pool if
+   it is not already there */
+char * label_intern(const char * s, size_t len)
+{
+  unsigned int hash = hash_fnv(s, len);
+  label_entry_t * entry = NULL;
+  size_t i;
+
+  pthread_rwlock_rdlock(&pool_lock);
+  if (slot_count)
+    entry = slots[find_slot(s, len, hash)];
+  pthread_rwlock_unlock(&pool_lock);
+
+  if (entry)
+    return entry->str;
+
+  pthread_rwlock_wrlock(&pool_lock);
+
+  if (2*(entries_count+1) > slot_count)
+    rehash();
+
+  /* the label may have been added since the read lock was released */
+  i = find_slot(s, len, hash);
+  if (!slots[i])
+  {
+    if (entries_count == entries_alloc)
+    {
+      entries_alloc = entries_alloc ? 2*entries_alloc : 1024;
+      entries = (label_entry_t **)xrealloc(entries, entries_alloc *
+                                                    sizeof(label_entry_t *));
+    }
+
+    entry = entry_alloc(len);
+    entry->id = (unsigned int)entries_count;
+    entry->hash = hash;
+    memcpy(entry->str, s, len);
+    entry->str[len] = 0;
+
+    entries[entries_count++] = entry;
+    slots[i] = entry;
+  }
+  entry = slots[i];
+
+  pthread_rwlock_unlock(&pool_lock);
+
+  return entry->str;
+}
+
+/* Returns the id of the label s[0..len-1], or -1 if it is not in the pool */
+int label_find(const char * s, size_t len)
+{
+  unsigned int hash = hash_fnv(s, len);
+  int id = -1;
+
+  pthread_rwlock_rdlock(&pool_lock);
+  if (slot_count)
+  {
+    label_entry_t * entry = slots[find_slot(s, len, hash)];
+    if (entry)
+      id = (int)entry->id;
+  }
+  pthread_rwlock_unlock(&pool_lock);
+
+  return id;
+}
+
+/* Returns the id of an interned label in constant time */
+int label_id(const char * label)
+{
+  const label_entry_t * entry;
+
+  entry = (const label_entry_t *)(label - offsetof(label_entry_t, str));
+
+  return (int)entry->id;
+}
+
+/* Returns the interned label with the given id */
+const char * label_string(int id)
+{
+  const char * label;
+
+  pthread_rwlock_rdlock(&pool_lock);
+  label = entries[id]->str;
+  pthread_rwlock_unlock(&pool_lock);
+
+  return label;
+}
+
+/* Returns the number of labels in the pool, which is also one more than the
+   largest id */
+int label_count(void)
+{
+  int count;
+
+  pthread_rwlock_rdlock(&pool_lock);
+  count = (int)entries_count;
+  pthread_rwlock_unlock(&pool_lock);
+
+  return count;
+}
+
+void label_pool_destroy(void)
+{
+  pthread_rwlock_wrlock(&pool_lock);
+
+  while (block_list)
+  {
+    pool_block_t * prev = block_list->prev;
+    free(block_list);
+    block_list = prev;
+  }
+
+  free(slots);
+  free(entries);
+  slots = NULL;
+  entries = NULL;
+  slot_count = entries_alloc = entries_count = 0;
+
+  pthread_rwlock_unlock(&pool_lock);
+}
@@ -0,0 +1,1025 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+#define READ_CHUNK 65536
+#define LEXER_BLOCK_SIZE 64
+
+/* character classes */
+#define CC_SPACE        1       /* skipped between tokens */
+#define CC_DELIM        2       /* terminates an unquoted label */
+#define CC_NOSTART      4       /* may not start an unquoted label */
+
+static unsigned char cclass[256];
+
+/* Block classification. Before tokenizing the bytes of a block of
+   LEXER_BLOCK_SIZE bytes, the lexer computes two bit masks for it, with one
+   bit per byte: the delimiters that end an unquoted label, and white space.
+   The end of a label and the start of the next token are then found by
+   counting trailing zero bits rather than by looking at every byte. The
+   masks are computed with a lookup of the two nibbles of each byte, on 32
+   bytes at a time with AVX2 and 16 with SSE4.2, or with the character class
+   table otherwise, depending on the SIMD level selected at startup. Quoted
+   labels and comments are still scanned on their own, since the lexer only
+   consults the masks outside of them */
+
+/* A byte is a delimiter if the entries of its low and high nibble have a
+   common bit, and white space if that bit is in NIBBLE_SPACE */
+#define NIBBLE_SPACE 0x11
+
+static const unsigned char nibble_low[16] __attribute__((aligned(16))) =
+ {
+   0x10, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x03, 0x05, 0x0c, 0x02, 0x09, 0, 0
+ };
+
+static const unsigned char nibble_high[16] __attribute__((aligned(16))) =
+ {
+   0x01, 0, 0x12, 0x04, 0, 0x08, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+ };
+
+static void classify_scalar(const char * p,
+                            unsigned long * delim,
+                            unsigned long * space)
+{
+  int i;
+
+  *delim = *space = 0;
+  for (i = 0; i < LEXER_BLOCK_SIZE; ++i)
+  {
+    unsigned char c = cclass[(unsigned char)p[i]];
+
+    if (c & CC_DELIM)
+      *delim |= 1UL << i;
+    if (c & CC_SPACE)
+      *space |= 1UL << i;
+  }
+}
+
+__attribute__((target("sse4.2")))
+static void classify_sse42(const char * p,
+                           unsigned long * delim,
+                           unsigned long * space)
+{
+  __m128i low = _mm_load_si128((const __m128i *)nibble_low);
+  __m128i high = _mm_load_si128((const __m128i *)nibble_high);
+  __m128i nibble = _mm_set1_epi8(0x0f);
+  __m128i white = _mm_set1_epi8(NIBBLE_SPACE);
+  __m128i zero = _mm_setzero_si128();
+  int i;
+
+  *delim = *space = 0;
+  for (i = 0; i < LEXER_BLOCK_SIZE; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i c = _mm_and_si128(
+                  _mm_shuffle_epi8(low, _mm_and_si128(x, nibble)),
+                  _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(x, 4),
+                                                       nibble)));
+    unsigned long d = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(c, zero));
+    unsigned long w = (unsigned int)_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(_mm_and_si128(c, white), zero));
+
+    *delim |= (~d & 0xffff) << i;
+    *space |= (~w & 0xffff) << i;
+  }
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char * p,
+                          unsigned long * delim,
+                          unsigned long * space)
+{
+  __m256i low = _mm256_broadcastsi128_si256(
+                  _mm_load_si128((const __m128i *)nibble_low));
+  __m256i high = _mm256_broadcastsi128_si256(
+                   _mm_load_si128((const __m128i *)nibble_high));
+  __m256i nibble = _mm256_set1_epi8(0x0f);
+  __m256i white = _mm256_set1_epi8(NIBBLE_SPACE);
+  __m256i zero = _mm256_setzero_si256();
+  int i;
+
+  *delim = *space = 0;
+  for (i = 0; i < LEXER_BLOCK_SIZE; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i c = _mm256_and_si256(
+                  _mm256_shuffle_epi8(low, _mm256_and_si256(x, nibble)),
+                  _mm256_shuffle_epi8(high,
+                                      _mm256_and_si256(_mm256_srli_epi16(x, 4),
+                                                       nibble)));
+    unsigned long d = (unsigned int)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(c, zero));
+    unsigned long w = (unsigned int)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(_mm256_and_si256(c, white), zero));
+
+    *delim |= (~d & 0xffffffffUL) << i;
+    *space |= (~w & 0xffffffffUL) << i;
+  }
+}
+
+/* kernels by SIMD level */
+typedef void (*classify_t)(const char *, unsigned long *, unsigned long *);
+typedef size_t (*find_any_t)(const char *, size_t, size_t,
+                             char, char, char, char);
+
+static size_t find_any_scalar(const char *, size_t, size_t,
+                              char, char, char, char);
+static size_t find_any_sse2(const char *, size_t, size_t,
+                            char, char, char, char);
+static size_t find_any_avx2(const char *, size_t, size_t,
+                            char, char, char, char);
+
+static const classify_t classify_kernel[SIMD_LEVELS] =
+ {
+   classify_scalar, classify_sse42, classify_avx2
+ };
+
+static const find_any_t find_any_kernel[SIMD_LEVELS] =
+ {
+   find_any_scalar, find_any_sse2, find_any_avx2
+ };
+
+static classify_t classify;
+static find_any_t find_any;
+
+static void init_classes(void)
+{
+  const char * p;
+
+  if (cclass[(unsigned char)'('])
+    return;
+
+  classify = classify_kernel[simd_level];
+  find_any = find_any_kernel[simd_level];
+
+  for (p = " \t\n\r"; *p; ++p)
+    cclass[(unsigned char)*p] |= CC_SPACE;
+  for (p = " \t\n\r()[],:;"; *p; ++p)
+    cclass[(unsigned char)*p] |= CC_DELIM | CC_NOSTART;
+  for (p = "'\""; *p; ++p)
+    cclass[(unsigned char)*p] |= CC_NOSTART;
+}
+
+/* read a file that cannot be mapped (e.g. a pipe) into a buffer which, just
+   like the mapping, is terminated by a zero byte */
+static int read_whole(lexer_t * lexer, int fd)
+{
+  size_t alloc = READ_CHUNK;
+  ssize_t bytes;
+
+  lexer->data = (char *)xmalloc(alloc);
+  lexer->size = 0;
+
+  while ((bytes = read(fd, lexer->data + lexer->size,
+                       alloc - lexer->size - 1)) > 0)
+  {
+    lexer->size += (size_t)bytes;
+    if (alloc - lexer->size == 1)
+    {
+      char * mem = (char *)xmalloc(2*alloc);
+      memcpy(mem, lexer->data, lexer->size);
+      free(lexer->data);
+      lexer->data = mem;
+      alloc *= 2;
+    }
+  }
+  lexer->data[lexer->size] = 0;
+
+  return bytes == 0;
+}
+
+/* Inflating gzip-compressed files. The inflated text is kept in a window
+   that starts at the tree being read and is extended by LEXER_WINDOW bytes
+   at a time, such that only about one window and the longest tree are in
+   memory at once, however large the file. lexer_window() moves the window
+   forward between trees, and lexer_load() inflates the whole file for the
+   readers that need all of it, e.g. to split it into chunks or to seek to
+   the offsets of an index. The compressed input, which may consist of
+   several concatenated gzip members, stays mapped until the file is
+   closed */
+
+#define LEXER_WINDOW 1048576
+
+struct lexer_stream_s
+{
+  z_stream z;
+  char * input;                 /* the compressed file */
+  size_t input_left;            /* bytes not yet passed to zlib */
+  size_t map_size;
+  int mapped;
+  int done;                     /* everything was inflated */
+  size_t alloc;                 /* size of the buffer of the window */
+  char * filename;
+};
+
+/* Appends up to LEXER_WINDOW bytes of inflated text to the window, which is
+   kept terminated by a zero byte */
+static int stream_fill(lexer_t * lexer)
+{
+  lexer_stream_t * s = lexer->stream;
+  int ret;
+
+  if (s->alloc - lexer->size < LEXER_WINDOW + 1)
+  {
+    s->alloc = MAX(2 * s->alloc, lexer->size + LEXER_WINDOW + 1);
+    lexer->data = (char *)xrealloc(lexer->data, s->alloc);
+  }
+
+  s->z.next_out = (Bytef *)lexer->data + lexer->size;
+  s->z.avail_out = LEXER_WINDOW;
+
+  while (s->z.avail_out && !s->done)
+  {
+    if (!s->z.avail_in)
+    {
+      s->z.avail_in = (uInt)MIN(s->input_left, UINT_MAX);
+      s->input_left -= s->z.avail_in;
+    }
+
+    ret = inflate(&s->z, Z_NO_FLUSH);
+
+    if (ret == Z_STREAM_END)
+    {
+      if (!s->z.avail_in && !s->input_left)
+        s->done = 1;
+      else
+        inflateReset(&s->z);      /* another member follows */
+    }
+    else if (ret != Z_OK &&
+             !(ret == Z_BUF_ERROR && (s->z.avail_in || s->input_left)))
+    {
+      snprintf(errmsg, 200, "Damaged or truncated gzip file (%s)",
+               s->filename);
+      return 0;
+    }
+  }
+
+  lexer->size = (size_t)((char *)s->z.next_out - lexer->data);
+  lexer->data[lexer->size] = 0;
+  lexer->block_valid = 0;
+
+  return 1;
+}
+
+/* Starts inflating the file whose compressed contents were read into the
+   lexer, and fills the first window */
+static int stream_open(lexer_t * lexer, const char * filename)
+{
+  lexer_stream_t * s = (lexer_stream_t *)xcalloc(1, sizeof(lexer_stream_t));
+
+  if (inflateInit2(&s->z, 15 + 32) != Z_OK)
+  {
+    free(s);
+    snprintf(errmsg, 200, "Unable to inflate file (%s)", filename);
+    return 0;
+  }
+
+  s->input = lexer->data;
+  s->input_left = lexer->size;
+  s->map_size = lexer->map_size;
+  s->mapped = lexer->mapped;
+  s->filename = xstrdup(filename);
+  s->z.next_in = (Bytef *)s->input;
+
+  lexer->stream = s;
+  lexer->data = NULL;
+  lexer->size = 0;
+  lexer->mapped = 0;
+
+  return stream_fill(lexer);
+}
+
+static void stream_close(lexer_stream_t * s)
+{
+  inflateEnd(&s->z);
+
+  if (s->mapped)
+    munmap(s->input, s->map_size);
+  else
+    free(s->input);
+
+  free(s->filename);
+  free(s);
+}
+
+/* Inflates the rest of a compressed file, such that all of it is in the
+   buffer of the lexer */
+int lexer_load(lexer_t * lexer)
+{
+  while (lexer->stream && !lexer->stream->done)
+    if (!stream_fill(lexer))
+      return 0;
+
+  return 1;
+}
+
+/* Makes sure that the tree at the position of the lexer is complete in the
+   window of a compressed file, if there is another tree. The text before
+   the position is dropped, and its size and line breaks are added to base
+   and base_lines, from which the offsets and lines in the file are
+   computed. Other files are in memory as a whole, and are left alone */
+int lexer_window(lexer_t * lexer)
+{
+  size_t start;
+  size_t shift;
+
+  if (!lexer->stream)
+    return 1;
+
+  while (!lexer->stream->done)
+  {
+    /* a tree followed by at least one byte has its semicolon in the
+       window, even if the semicolon is the last byte of a member */
+    start = lexer_tree_start(lexer, lexer->pos);
+    if (start < lexer->size && lexer_tree_end(lexer, start) < lexer->size)
+      break;
+
+    shift = lexer->pos;
+    if (shift)
+    {
+      lexer->base_lines += lexer_count_lines(lexer, 0, shift);
+      lexer->base += shift;
+      memmove(lexer->data, lexer->data + shift, lexer->size - shift + 1);
+      lexer->size -= shift;
+      lexer->pos = 0;
+      lexer->token = lexer->token > shift ? lexer->token - shift : 0;
+    }
+
+    if (!stream_fill(lexer))
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Maps the file into memory. The mapping is placed over an anonymous region
+   one byte larger than the file, such that the byte following the contents
+   is always zero even when the file size is a multiple of the page size.
+   This lets numbers be converted with strtod directly on the mapped bytes
+   when needed. Files compressed with gzip are inflated one window at a
+   time, see lexer_window(), except for NEXUS files, which are inflated as
+   a whole since their TRANSLATE table is read before the trees */
+int lexer_open_stream(lexer_t * lexer, const char * filename)
+{
+  struct stat st;
+  void * region;
+
+  init_classes();
+
+  memset(lexer, 0, sizeof(lexer_t));
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) == -1)
+  {
+    if (fd != -1) close(fd);
+    snprintf(errmsg, 200, "Unable to open file (%s)", filename);
+    return 0;
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    lexer->size = (size_t)st.st_size;
+    lexer->map_size = lexer->size + 1;
+
+    region = mmap(NULL, lexer->map_size, PROT_READ,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region != MAP_FAILED &&
+        mmap(region, lexer->size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+             fd, 0) != MAP_FAILED)
+    {
+      madvise(region, lexer->size, MADV_SEQUENTIAL);
+      lexer->data = (char *)region;
+      lexer->mapped = 1;
+    }
+    else if (region != MAP_FAILED)
+      munmap(region, lexer->map_size);
+  }
+
+  if (!lexer->mapped && !read_whole(lexer, fd))
+  {
+    close(fd);
+    free(lexer->data);
+    lexer->data = NULL;
+    snprintf(errmsg, 200, "Unable to read file (%s)", filename);
+    return 0;
+  }
+
+  close(fd);
+
+  if (lexer->size >= 18 && (unsigned char)lexer->data[0] == 0x1f &&
+      (unsigned char)lexer->data[1] == 0x8b && !stream_open(lexer, filename))
+  {
+    lexer_close(lexer);
+    return 0;
+  }
+
+  /* NEXUS files are read with their TRANSLATE table */
+  if (nexus_probe(lexer->data, lexer->size) &&
+      (!lexer_load(lexer) ||
+       !(lexer->nexus = nexus_create(lexer->data, lexer->size))))
+  {
+    lexer_close(lexer);
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Opens the file with all of its contents in memory */
+int lexer_open(lexer_t * lexer, const char * filename)
+{
+  if (!lexer_open_stream(lexer, filename))
+    return 0;
+
+  if (!lexer_load(lexer))
+  {
+    lexer_close(lexer);
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Tokenizes data[0..size-1], which belongs to the caller and is not freed
+   by lexer_close(). Numbers are converted in place, so the buffer must be
+   followed by a delimiter or a zero byte, as is the case for any part of a
+   file opened with lexer_open() that ends with a complete tree. If nexus is
+   not NULL, the data is a part of a NEXUS file that starts at a command */
+void lexer_init(lexer_t * lexer,
+                const char * data,
+                size_t size,
+                nexus_t * nexus)
+{
+  init_classes();
+
+  memset(lexer, 0, sizeof(lexer_t));
+
+  lexer->data = (char *)data;
+  lexer->size = size;
+  lexer->borrowed = 1;
+  lexer->nexus = nexus;
+}
+
+void lexer_close(lexer_t * lexer)
+{
+  if (lexer->stream)
+  {
+    stream_close(lexer->stream);
+    lexer->stream = NULL;
+  }
+
+  if (!lexer->data) return;
+
+  if (lexer->mapped)
+    munmap(lexer->data, lexer->map_size);
+  else if (!lexer->borrowed)
+    free(lexer->data);
+
+  if (lexer->nexus && !lexer->borrowed)
+    nexus_destroy(lexer->nexus);
+
+  free(lexer->label_buf);
+
+  lexer->nexus = NULL;
+  lexer->data = NULL;
+  lexer->label_buf = NULL;
+  lexer->label_alloc = 0;
+}
+
+/* Computes the masks of the block containing pos. The bytes of the last,
+   partial block are copied into a block padded with semicolons, so that
+   the scans stop at the end of the buffer */
+static void lexer_block(lexer_t * lexer, size_t pos)
+{
+  size_t block = pos & ~(size_t)(LEXER_BLOCK_SIZE - 1);
+
+  if (block + LEXER_BLOCK_SIZE <= lexer->size)
+    classify(lexer->data + block, &lexer->block_delim, &lexer->block_space);
+  else
+  {
+    char tail[LEXER_BLOCK_SIZE];
+
+    memset(tail, ';', LEXER_BLOCK_SIZE);
+    memcpy(tail, lexer->data + block, lexer->size - block);
+    classify(tail, &lexer->block_delim, &lexer->block_space);
+  }
+
+  lexer->block = block;
+  lexer->block_valid = 1;
+}
+
+/* returns the position of the first delimiter at or after pos */
+static size_t next_delim(lexer_t * lexer, size_t pos)
+{
+  while (pos < lexer->size)
+  {
+    unsigned long mask;
+
+    if (!lexer->block_valid || pos - lexer->block >= LEXER_BLOCK_SIZE)
+      lexer_block(lexer, pos);
+
+    mask = lexer->block_delim >> (pos - lexer->block);
+    if (mask)
+      return MIN(pos + (size_t)__builtin_ctzl(mask), lexer->size);
+
+    pos = lexer->block + LEXER_BLOCK_SIZE;
+  }
+
+  return lexer->size;
+}
+
+/* returns the position of the first byte at or after pos that is not white
+   space */
+static size_t next_nonspace(lexer_t * lexer, size_t pos)
+{
+  while (pos < lexer->size)
+  {
+    unsigned long mask;
+
+    if (!lexer->block_valid || pos - lexer->block >= LEXER_BLOCK_SIZE)
+      lexer_block(lexer, pos);
+
+    mask = ~lexer->block_space >> (pos - lexer->block);
+    if (mask)
+      return MIN(pos + (size_t)__builtin_ctzl(mask), lexer->size);
+
+    pos = lexer->block + LEXER_BLOCK_SIZE;
+  }
+
+  return lexer->size;
+}
+
+/* exactly representable powers of ten */
+static const double pow10_exact[] =
+ {
+   1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+ };
+
+/* Checks whether the unquoted label s[0..len-1] is a number, i.e. matches
+   [+-]?[0-9]+ or [+-]?[0-9]+\.[0-9]+([eE][+-]?[0-9]+)?, and converts it to a
+   double while scanning it. When the digits fit in 53 bits and the decimal
+   exponent is at most 22 in magnitude, the result is a single correctly
+   rounded multiplication or division. Otherwise we fall back to strtod on
+   the buffer, which is followed by a delimiter or the terminating zero */
+static int scan_number(const char * s, size_t len, double * value)
+{
+  const char * start = s;
+  const char * end = s + len;
+  const char * digits;
+  unsigned long mantissa = 0;
+  int mantissa_digits = 0;
+  int negative = 0;
+  int exponent = 0;
+  int exp_negative = 0;
+  int exp_value = 0;
+
+  if (*s == '+' || *s == '-')
+    negative = (*s++ == '-');
+
+  digits = s;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s)
+  {
+    if (mantissa_digits < 19)
+      mantissa = 10*mantissa + (unsigned long)(*s - '0');
+    else
+      ++exponent;
+    if (mantissa) ++mantissa_digits;
+  }
+  if (s == digits) return 0;
+
+  if (s < end)
+  {
+    if (*s++ != '.') return 0;
+
+    digits = s;
+    for (; s < end && *s >= '0' && *s <= '9'; ++s)
+    {
+      if (mantissa_digits < 19)
+      {
+        mantissa = 10*mantissa + (unsigned long)(*s - '0');
+        --exponent;
+      }
+      if (mantissa) ++mantissa_digits;
+    }
+    if (s == digits) return 0;
+
+    if (s < end)
+    {
+      if (*s != 'e' && *s != 'E') return 0;
+      ++s;
+      if (s < end && (*s == '+' || *s == '-'))
+        exp_negative = (*s++ == '-');
+
+      digits = s;
+      for (; s < end && *s >= '0' && *s <= '9'; ++s)
+        if (exp_value < 100000)
+          exp_value = 10*exp_value + (*s - '0');
+      if (s == digits || s != end) return 0;
+
+      exponent += exp_negative ? -exp_value : exp_value;
+    }
+  }
+
+  if (mantissa_digits <= 19 && mantissa < (1UL << 53) &&
+      exponent >= -22 && exponent <= 22)
+  {
+    *value = (double)mantissa;
+    if (exponent < 0)
+      *value /= pow10_exact[-exponent];
+    else
+      *value *= pow10_exact[exponent];
+    if (negative)
+      *value = -*value;
+  }
+  else
+    *value = strtod(start, NULL);
+
+  return 1;
+}
+
+/* appends s[0..len-1] to the label buffer, which grows geometrically and is
+   reused for all labels of the file */
+static void label_append(lexer_t * lexer, size_t * used,
+                         const char * s, size_t len)
+{
+  if (*used + len > lexer->label_alloc)
+  {
+    lexer->label_alloc = MAX(2*lexer->label_alloc, *used + len);
+    lexer->label_buf = (char *)xrealloc(lexer->label_buf,
+                                        lexer->label_alloc);
+  }
+
+  memcpy(lexer->label_buf + *used, s, len);
+  *used += len;
+}
+
+/* Return the position of the first byte at or after pos that equals one of
+   c0, c1, c2 and c3, or size if there is none. The vector versions compare
+   16 or 32 bytes with the four characters at once, and finish the last,
+   partial vector one byte at a time */
+static size_t find_any_scalar(const char * data, size_t pos, size_t size,
+                              char c0, char c1, char c2, char c3)
+{
+  for (; pos < size; ++pos)
+    if (data[pos] == c0 || data[pos] == c1 ||
+        data[pos] == c2 || data[pos] == c3)
+      break;
+
+  return pos;
+}
+
+static size_t find_any_sse2(const char * data, size_t pos, size_t size,
+                            char c0, char c1, char c2, char c3)
+{
+  __m128i v0 = _mm_set1_epi8(c0);
+  __m128i v1 = _mm_set1_epi8(c1);
+  __m128i v2 = _mm_set1_epi8(c2);
+  __m128i v3 = _mm_set1_epi8(c3);
+
+  for (; pos + 16 <= size; pos += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(data + pos));
+    __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, v0),
+                                           _mm_cmpeq_epi8(x, v1)),
+                              _mm_or_si128(_mm_cmpeq_epi8(x, v2),
+                                           _mm_cmpeq_epi8(x, v3)));
+    int mask = _mm_movemask_epi8(eq);
+
+    if (mask)
+      return pos + (size_t)__builtin_ctz((unsigned int)mask);
+  }
+
+  return find_any_scalar(data, pos, size, c0, c1, c2, c3);
+}
+
+__attribute__((target("avx2")))
+static size_t find_any_avx2(const char * data, size_t pos, size_t size,
+                            char c0, char c1, char c2, char c3)
+{
+  __m256i v0 = _mm256_set1_epi8(c0);
+  __m256i v1 = _mm256_set1_epi8(c1);
+  __m256i v2 = _mm256_set1_epi8(c2);
+  __m256i v3 = _mm256_set1_epi8(c3);
+
+  for (; pos + 32 <= size; pos += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + pos));
+    __m256i eq = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, v0),
+                                                 _mm256_cmpeq_epi8(x, v1)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(x, v2),
+                                                 _mm256_cmpeq_epi8(x, v3)));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(eq);
+
+    if (mask)
+      return pos + (size_t)__builtin_ctz(mask);
+  }
+
+  return find_any_sse2(data, pos, size, c0, c1, c2, c3);
+}
+
+/* Scans a quoted label whose first character is at data[pos], and returns
+   the position after the closing quote, or 0 if the label is unterminated.
+   Two consecutive quotes stand for one quote character; a backslash keeps
+   the next quote or backslash from closing the label, and both are kept
+   verbatim. Labels without doubled quotes are returned as views into the
+   data; the others are assembled in the label buffer, segment by segment,
+   which keeps scanning linear in the length of the label */
+static size_t scan_quoted(lexer_t * lexer, size_t pos, lexeme_t * lexeme)
+{
+  const char * data = lexer->data;
+  size_t size = lexer->size;
+  char quote = data[pos-1];
+  size_t start = pos;
+  size_t used = 0;
+  int unescape = 0;
+
+  while (1)
+  {
+    while ((pos = find_any(data, pos, size,
+                           quote, '\\', quote, quote)) < size &&
+           data[pos] != quote)
+    {
+      if (pos+1 < size && (data[pos+1] == '\\' || data[pos+1] == quote))
+        ++pos;
+      ++pos;
+    }
+
+    if (pos == size)
+      return 0;
+
+    if (pos+1 == size || data[pos+1] != quote)
+      break;
+
+    /* copy the segment up to and including the first quote of the pair */
+    label_append(lexer, &used, data+start, pos+1 - start);
+    unescape = 1;
+    pos += 2;
+    start = pos;
+  }
+
+  if (unescape)
+  {
+    label_append(lexer, &used, data+start, pos - start);
+    lexeme->str = lexer->label_buf;
+    lexeme->len = used;
+  }
+  else
+  {
+    lexeme->str = data + start;
+    lexeme->len = pos - start;
+  }
+
+  return pos+1;
+}
+
+/* Returns the next token of the buffer, or LEX_EOF at its end. Labels and
+   numbers are returned as views into the buffer, which remain valid until
+   lexer_close(), and numbers are also converted to a double. Quoted labels
+   with doubled quotes point to the label buffer instead, and remain valid
+   until the next quoted label */
+int lexer_next(lexer_t * lexer, lexeme_t * lexeme)
+{
+  const char * data = lexer->data;
+  size_t size = lexer->size;
+  size_t pos = lexer->pos;
+  size_t start;
+
+  /* outside TREE commands of NEXUS files, skip to the next newick string */
+  if (lexer->nexus && !lexer->in_tree)
+  {
+    pos = nexus_next_tree(data, size, pos, NULL);
+    lexer->in_tree = 1;
+  }
+
+  /* tokens mostly follow each other directly, without the masks */
+  if (pos < size &&
+      ((cclass[(unsigned char)data[pos]] & CC_SPACE) || data[pos] == '['))
+  {
+    while ((pos = next_nonspace(lexer, pos)) < size && data[pos] == '[')
+    {
+      /* comments, e.g. NHX annotations, are skipped like white space */
+      const char * end = (const char *)memchr(data+pos, ']', size-pos);
+      pos = end ? (size_t)(end - data) + 1 : size;
+    }
+  }
+
+  lexer->token = pos;
+  if (pos == size)
+  {
+    lexer->pos = pos;
+    return LEX_EOF;
+  }
+
+  lexer->pos = pos+1;
+  switch (data[pos])
+  {
+    case '(': return LEX_OPAR;
+    case ')': return LEX_CPAR;
+    case ',': return LEX_COMMA;
+    case ':': return LEX_COLON;
+    case ';':
+      lexer->in_tree = 0;
+      return LEX_SEMICOLON;
+
+    case '\'':
+    case '"':
+      pos = scan_quoted(lexer, pos+1, lexeme);
+
+      /* an unterminated quoted label is an error at the opening quote, and
+         the rest of the input belongs to it */
+      if (!pos)
+      {
+        lexer->pos = size;
+        return LEX_ERROR;
+      }
+
+      lexer->pos = pos;
+      return LEX_STRING;
+  }
+
+  /* left to the parser, which reports the error at lexer->token */
+  if (cclass[(unsigned char)data[pos]] & CC_NOSTART)
+    return LEX_ERROR;
+
+  start = pos;
+  pos = next_delim(lexer, pos+1);
+
+  lexeme->str = data + start;
+  lexeme->len = pos - start;
+  lexer->pos = pos;
+
+  if (scan_number(lexeme->str, lexeme->len, &lexeme->number))
+    return LEX_NUMBER;
+
+  return LEX_STRING;
+}
+
+/* Returns the position of the next tree at or after pos, which in NEXUS
+   files is the position after the '=' of the next TREE command, or the size
+   of the buffer if there are no more trees. Only white space, comments and
+   NEXUS commands are looked at */
+size_t lexer_tree_start(const lexer_t * lexer, size_t pos)
+{
+  const char * data = lexer->data;
+  size_t size = lexer->size;
+
+  if (lexer->nexus)
+    return nexus_next_tree(data, size, pos, NULL);
+
+  while (pos < size)
+  {
+    if (cclass[(unsigned char)data[pos]] & CC_SPACE)
+      ++pos;
+    else if (data[pos] == '[')
+    {
+      const char * end = (const char *)memchr(data+pos, ']', size-pos);
+      pos = end ? (size_t)(end - data) + 1 : size;
+    }
+    else
+      break;
+  }
+
+  return pos;
+}
+
+/* Returns the position after the semicolon that ends the tree starting at
+   pos, or the size of the buffer if there is none. The tree is not
+   tokenized: the scan jumps from one semicolon, quote or comment to the
+   next, such that semicolons within quotes and comments are not taken for
+   the end of the tree */
+size_t lexer_tree_end(const lexer_t * lexer, size_t pos)
+{
+  const char * data = lexer->data;
+  size_t size = lexer->size;
+  const char * end;
+  char quote;
+
+  while ((pos = find_any(data, pos, size, ';', '[', '\'', '"')) < size)
+  {
+    switch (data[pos])
+    {
+      case ';':
+        return pos+1;
+
+      case '[':
+        end = (const char *)memchr(data+pos, ']', size-pos);
+        pos = end ? (size_t)(end - data) + 1 : size;
+        break;
+
+      default:
+        /* a backslash keeps the next quote or backslash from closing it */
+        quote = data[pos++];
+        while ((pos = find_any(data, pos, size,
+                               quote, '\\', quote, quote)) < size &&
+               data[pos] != quote)
+        {
+          if (pos+1 < size && (data[pos+1] == '\\' || data[pos+1] == quote))
+            ++pos;
+          ++pos;
+        }
+        if (pos < size)
+          ++pos;
+        break;
+    }
+  }
+
+  return size;
+}
+
+/* Counts the trees in the buffer with the same scan */
+long lexer_count_trees(const lexer_t * lexer)
+{
+  size_t pos = 0;
+  long count = 0;
+
+  while ((pos = lexer_tree_start(lexer, pos)) < lexer->size)
+  {
+    pos = lexer_tree_end(lexer, pos);
+    ++count;
+  }
+
+  return count;
+}
+
+/* Skips the next tree without tokenizing it. Returns 0 if there are no more
+   trees */
+int lexer_skip_tree(lexer_t * lexer)
+{
+  size_t pos = lexer_tree_start(lexer, lexer->pos);
+
+  if (pos == lexer->size)
+    return 0;
+
+  lexer->pos = lexer_tree_end(lexer, pos);
+  lexer->in_tree = 0;
+
+  return 1;
+}
+
+/* Continues tokenizing at the tree starting at pos, as returned by
+   lexer_tree_start() */
+void lexer_seek(lexer_t * lexer, size_t pos)
+{
+  lexer->pos = MIN(pos, lexer->size);
+  lexer->in_tree = 1;
+}
+
+/* Returns the number of line breaks in data[from..to-1], from which the
+   line of a position is computed for error messages */
+long lexer_count_lines(const lexer_t * lexer, size_t from, size_t to)
+{
+  const char * data = lexer->data;
+  long count = 0;
+
+  while (from < to)
+  {
+    const char * nl = (const char *)memchr(data+from, '\n', to-from);
+    if (!nl)
+      break;
+    ++count;
+    from = (size_t)(nl - data) + 1;
+  }
+
+  return count;
+}
+
+/* returns the interned copy of a label, or NULL for a missing label */
+char * lexeme_intern(lexeme_t lexeme)
+{
+  if (!lexeme.str) return NULL;
+
+  return label_intern(lexeme.str, lexeme.len);
+}
+
+/* Returns the interned label of a tip, which in NEXUS files may stand for
+   the taxon label it is mapped to by the TRANSLATE table */
+char * lexer_tip_label(lexer_t * lexer, lexeme_t lexeme)
+{
+  char * label;
+
+  if (lexer->nexus && lexeme.str &&
+      (label = nexus_translate(lexer->nexus, lexeme.str, lexeme.len)))
+    return label;
+
+  return lexeme_intern(lexeme);
+}
@@ -43,6 +43,7 @@ char * opt_alltree_filename;
 char * opt_resolve_clade;
 char * opt_labels;
 char * opt_attach_filename;
+char * opt_simd;
 char * opt_attach_at;
 int opt_quiet;
 int opt_precision;
@@ -77,7 +78,21 @@ long opt_simulate_tips;
 long opt_origin_scale;
 long opt_seed;
 long opt_scalebranch;
+long opt_threads;
+long opt_export_snapshot;
+long opt_export_newick;
+long opt_nexus;
+long opt_build_index;
+long opt_trees;
+long opt_trees_first;
+long opt_trees_last;
+long opt_trees_step;
+long opt_copy_trees;
+long opt_follow;
+long opt_compact;
+char * opt_quarantine;
 double opt_svg_legend_ratio;
+double opt_burnin;
 double opt_subtree_short;
 double opt_randomtree_minbranch;
 double opt_randomtree_maxbranch;
@@ -136,6 +151,18 @@ static struct option long_options[] =
   {"attach",               required_argument, 0, 0 },  /* 44 */
   {"attach_at",            required_argument, 0, 0 },  /* 45 */
   {"scale_branch",         required_argument, 0, 0 },  /* 46 */
+  {"threads",              required_argument, 0, 0 },  /* 47 */
+  {"export_snapshot",      no_argument,       0, 0 },  /* 48 */
+  {"export_newick",        no_argument,       0, 0 },  /* 49 */
+  {"nexus",                no_argument,       0, 0 },  /* 50 */
+  {"build_index",          no_argument,       0, 0 },  /* 51 */
+  {"trees",                required_argument, 0, 0 },  /* 52 */
+  {"burnin",               required_argument, 0, 0 },  /* 53 */
+  {"copy_trees",           no_argument,       0, 0 },  /* 54 */
+  {"simd",                 required_argument, 0, 0 },  /* 55 */
+  {"follow",               no_argument,       0, 0 },  /* 56 */
+  {"quarantine",           required_argument, 0, 0 },  /* 57 */
+  {"compact",              no_argument,       0, 0 },  /* 58 */
   { 0, 0, 0, 0 }
 };
 
@@ -198,6 +225,21 @@ void args_init(int argc, char ** argv)
   opt_attach_at = NULL;
   opt_scalebranch = 0;
   opt_scalebranch_factor = 0;
+  opt_threads = 1;
+  opt_export_snapshot = 0;
+  opt_export_newick = 0;
+  opt_nexus = 0;
+  opt_build_index = 0;
+  opt_trees = 0;
+  opt_trees_first = 1;
+  opt_trees_last = 0;
+  opt_trees_step = 1;
+  opt_burnin = 0;
+  opt_copy_trees = 0;
+  opt_follow = 0;
+  opt_quarantine = NULL;
+  opt_compact = 0;
+  opt_simd = NULL;
 
   while ((c = getopt_long_only(argc, argv, "", long_options, &option_index)) == 0)
   {
@@ -317,7 +359,11 @@ void args_init(int argc, char ** argv)
         break;
 
       case 28:
-        opt_precision = atoi(optarg);
+        if (!strcmp(optarg, "shortest"))
+          opt_precision = PRECISION_SHORTEST;
+        else if ((opt_precision = atoi(optarg)) < 0)
+          fatal("The argument to --precision must be a non-negative integer "
+                "or 'shortest'");
         break;
 
       case 29:
@@ -401,6 +447,63 @@ void args_init(int argc, char ** argv)
         opt_scalebranch_factor = atof(optarg);
         break;
 
+      case 47:
+        opt_threads = atol(optarg);
+        if (opt_threads < 1)
+          fatal("Number of threads must be a positive integer");
+        break;
+
+      case 48:
+        opt_export_snapshot = 1;
+        break;
+
+      case 49:
+        opt_export_newick = 1;
+        break;
+
+      case 50:
+        opt_nexus = 1;
+        break;
+
+      case 51:
+        opt_build_index = 1;
+        break;
+
+      case 52:
+        if (!args_gettrees(optarg))
+          fatal("Invalid tree selection %s, expected FIRST[-LAST][:STEP]",
+                optarg);
+        opt_trees = 1;
+        break;
+
+      case 53:
+        opt_burnin = atof(optarg);
+        if (opt_burnin < 0 || (opt_burnin >= 1 && opt_burnin != floor(opt_burnin)))
+          fatal("Burn-in must be a fraction below 1 or a number of trees");
+        if (opt_burnin > 0)
+          opt_trees = 1;
+        break;
+
+      case 54:
+        opt_copy_trees = 1;
+        break;
+
+      case 55:
+        opt_simd = optarg;
+        break;
+
+      case 56:
+        opt_follow = 1;
+        break;
+
+      case 57:
+        opt_quarantine = optarg;
+        break;
+
+      case 58:
+        opt_compact = 1;
+        break;
+
       default:
         fatal("Internal error in option parsing");
     }
@@ -475,6 +578,16 @@ void args_init(int argc, char ** argv)
     commands++;
   if (opt_scalebranch)
     commands++;
+  if (opt_export_snapshot)
+    commands++;
+  if (opt_export_newick)
+    commands++;
+  if (opt_build_index)
+    commands++;
+  if (opt_copy_trees)
+    commands++;
+  if (opt_follow)
+    commands++;
 
   /* if more than one independent command, fail */
   if (commands > 1)
@@ -526,8 +639,14 @@ void cmd_help()
           "  --help                           Display help information.\n"
           "  --version                        Display version information.\n"
           "  --quiet                          Only output warnings and fatal errors to stderr.\n"
-          "  --precision                      Number of digits to display after decimal point.\n"
+          "  --precision INT|shortest         Number of digits to display after decimal point,\n"
+          "                                   or the fewest digits that read back exactly.\n"
           "  --seed INT                       Seed to initialize random number generator.\n"
+          "  --threads INT                    Number of threads parsing files with many trees.\n"
+          "  --simd none|sse4.2|avx2          Instruction set of the vectorized code (default:\n"
+          "                                   the best one the processor supports).\n"
+          "  --compact                        Keep trees in a compact form of 20 bytes per\n"
+          "                                   node, with single precision branch lengths.\n"
           "Commnads for binary trees:\n"
           "  --lca_left                       Print  two  taxa whose LCA is the left child of\n"
           "                                   the root node.\n"
@@ -569,6 +688,20 @@ void cmd_help()
           "  --make_binary                    Convert n-ary/unrooted tree to binary.\n"
           "  --resolve-clade STRING           Resolve to binary only the given clade.\n"
           "  --resolve-ladder                 Resolve to binary in ladder-like way.\n"
+          "  --export_snapshot                Write the trees to --output_file as a binary\n"
+          "                                   snapshot, which is loaded faster than newick\n"
+          "                                   when given as --tree_file.\n"
+          "  --export_newick                  Write the trees (e.g. of a snapshot) in newick.\n"
+          "  --build_index                    Index the trees of --tree_file, such that\n"
+          "                                   --trees seeks to them without reading the rest\n"
+          "                                   of the file.\n"
+          "  --copy_trees                     Copy the trees selected by --trees and --burnin\n"
+          "                                   unchanged, without parsing them.\n"
+          "  --follow                         Process the trees of --tree_file as they are\n"
+          "                                   appended to it, e.g. by a running analysis,\n"
+          "                                   printing the tree lengths and split frequencies\n"
+          "                                   after each batch of trees. With --output_file,\n"
+          "                                   the frequency of every split is written to it.\n"
           "Options for visualization:\n"
           "  --svg_width INT                  Width of SVG image in pixels (default: 1920).\n"
           "  --svg_fontsize INT               Font size of SVG image. (default: 12)\n"
@@ -583,8 +716,21 @@ void cmd_help()
           "  --svg_marginbottom INT           Bottom margin in pixels (default: 20).\n"
           "  --svg_inner_radius               Radius of inner nodes in pixels (default: 0).\n"
           "Input and output options:\n"
-          "  --tree_file FILENAME             Tree file in newick format.\n"
+          "  --tree_file FILENAME             Tree file in newick, NEXUS or snapshot format,\n"
+          "                                   which may be compressed with gzip.\n"
+          "                                   If the file contains more than one tree, the\n"
+          "                                   command is applied to every tree in the file.\n"
           "  --output_file FILENAME           Optional output file name. If not specified, output is displayed on terminal.\n"
+          "                                   Output to a file ending in .gz is compressed.\n"
+          "  --trees FIRST[-LAST][:STEP]      Only process every STEP-th tree from FIRST to\n"
+          "                                   LAST (default: the last tree), e.g. 1000-5000:10.\n"
+          "  --burnin REAL                    Skip the first trees of the file, either a\n"
+          "                                   fraction of all trees (if below 1), e.g. 0.25,\n"
+          "                                   or a number of trees.\n"
+          "  --quarantine FILENAME            Trees that cannot be parsed are skipped with a\n"
+          "                                   warning. Write their text to FILENAME.\n"
+          "  --nexus                          Write output trees as a NEXUS TREES block whose\n"
+          "                                   TRANSLATE table numbers the taxa.\n"
          );
 }
 
@@ -600,9 +746,47 @@ int args_getdouble2(char * arg, double * a, double * b)
   return 1;
 }
 
+/* Parses a selection of trees FIRST[-LAST][:STEP], where a missing LAST
+   stands for the last tree of the file */
+int args_gettrees(char * arg)
+{
+  char * end;
+
+  opt_trees_first = strtol(arg, &end, 10);
+  opt_trees_last = opt_trees_first;
+  opt_trees_step = 1;
+
+  if (end == arg || opt_trees_first < 1)
+    return 0;
+
+  if (*end == '-')
+  {
+    arg = end + 1;
+    opt_trees_last = strtol(arg, &end, 10);
+    if (end == arg)
+      opt_trees_last = 0;
+    else if (opt_trees_last < opt_trees_first)
+      return 0;
+  }
+
+  if (*end == ':')
+  {
+    arg = end + 1;
+    opt_trees_step = strtol(arg, &end, 10);
+    if (end == arg || opt_trees_step < 1)
+      return 0;
+  }
+
+  return !*end;
+}
+
 void cmd_tree_show()
 {
   FILE * out;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
@@ -612,59 +796,70 @@ void cmd_tree_show()
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
   {
-    int tip_count;
-    utree_t * utree = utree_parse_newick(opt_treefile, &tip_count);
-    if (!utree)
-      fatal("Tree is neither unrooted nor rooted. Go fix your tree.");
-     
-    if (!opt_quiet)
-      fprintf(stdout, "Loaded unrooted tree...\n");
+    if (tree_type == TREE_UNROOTED)
+    {
+      if (!opt_quiet)
+        fprintf(stdout, "Loaded unrooted tree...\n");
 
-    utree_show_ascii(out,utree);
-    utree_destroy(utree);
-  }
-  else
-  {
-    if (!opt_quiet)
-      fprintf(stdout, "Loaded rooted binary tree...\n");
+      utree_show_ascii(out,utree);
+      utree_destroy(utree);
+    }
+    else if (tree_type == TREE_ROOTED)
+    {
+      if (!opt_quiet)
+        fprintf(stdout, "Loaded rooted binary tree...\n");
 
-    rtree_show_ascii(out,rtree);
-    rtree_destroy(rtree);
+      rtree_show_ascii(out,rtree);
+      rtree_destroy(rtree);
+    }
+    else
+      fatal("Tree is neither unrooted nor rooted. Go fix your tree.");
   }
 
+  forest_close();
+
   if (opt_outfile)
     fclose(out);
 }
 
 void cmd_lca_left()
 {
+  int tip_count;
+  int tree_type;
   rtree_t * tip1, * tip2;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
-    fatal("Tree must be rooted...");
-  
-  lca_tips(rtree, &tip1, &tip2);
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("Tree must be rooted...");
 
-  if (!opt_quiet)
-    printf("Computing left lca tips...\n");
+    lca_tips(rtree, &tip1, &tip2);
+
+    if (!opt_quiet)
+      printf("Computing left lca tips...\n");
 
-  if (tip1)
-    fprintf(stdout,"%s\n",tip1->label);
-  if (tip2)
-    fprintf(stdout,"%s\n",tip2->label);
+    if (tip1)
+      fprintf(stdout,"%s\n",tip1->label);
+    if (tip2)
+      fprintf(stdout,"%s\n",tip2->label);
+
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+  }
 
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
+  forest_close();
 
   if (!opt_quiet)
     fprintf(stdout, "Done...\n");
@@ -673,40 +868,47 @@ void cmd_lca_left()
 void cmd_root()
 {
   FILE * out;
+  writer_t * w;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
           xopen(opt_outfile,"w") : stdout;
+  w = writer_open(out);
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  int tip_count;
+  forest_open(opt_treefile);
 
-  utree_t * utree = utree_parse_newick(opt_treefile, &tip_count);
-  if (!utree)
-    fatal("File %s does not contain an unrooted binary tree...", opt_treefile);
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_UNROOTED)
+      fatal("File %s does not contain an unrooted binary tree...",
+            opt_treefile);
 
-  rtree_t * rtree = utree_convert_rtree(utree, tip_count, opt_root);
-  utree_destroy(utree);
+    rtree = utree_convert_rtree(utree, tip_count, opt_root);
+    utree_destroy(utree);
 
-  if (!opt_quiet)
-    fprintf(stdout, "Writing tree file...\n");
+    if (!opt_quiet)
+      fprintf(stdout, "Writing tree file...\n");
 
-  /* export tree structure to newick string */
-  char * newick = rtree_export_newick(rtree);
+    rtree_stream_newick(w, rtree);
 
-  fprintf(out, "%s\n", newick);
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+  }
+
+  forest_close();
+  writer_close(w);
 
   if (opt_outfile)
     fclose(out);
 
-  free(newick);
-
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
-
   if (!opt_quiet)
     fprintf(stdout, "Done...\n");
 }
@@ -715,44 +917,53 @@ void cmd_scalebranch()
 {
   int i;
   int nodes_count;
+  int tip_count;
+  int tree_type;
   FILE * out;
+  writer_t * w;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
           xopen(opt_outfile,"w") : stdout;
+  w = writer_open(out);
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
-    fatal("Tree must be rooted...");
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("Tree must be rooted...");
 
-  nodes_count = 2*rtree->leaves-1;
-  rtree_t ** nodes = (rtree_t **)xmalloc(nodes_count*sizeof(rtree_t *));
+    nodes_count = 2*rtree->leaves-1;
+    rtree_t ** nodes = (rtree_t **)xmalloc(nodes_count*sizeof(rtree_t *));
 
-  /* get all nodes */
-  rtree_query_tipnodes(rtree, nodes);
-  rtree_query_innernodes(rtree, nodes+rtree->leaves);
+    /* get all nodes */
+    rtree_query_tipnodes(rtree, nodes);
+    rtree_query_innernodes(rtree, nodes+rtree->leaves);
 
-  for (i=0; i < nodes_count; ++i)
-    nodes[i]->length *= opt_scalebranch_factor;
+    for (i=0; i < nodes_count; ++i)
+      nodes[i]->length *= opt_scalebranch_factor;
 
-  
-  char * newick = rtree_export_newick(rtree);
+    free(nodes);
+    
+    rtree_stream_newick(w, rtree);
+    
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+  }
 
-  fprintf(out, "%s\n", newick);
+  forest_close();
+  writer_close(w);
 
   if (opt_outfile)
     fclose(out);
 
-  free(newick);
-  
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
-
   if (!opt_quiet)
     fprintf(stdout, "\nDone...\n");
 }
@@ -760,44 +971,51 @@ void cmd_scalebranch()
 void cmd_extract_subtree(int which)
 {
   FILE * out;
+  writer_t * w;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
           xopen(opt_outfile,"w") : stdout;
+  w = writer_open(out);
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
-    fatal("Tree must be rooted...");
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("Tree must be rooted...");
 
-  
-  char * newick;
-  if (which == 0)
-    newick = rtree_export_newick(rtree->left);
-  else
-    newick = rtree_export_newick(rtree->right);
+    rtree_stream_newick(w, which == 0 ? rtree->left : rtree->right);
+    
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+  }
 
-  fprintf(out, "%s\n", newick);
+  forest_close();
+  writer_close(w);
 
   if (opt_outfile)
     fclose(out);
 
-  free(newick);
-  
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
-
   if (!opt_quiet)
     fprintf(stdout, "\nDone...\n");
 }
 void cmd_extract_ltips()
 {
   unsigned int i;
+  int tip_count;
+  int tree_type;
   FILE * out;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
@@ -807,27 +1025,32 @@ void cmd_extract_ltips()
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
-    fatal("Tree must be rooted...");
-  
-  if (!opt_quiet)
-    fprintf(out,"Tip labels for left subtree:\n");
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("Tree must be rooted...");
 
-  /* allocate list of tip nodes in left subtree */
-  rtree_t ** node_list = (rtree_t **)calloc(rtree->left->leaves,
-                                            sizeof(rtree_t *)); 
-  rtree_query_tipnodes(rtree->left, node_list);
+    if (!opt_quiet)
+      fprintf(out,"Tip labels for left subtree:\n");
 
-  /* print tip-node labels */
-  for (i = 0; i < rtree->left->leaves; ++i)
-    fprintf(out,"%s\n", node_list[i]->label);
+    /* allocate list of tip nodes in left subtree */
+    rtree_t ** node_list = (rtree_t **)calloc(rtree->left->leaves,
+                                              sizeof(rtree_t *)); 
+    rtree_query_tipnodes(rtree->left, node_list);
 
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
+    /* print tip-node labels */
+    for (i = 0; i < rtree->left->leaves; ++i)
+      fprintf(out,"%s\n", node_list[i]->label);
 
-  free(node_list);
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+
+    free(node_list);
+  }
+
+  forest_close();
 
   if (opt_outfile)
     fclose(out);
@@ -839,7 +1062,11 @@ void cmd_extract_ltips()
 void cmd_extract_rtips()
 {
   unsigned int i;
+  int tip_count;
+  int tree_type;
   FILE * out;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
@@ -849,27 +1076,32 @@ void cmd_extract_rtips()
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
-    fatal("Tree must be rooted...");
-  
-  if (!opt_quiet)
-    fprintf(out,"Tip labels for left subtree:\n");
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("Tree must be rooted...");
 
-  /* allocate list of tip nodes in left subtree */
-  rtree_t ** node_list = (rtree_t **)calloc(rtree->right->leaves,
-                                            sizeof(rtree_t *)); 
-  rtree_query_tipnodes(rtree->right, node_list);
+    if (!opt_quiet)
+      fprintf(out,"Tip labels for left subtree:\n");
 
-  /* print tip-node labels */
-  for (i = 0; i < rtree->right->leaves; ++i)
-    fprintf(out, "%s\n", node_list[i]->label);
+    /* allocate list of tip nodes in left subtree */
+    rtree_t ** node_list = (rtree_t **)calloc(rtree->right->leaves,
+                                              sizeof(rtree_t *)); 
+    rtree_query_tipnodes(rtree->right, node_list);
 
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
+    /* print tip-node labels */
+    for (i = 0; i < rtree->right->leaves; ++i)
+      fprintf(out, "%s\n", node_list[i]->label);
 
-  free(node_list);
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+
+    free(node_list);
+  }
+
+  forest_close();
 
   if (opt_outfile)
     fclose(out);
@@ -878,61 +1110,107 @@ void cmd_extract_rtips()
     fprintf(stdout, "\nDone...\n");
 }
 
-void cmd_extract_tips()
+/* The tips of a flat tree are numbered from left to right, as in any
+   postorder */
+static void extract_tips_compact(void)
 {
-  unsigned int i;
-
-  /* parse tree */
-  if (!opt_quiet)
-    fprintf(stdout, "Parsing tree file...\n");
+  int i;
+  ftree_t * tree;
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open_ntree(opt_treefile);
 
-  if (rtree)
+  while ((tree = forest_next_ftree()))
   {
+    if (tree->tree_type == TREE_NARY)
+      fatal("Tree is neither rooted or unrooted...");
+
     if (!opt_quiet)
-      printf("Loaded binary rooted tree...\n");
+      printf(tree->tree_type == TREE_ROOTED ?
+               "Loaded binary rooted tree...\n" :
+               "Loaded binary unrooted tree...\n");
 
     if (!opt_quiet)
       printf("Tip labels:\n");
 
-    rtree_t ** node_list = (rtree_t **)calloc(rtree->leaves,sizeof(rtree_t *)); 
-    rtree_query_tipnodes(rtree, node_list);
+    for (i = 0; i < tree->node_count; ++i)
+      if (tree->left[i] == -1)
+        printf("%s\n", label_string(tree->taxon[i]));
 
-    for (i = 0; i < rtree->leaves; ++i)
-      printf("%s\n", node_list[i]->label);
+    ftree_destroy(tree);
+  }
 
-    /* deallocate tree structure */
-    rtree_destroy(rtree);
+  forest_close();
 
-    free(node_list);
+  if (!opt_quiet)
+    fprintf(stdout, "\nDone...\n");
+}
+
+void cmd_extract_tips()
+{
+  unsigned int i;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
+
+  /* parse tree */
+  if (!opt_quiet)
+    fprintf(stdout, "Parsing tree file...\n");
+
+  if (opt_compact)
+  {
+    extract_tips_compact();
+    return;
   }
-  else
+
+  forest_open(opt_treefile);
+
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
   {
-    int tip_count;
+    if (tree_type == TREE_ROOTED)
+    {
+      if (!opt_quiet)
+        printf("Loaded binary rooted tree...\n");
 
-    utree_t * utree = utree_parse_newick(opt_treefile, &tip_count);
-    if (!utree)
-      fatal("Tree is neither rooted or unrooted...");
-    
-    if (!opt_quiet)
-      printf("Loaded binary unrooted tree...\n");
+      if (!opt_quiet)
+        printf("Tip labels:\n");
 
-    if (!opt_quiet)
-      printf("Tip labels:\n");
+      rtree_t ** node_list = (rtree_t **)calloc(rtree->leaves,sizeof(rtree_t *)); 
+      rtree_query_tipnodes(rtree, node_list);
 
-    utree_t ** node_list = (utree_t **)calloc((size_t)tip_count,
-                                              sizeof(utree_t *)); 
-    tip_count = utree_query_tipnodes(utree, node_list);
+      for (i = 0; i < rtree->leaves; ++i)
+        printf("%s\n", node_list[i]->label);
 
-    for (i = 0; (int)i < tip_count; ++i)
-      printf("%s\n", node_list[i]->label);
+      /* deallocate tree structure */
+      rtree_destroy(rtree);
 
-    /* deallocate tree structure */
-    utree_destroy(utree);
+      free(node_list);
+    }
+    else if (tree_type == TREE_UNROOTED)
+    {
+      if (!opt_quiet)
+        printf("Loaded binary unrooted tree...\n");
 
-    free(node_list);
+      if (!opt_quiet)
+        printf("Tip labels:\n");
+
+      utree_t ** node_list = (utree_t **)calloc((size_t)tip_count,
+                                                sizeof(utree_t *)); 
+      tip_count = utree_query_tipnodes(utree, node_list);
+
+      for (i = 0; (int)i < tip_count; ++i)
+        printf("%s\n", node_list[i]->label);
+
+      /* deallocate tree structure */
+      utree_destroy(utree);
+
+      free(node_list);
+    }
+    else
+      fatal("Tree is neither rooted or unrooted...");
   }
+
+  forest_close();
   
   if (!opt_quiet)
     fprintf(stdout, "\nDone...\n");
@@ -941,73 +1219,74 @@ void cmd_extract_tips()
 void cmd_identical(void)
 {
   int i;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree1;
+  utree_t * utree;
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree1 = rtree_parse_newick(opt_treefile);
   rtree_t * rtree2 = rtree_parse_newick(opt_identical);
-
-  if (!rtree1)
-    fatal("File %s does not contain a rooted binary tree...", opt_treefile);
   if (!rtree2)
     fatal("File %s does not contain a rooted binary tree...", opt_identical);
 
-  if (rtree1->leaves != rtree2->leaves)
-    printf("Trees have different topologies (number of leaves mismatch)\n");
-  else
-  {
-    rtree_t ** node_list1 = (rtree_t **)calloc(2*rtree1->leaves-1,sizeof(rtree_t *)); 
-    rtree_t ** node_list2 = (rtree_t **)calloc(2*rtree2->leaves-1,sizeof(rtree_t *)); 
+  rtree_t ** node_list2 = (rtree_t **)calloc(2*rtree2->leaves-1,sizeof(rtree_t *)); 
+  int index2 = 0;
+  rtree_traverse_sorted(rtree2, node_list2, &index2);
 
-    int index = 0;
-    rtree_traverse_sorted(rtree1, node_list1, &index);
-    index = 0;
-    rtree_traverse_sorted(rtree2, node_list2, &index);
+  forest_open(opt_treefile);
 
-    for(i = 0; i < index; ++i)
+  /* compare each tree in the tree file against the reference tree */
+  while ((tree_type = forest_next(&rtree1, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("File %s does not contain a rooted binary tree...", opt_treefile);
+
+    if (rtree1->leaves != rtree2->leaves)
+      printf("Trees have different topologies (number of leaves mismatch)\n");
+    else
     {
-      if (node_list1[i]->left == NULL && node_list2[i]->left != NULL)
-      {
-        printf("Trees have different topologies\n");
-        break;
-      }
-      else if (node_list1[i]->left != NULL && node_list2[i]->left == NULL)
-      {
-        printf("Trees have different topologies\n");
-        break;
-      }
+      rtree_t ** node_list1 = (rtree_t **)calloc(2*rtree1->leaves-1,sizeof(rtree_t *)); 
 
-      if (!node_list1[i]->label && node_list2[i]->label)
-      {
-        printf("Trees have different topologies\n");
-        break;
-      }
-      else if (node_list1[i]->label && !node_list2[i]->label)
-      {
-        printf("Trees have different topologies\n");
-        break;
-      }
-      else if (node_list1[i]->label && node_list2[i]->label)
+      int index = 0;
+      rtree_traverse_sorted(rtree1, node_list1, &index);
+
+      for(i = 0; i < index; ++i)
       {
-        if (strcmp(node_list1[i]->label, node_list2[i]->label))
+        if (node_list1[i]->left == NULL && node_list2[i]->left != NULL)
+        {
+          printf("Trees have different topologies\n");
+          break;
+        }
+        else if (node_list1[i]->left != NULL && node_list2[i]->left == NULL)
+        {
+          printf("Trees have different topologies\n");
+          break;
+        }
+
+        /* labels are interned, hence equal labels are the same pointer */
+        if (node_list1[i]->label != node_list2[i]->label)
         {
           printf("Trees have different topologies\n");
           break;
         }
       }
-    }
 
-    if (i == index)
-      printf("Trees have identical topologies\n");
+      if (i == index)
+        printf("Trees have identical topologies\n");
+
+      free(node_list1);
+    }
 
-    free(node_list1);
-    free(node_list2);
+    /* deallocate tree structure */
+    rtree_destroy(rtree1);
   }
 
-  /* deallocate tree structure */
-  rtree_destroy(rtree1);
+  forest_close();
+
+  free(node_list2);
   rtree_destroy(rtree2);
 
   if (!opt_quiet)
@@ -1018,62 +1297,57 @@ void cmd_identical(void)
 void cmd_make_binary()
 {
   FILE * out;
+  writer_t * w;
+  int tree_type;
+  ntree_t * ntree;
+
+  /* attempt to open output file */
+  out = opt_outfile ?
+          xopen(opt_outfile,"w") : stdout;
+  w = writer_open(out);
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open_ntree(opt_treefile);
 
-  if (rtree)
+  while ((ntree = forest_next_ntree(&tree_type)))
   {
-    printf("Loaded tree is already binary...\n");
-
-    /* deallocate tree structure */
-    rtree_destroy(rtree);
-  }
-  else
-  {
-    int tip_count;
-
-    utree_t * utree = utree_parse_newick(opt_treefile, &tip_count);
-    if (utree)
+    /* a binary tree is written unchanged, such that the output holds one
+       tree for every tree of the input */
+    if (tree_type == TREE_ROOTED)
     {
       if (!opt_quiet)
-        printf("Loaded unrooted binary tree...\n");
+        printf("Loaded tree is already binary...\n");
+
+      ntree_stream_newick(w, ntree);
 
       /* deallocate tree structure */
-      utree_destroy(utree);
+      ntree_destroy(ntree);
+      continue;
     }
 
-    /* load it as n-ary */
-    ntree_t * ntree = ntree_parse_newick(opt_treefile);
-    if (ntree)
-    {
-      /* convert to binary */
-      rtree_t * rt = ntree_to_rtree(ntree);
-
-      /* attempt to open output file */
-      out = opt_outfile ?
-              xopen(opt_outfile,"w") : stdout;
+    if (tree_type == TREE_UNROOTED && !opt_quiet)
+      printf("Loaded unrooted binary tree...\n");
 
-      char * newick = rtree_export_newick(rt);
+    /* convert to binary */
+    rtree_t * rt = ntree_to_rtree(ntree);
 
-      if (!opt_quiet)
-        fprintf(stdout,"Writing newick string...\n");
-      fprintf(out, "%s\n", newick);
+    if (!opt_quiet)
+      fprintf(stdout,"Writing newick string...\n");
+    rtree_stream_newick(w, rt);
 
-      free(newick);
+    /* deallocate tree structures */
+    ntree_destroy(ntree);
+    rtree_destroy(rt);
+  }
 
-      fclose(out);
+  forest_close();
+  writer_close(w);
 
-      /* deallocate tree structures */
-      ntree_destroy(ntree);
-      rtree_destroy(rt);
-    }
-    else
-      fatal("Failed loading tree as n-ary");
-  }
+  if (opt_outfile)
+    fclose(out);
 }
 
 void getentirecommandline(int argc, char * argv[])
@@ -1116,6 +1390,9 @@ int main (int argc, char * argv[])
   getentirecommandline(argc, argv);
 
   args_init(argc, argv);
+
+  cpu_features_detect();
+  simd_select(opt_simd);
   
   srand((unsigned int)opt_seed);
 
@@ -1206,7 +1483,28 @@ int main (int argc, char * argv[])
   {
     cmd_scalebranch();
   }
+  else if (opt_export_snapshot)
+  {
+    cmd_export_snapshot();
+  }
+  else if (opt_export_newick)
+  {
+    cmd_export_newick();
+  }
+  else if (opt_build_index)
+  {
+    cmd_build_index();
+  }
+  else if (opt_copy_trees)
+  {
+    cmd_copy_trees();
+  }
+  else if (opt_follow)
+  {
+    cmd_follow();
+  }
 
+  label_pool_destroy();
   free(cmdline);
   return (0);
 }
@@ -22,6 +22,8 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <pthread.h>
 #include <search.h>
@@ -34,8 +36,14 @@
 #include <math.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <ctype.h>
+#include <zlib.h>
 #include <time.h>
 
 /* constants */
@@ -55,16 +63,20 @@ typedef unsigned int UINT32;
 typedef unsigned short WORD;
 typedef unsigned char BYTE;
 
+typedef struct arena_s arena_t;
+
+/* The three records of an inner node are allocated as one block by
+   utree_inner_create(), such that next always points to the following
+   record of the block, or back to the first one. Tips have no next */
 typedef struct utree_s
 {
   char * label;
   double length;
-  int height;
   struct utree_s * next;
   struct utree_s * back;
-  int mark;
-
   void * data;
+  int height;
+  int mark;
 } utree_t;
 
 typedef struct rtree_s
@@ -88,15 +100,221 @@ typedef struct ntree_s
   struct ntree_s ** children;
   struct ntree_s * parent;
   int children_count;
+  int has_length;
   int mark;
 } ntree_t;
 
+/* tree stored as arrays indexed by node, with nodes numbered in postorder
+   and the root last (see ftree.c). Compact trees, read with --compact, keep
+   single precision lengths in flength and have no right, preorder and
+   length arrays, which leaves 20 bytes per node */
+typedef struct ftree_s
+{
+  int tree_type;
+  int node_count;
+  int tip_count;
+  int root;
+  int compact;
+  int32_t * parent;             /* -1 for the root */
+  int32_t * left;               /* first child, -1 for tips */
+  int32_t * right;              /* last child, -1 for tips */
+  int32_t * sibling;            /* next child of the parent, -1 if last */
+  int32_t * taxon;              /* id of the label in the pool, -1 if none */
+  int32_t * preorder;           /* nodes in preorder */
+  double * length;
+  float * flength;
+  unsigned char * has_length;   /* one bit per node */
+} ftree_t;
+
+/* explicit stack of the iterative traversals: each frame holds a node and
+   the number of its children that were visited */
+typedef struct trav_frame_s
+{
+  void * node;
+  int child;
+} trav_frame_t;
+
+typedef struct trav_stack_s
+{
+  trav_frame_t * frames;
+  int top;
+  int alloc;
+} trav_stack_t;
+
+typedef struct lexeme_s
+{
+  const char * str;
+  size_t len;
+  double number;
+} lexeme_t;
+
+typedef struct nexus_s nexus_t;
+
+typedef struct lexer_stream_s lexer_stream_t;
+
+typedef struct lexer_s
+{
+  char * data;
+  size_t size;
+  size_t map_size;
+  size_t pos;
+  size_t token;                 /* start of the last token returned */
+  int mapped;
+  int borrowed;
+  char * label_buf;
+  size_t label_alloc;
+  nexus_t * nexus;
+  int in_tree;
+  size_t block;                 /* start of the classified block */
+  int block_valid;
+  unsigned long block_delim;    /* delimiters of the block, one bit per byte */
+  unsigned long block_space;    /* white space of the block */
+  lexer_stream_t * stream;      /* inflate state of a compressed file */
+  size_t base;                  /* offset in the file of data[0] */
+  long base_lines;              /* line breaks before data[0] */
+} lexer_t;
+
+typedef struct ntree_parser_s ntree_parser_t;
+
+typedef struct ctree_parser_s ctree_parser_t;
+
+typedef struct writer_s writer_t;
+
+/* views into a tree record of a mapped snapshot file */
+typedef struct snapshot_tree_s
+{
+  int tree_type;
+  int node_count;
+  int tip_count;
+  const double * length;
+  const int * parent;
+  const int * child_start;
+  const unsigned int * label;
+  const unsigned char * has_length;
+  const char * strings;
+} snapshot_tree_t;
+
+/* lexer token codes */
+
+#define LEX_EOF                 0
+#define LEX_OPAR                1
+#define LEX_CPAR                2
+#define LEX_COMMA               3
+#define LEX_COLON               4
+#define LEX_SEMICOLON           5
+#define LEX_STRING              6
+#define LEX_NUMBER              7
+#define LEX_ERROR               8
+
+/* tree types */
+
+#define TREE_NONE               0
+#define TREE_ROOTED             1
+#define TREE_UNROOTED           2
+#define TREE_NARY               3
+
+/* value of opt_precision selecting the shortest round-trip output */
+
+#define PRECISION_SHORTEST      -1
+
+/* buffer size for format_double() that holds any double with six decimals */
+
+#define FORMAT_BUFFER_SIZE      352
+
+/* a burn-in below one is a fraction of the trees, and needs their number */
+
+#define BURNIN_RELATIVE         (opt_burnin > 0 && opt_burnin < 1)
+
+/* whether node i of a flat tree has a branch length, and the length */
+
+#define FTREE_HAS_LENGTH(t,i)   (((t)->has_length[(i) >> 3] >> ((i) & 7)) & 1)
+#define FTREE_LENGTH(t,i)       ((t)->compact ? (t)->flength[i] \
+                                        : (t)->length[i])
+
+/* levels of the vectorized kernels, each of which implies the ones below */
+
+#define SIMD_NONE               0
+#define SIMD_SSE42              1
+#define SIMD_AVX2               2
+#define SIMD_LEVELS             3
+
 /* macros */
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define SWAP(x,y) do { __typeof__ (x) _t = x; x = y; y = _t; } while(0)
 
+/* iterative traversals */
+
+#define TRAV_PUSH(s,x)                                                      \
+  do                                                                        \
+  {                                                                         \
+    if ((s)->top == (s)->alloc)                                             \
+      trav_stack_grow(s);                                                   \
+    (s)->frames[(s)->top].node = (x);                                       \
+    (s)->frames[(s)->top++].child = 0;                                      \
+  }                                                                         \
+  while(0)
+
+/* Depth-first traversal of the binary tree below root, without recursion.
+   The visitors are expressions in terms of the current node, which is
+   declared as a variable of type type* named var, and are expanded in the
+   loop such that the compiler specializes it for them:
+
+     ENTER  evaluated when a node is reached; if false, the node is left
+            immediately and LEAVE is skipped
+     LEAVE  statement run for a node once its subtree has been traversed,
+            i.e. in postorder
+
+   IS_TIP tells whether the node has no children, and FIRST and SECOND
+   select them otherwise. NULL children are passed over. The frame of a
+   node has child 1 while its first child is traversed and 2 while its
+   second one is, which visitors may read from the frames below the top.
+   Nodes already on the stack s are traversed after the subtree of root,
+   and the stack can be reused by further traversals until it is released
+   by trav_stack_free() */
+#define TRAVERSE_BINARY(s,type,root,var,IS_TIP,FIRST,SECOND,ENTER,LEAVE)    \
+  do                                                                        \
+  {                                                                         \
+    TRAV_PUSH(s, root);                                                     \
+    while ((s)->top)                                                        \
+    {                                                                       \
+      trav_frame_t * trav_f = (s)->frames + (s)->top - 1;                   \
+      type * var = (type *)trav_f->node;                                    \
+                                                                            \
+      if (!var)                                                             \
+      {                                                                     \
+        (s)->top--;                                                         \
+        continue;                                                           \
+      }                                                                     \
+                                                                            \
+      if (!trav_f->child)                                                   \
+      {                                                                     \
+        if (!(ENTER))                                                       \
+        {                                                                   \
+          (s)->top--;                                                       \
+          continue;                                                         \
+        }                                                                   \
+        if (!(IS_TIP))                                                      \
+        {                                                                   \
+          trav_f->child = 1;                                                \
+          TRAV_PUSH(s, FIRST);                                              \
+          continue;                                                         \
+        }                                                                   \
+      }                                                                     \
+      else if (trav_f->child == 1)                                          \
+      {                                                                     \
+        trav_f->child = 2;                                                  \
+        TRAV_PUSH(s, SECOND);                                               \
+        continue;                                                           \
+      }                                                                     \
+                                                                            \
+      LEAVE;                                                                \
+      (s)->top--;                                                           \
+    }                                                                       \
+  }                                                                         \
+  while(0)
+
 /* options */
 
 extern int opt_quiet;
@@ -143,6 +361,21 @@ extern long opt_simulate_tips;
 extern long opt_origin_scale;
 extern long opt_seed;
 extern long opt_scalebranch;
+extern long opt_threads;
+extern long opt_export_snapshot;
+extern long opt_export_newick;
+extern long opt_nexus;
+extern long opt_build_index;
+extern long opt_trees;
+extern long opt_trees_first;
+extern long opt_trees_last;
+extern long opt_trees_step;
+extern double opt_burnin;
+extern long opt_copy_trees;
+extern long opt_follow;
+extern long opt_compact;
+extern char * opt_quarantine;
+extern char * opt_simd;
 extern double opt_svg_legend_ratio;
 extern double opt_subtree_short;
 extern double opt_randomtree_minbranch;
@@ -166,6 +399,7 @@ extern long sse42_present;
 extern long popcnt_present;
 extern long avx_present;
 extern long avx2_present;
+extern int simd_level;
 
 /* functions in util.c */
 
@@ -183,6 +417,8 @@ long getusec(void);
 void show_rusage(void);
 FILE * xopen(const char * filename, const char * mode);
 void shuffle(void * array, size_t n, size_t size);
+void trav_stack_grow(trav_stack_t * s);
+void trav_stack_free(trav_stack_t * s);
 
 /* functions in newick-tools.c */
 
@@ -193,6 +429,7 @@ void fillheader(void);
 void show_header(void);
 void cmd_tree_show(void);
 int args_getdouble2(char * arg, double * a, double * b);
+int args_gettrees(char * arg);
 void cmd_lca_left(void);
 void cmd_root(void);
 void cmd_extract_subtree(int which);
@@ -204,7 +441,38 @@ void cmd_make_binary(void);
 
 /* functions in parse_ntree.y */
 
-ntree_t * ntree_parse_newick(const char * filename);
+ntree_parser_t * ntree_parser_create(void);
+
+void ntree_parser_destroy(ntree_parser_t * parser);
+
+int ntree_parser_open(ntree_parser_t * parser, const char * filename);
+
+void ntree_parser_set_buffer(ntree_parser_t * parser,
+                             const char * data,
+                             size_t size,
+                             nexus_t * nexus);
+
+ntree_t * ntree_parser_next(ntree_parser_t * parser,
+                            int * tip_count,
+                            int * tree_type);
+
+int ntree_parser_eof(ntree_parser_t * parser);
+
+const char * ntree_parser_error(ntree_parser_t * parser);
+
+size_t ntree_parser_error_pos(ntree_parser_t * parser);
+
+void ntree_parser_skip(ntree_parser_t * parser, size_t * start, size_t * end);
+
+lexer_t * ntree_parser_lexer(ntree_parser_t * parser);
+
+void ntree_parser_close(ntree_parser_t * parser);
+
+void ntree_syntax_error(char * msg,
+                        size_t size,
+                        int token,
+                        const int * expected,
+                        int count);
 
 void ntree_destroy(ntree_t * root);
 
@@ -214,13 +482,6 @@ rtree_t * rtree_parse_newick(const char * filename);
 
 void rtree_destroy(rtree_t * root);
 
-/* functions in parse_utree.y */
-
-utree_t * utree_parse_newick(const char * filename,
-                             int * tip_count);
-
-void utree_destroy(utree_t * root);
-
 /* functions in ntree.c */
 
 void ntree_node_count(ntree_t * root,
@@ -231,11 +492,17 @@ void ntree_node_count(ntree_t * root,
 
 rtree_t * ntree_to_rtree(ntree_t * root);
 
+rtree_t * ntree_binary_to_rtree(ntree_t * root);
+
+utree_t * ntree_binary_to_utree(ntree_t * root);
+
 /* functions in utree.c */
 
-void utree_show_ascii(FILE * stream, utree_t * tree);
+utree_t * utree_inner_create(arena_t * arena);
 
-char * utree_export_newick(utree_t * root);
+void utree_destroy(utree_t * root);
+
+void utree_show_ascii(FILE * stream, utree_t * tree);
 
 int utree_traverse(utree_t * root,
                    int (*cbtrav)(utree_t *),
@@ -262,8 +529,6 @@ int utree_query_branch_lengths(utree_t * root, double * outbuffer, int count);
 
 void rtree_show_ascii(FILE * stream, rtree_t * tree);
 
-char * rtree_export_newick(rtree_t * root);
-
 int rtree_traverse(rtree_t * root,
                    int (*cbtrav)(rtree_t *),
                    rtree_t ** outbuffer);
@@ -296,14 +561,12 @@ int rtree_query_branch_lengths(rtree_t * root, double * outbuffer);
 
 double rtree_longest_path(rtree_t * root);
 
-/* functions in parse_rtree.y */
-
-rtree_t * rtree_parse_newick(const char * filename);
-
 /* functions in arch.c */
 
 unsigned long arch_get_memused();
 unsigned long arch_get_memtotal();
+void cpu_features_detect();
+void simd_select(const char * level);
 
 /* functions in lca_tips.c */
 
@@ -359,3 +622,253 @@ char ** parse_labels(const char * filename, int * count);
 /* functions in attach.c */
 
 void cmd_attach_tree(void);
+
+/* functions in forest.c */
+
+void forest_open(const char * filename);
+
+void forest_open_ntree(const char * filename);
+
+int forest_next(rtree_t ** rtree,
+                utree_t ** utree,
+                int * tip_count,
+                ntree_t ** ntree);
+
+ntree_t * forest_next_ntree(int * tree_type);
+
+ftree_t * forest_next_ftree(void);
+
+void forest_close(void);
+
+void reject_open(void);
+
+void reject_tree(long tree,
+                 size_t offset,
+                 long line,
+                 const char * msg,
+                 const char * text,
+                 size_t len);
+
+long reject_close(void);
+
+/* functions in lexer.c */
+
+int lexer_open(lexer_t * lexer, const char * filename);
+
+int lexer_open_stream(lexer_t * lexer, const char * filename);
+
+int lexer_load(lexer_t * lexer);
+
+int lexer_window(lexer_t * lexer);
+
+void lexer_init(lexer_t * lexer,
+                const char * data,
+                size_t size,
+                nexus_t * nexus);
+
+void lexer_close(lexer_t * lexer);
+
+int lexer_next(lexer_t * lexer, lexeme_t * lexeme);
+
+char * lexeme_intern(lexeme_t lexeme);
+
+char * lexer_tip_label(lexer_t * lexer, lexeme_t lexeme);
+
+size_t lexer_tree_start(const lexer_t * lexer, size_t pos);
+
+size_t lexer_tree_end(const lexer_t * lexer, size_t pos);
+
+long lexer_count_trees(const lexer_t * lexer);
+
+int lexer_skip_tree(lexer_t * lexer);
+
+void lexer_seek(lexer_t * lexer, size_t pos);
+
+long lexer_count_lines(const lexer_t * lexer, size_t from, size_t to);
+
+/* functions in intern.c */
+
+char * label_intern(const char * s, size_t len);
+
+int label_find(const char * s, size_t len);
+
+int label_id(const char * label);
+
+const char * label_string(int id);
+
+int label_count(void);
+
+void label_pool_destroy(void);
+
+/* functions in ftree.c */
+
+ftree_t * ftree_create(int n, int compact);
+
+void ftree_resize(ftree_t * tree, int n);
+
+void ftree_set_length(ftree_t * tree, int node, double length);
+
+void ftree_compact(ftree_t * tree);
+
+ftree_t * ftree_from_rtree(rtree_t * root);
+
+ftree_t * ftree_from_utree(utree_t * root);
+
+ftree_t * ftree_from_ntree(ntree_t * root);
+
+rtree_t * ftree_to_rtree(const ftree_t * tree);
+
+utree_t * ftree_to_utree(const ftree_t * tree);
+
+ntree_t * ftree_to_ntree(const ftree_t * tree);
+
+void ftree_destroy(ftree_t * tree);
+
+/* functions in ctree.c */
+
+ctree_parser_t * ctree_parser_create(void);
+
+void ctree_parser_destroy(ctree_parser_t * parser);
+
+int ctree_parser_open(ctree_parser_t * parser, const char * filename);
+
+ftree_t * ctree_parser_next(ctree_parser_t * parser);
+
+int ctree_parser_eof(ctree_parser_t * parser);
+
+const char * ctree_parser_error(ctree_parser_t * parser);
+
+size_t ctree_parser_error_pos(ctree_parser_t * parser);
+
+void ctree_parser_skip(ctree_parser_t * parser, size_t * start, size_t * end);
+
+lexer_t * ctree_parser_lexer(ctree_parser_t * parser);
+
+/* functions in arena.c */
+
+arena_t * arena_create(void);
+
+void * arena_alloc(arena_t * arena, size_t size);
+
+void * arena_realloc(arena_t * arena, void * ptr, size_t old_size, size_t size);
+
+arena_t * arena_of(const void * ptr);
+
+void arena_destroy(arena_t * arena);
+
+/* functions in snapshot.c */
+
+int snapshot_probe(const char * filename);
+
+int snapshot_open(const char * filename);
+
+int snapshot_next(snapshot_tree_t * tree);
+
+int snapshot_eof(void);
+
+void snapshot_close(void);
+
+ntree_t * snapshot_tree_ntree(const snapshot_tree_t * tree);
+
+rtree_t * snapshot_tree_rtree(const snapshot_tree_t * tree);
+
+utree_t * snapshot_tree_utree(const snapshot_tree_t * tree);
+
+void snapshot_write_header(FILE * fp);
+
+void snapshot_write_ntree(FILE * fp, ntree_t * root, int tree_type);
+
+void snapshot_write_ftree(FILE * fp, const ftree_t * tree);
+
+void cmd_export_snapshot(void);
+
+void cmd_export_newick(void);
+
+/* functions in newick.c */
+
+char * rtree_export_newick(rtree_t * root);
+
+char * utree_export_newick(utree_t * root);
+
+char * ntree_export_newick(ntree_t * root);
+
+void rtree_write_newick(FILE * fp, rtree_t * root);
+
+void utree_write_newick(FILE * fp, utree_t * root);
+
+void ntree_write_newick(FILE * fp, ntree_t * root);
+
+void rtree_stream_newick(writer_t * w, rtree_t * root);
+
+void utree_stream_newick(writer_t * w, utree_t * root);
+
+void ntree_stream_newick(writer_t * w, ntree_t * root);
+
+void ftree_stream_newick(writer_t * w, const ftree_t * tree);
+
+/* functions in index.c */
+
+unsigned long * index_load(const char * treefile,
+                           const lexer_t * lexer,
+                           long * count);
+
+int index_exists(const char * treefile);
+
+void cmd_build_index(void);
+
+void trees_burnin(long count);
+
+long trees_next_selected(long n);
+
+/* functions in copy.c */
+
+void cmd_copy_trees(void);
+
+/* functions in follow.c */
+
+void cmd_follow(void);
+
+/* functions in nexus.c */
+
+int nexus_probe(const char * data, size_t size);
+
+nexus_t * nexus_create(const char * data, size_t size);
+
+void nexus_destroy(nexus_t * nexus);
+
+size_t nexus_next_tree(const char * data,
+                       size_t size,
+                       size_t pos,
+                       size_t * command);
+
+int nexus_block_end(const char * data, size_t size, size_t pos);
+
+char * nexus_translate(const nexus_t * nexus, const char * s, size_t len);
+
+char * nexus_quote(const char * label);
+
+int nexus_tip_number(const char * label);
+
+int nexus_header_written(void);
+
+long nexus_tree_number(void);
+
+void nexus_write_header(writer_t * w);
+
+void nexus_write_end(writer_t * w);
+
+/* functions in writer.c */
+
+writer_t * writer_open(FILE * fp);
+
+void writer_write(writer_t * w, const char * data, size_t len);
+
+void writer_close(writer_t * w);
+
+FILE * writer_fopen_gzip(const char * filename);
+
+/* functions in format.c */
+
+size_t format_double(char * buf, size_t size, double x, int precision);
+
+size_t format_float(char * buf, size_t size, float x, int precision);
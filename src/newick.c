@@ -0,0 +1,474 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Newick writer. The tree is traversed once, without recursion, and every
+   node appends its own text to a single growable buffer. When writing to a
+   file, the buffer is flushed whenever it exceeds NEWICK_FLUSH_SIZE bytes,
+   so memory usage does not depend on the size of the tree. The *_stream_
+   newick() functions flush to an asynchronous writer instead, and the
+   *_export_newick() functions use no output at all and return the buffer */
+
+#define NEWICK_FLUSH_SIZE 65536
+
+typedef struct newick_buffer_s
+{
+  char * data;
+  size_t len;
+  size_t alloc;
+  FILE * fp;
+  writer_t * writer;
+  int nexus;
+} newick_buffer_t;
+
+/* Unrooted trees have always been written with six decimals regardless of
+   --precision, which only switches them to the shortest representation */
+#define UTREE_PRECISION \
+  (opt_precision == PRECISION_SHORTEST ? PRECISION_SHORTEST : 6)
+
+static void buffer_init(newick_buffer_t * b, FILE * fp, writer_t * writer)
+{
+  b->fp = fp;
+  b->writer = writer;
+  b->nexus = 0;
+  b->len = 0;
+  b->alloc = 4096;
+  b->data = (char *)xmalloc(b->alloc);
+}
+
+static void buffer_flush(newick_buffer_t * b)
+{
+  if (b->writer)
+    writer_write(b->writer, b->data, b->len);
+  else if (b->len && fwrite(b->data, 1, b->len, b->fp) != b->len)
+    fatal("Unable to write newick output");
+  b->len = 0;
+}
+
+/* makes room for n more bytes */
+static void buffer_reserve(newick_buffer_t * b, size_t n)
+{
+  if (b->len + n <= b->alloc)
+    return;
+
+  if ((b->fp || b->writer) && b->len >= NEWICK_FLUSH_SIZE)
+  {
+    buffer_flush(b);
+    if (n <= b->alloc)
+      return;
+  }
+
+  b->alloc = MAX(2*b->alloc, b->len + n);
+  b->data = (char *)xrealloc(b->data, b->alloc);
+}
+
+static void buffer_append(newick_buffer_t * b, const char * s, size_t n)
+{
+  buffer_reserve(b, n);
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+}
+
+static void buffer_putc(newick_buffer_t * b, char c)
+{
+  buffer_reserve(b, 1);
+  b->data[b->len++] = c;
+}
+
+static void buffer_label(newick_buffer_t * b, const char * label)
+{
+  if (label)
+    buffer_append(b, label, strlen(label));
+}
+
+/* Tip labels of NEXUS output are replaced by their number in the TRANSLATE
+   table. Labels missing from the table are quoted if necessary */
+static void buffer_tip(newick_buffer_t * b, const char * label)
+{
+  char number[16];
+  char * quoted;
+
+  if (!b->nexus || !label)
+  {
+    buffer_label(b, label);
+    return;
+  }
+
+  int n = nexus_tip_number(label);
+  if (n)
+  {
+    buffer_append(b, number, (size_t)snprintf(number, 16, "%d", n));
+    return;
+  }
+
+  quoted = nexus_quote(label);
+  buffer_label(b, quoted ? quoted : label);
+  free(quoted);
+}
+
+/* appends ":length" with the given number of decimal digits */
+static void buffer_length(newick_buffer_t * b, double length, int precision)
+{
+  size_t n;
+  size_t room = 32;
+
+  buffer_putc(b, ':');
+
+  while (1)
+  {
+    buffer_reserve(b, room);
+    n = format_double(b->data + b->len, room, length, precision);
+    if (n < room)
+      break;
+    room = n + 1;
+  }
+
+  b->len += n;
+}
+
+/* same for the single precision lengths of compact trees */
+static void buffer_length_float(newick_buffer_t * b, float length)
+{
+  size_t n;
+  size_t room = 32;
+
+  buffer_putc(b, ':');
+
+  while (1)
+  {
+    buffer_reserve(b, room);
+    n = format_float(b->data + b->len, room, length, opt_precision);
+    if (n < room)
+      break;
+    room = n + 1;
+  }
+
+  b->len += n;
+}
+
+/* terminates the tree, and either writes the rest of the buffer together
+   with a newline, or returns the buffer as a string */
+static char * buffer_finish(newick_buffer_t * b)
+{
+  buffer_putc(b, ';');
+
+  if (b->fp || b->writer)
+  {
+    buffer_putc(b, '\n');
+    buffer_flush(b);
+    free(b->data);
+    return NULL;
+  }
+
+  buffer_putc(b, 0);
+  return b->data;
+}
+
+/* Called when a binary traversal reaches a node: a second child is
+   separated from the first by a comma, and an inner node opens its
+   parenthesis. The frame of the parent tells which child is entered */
+static int buffer_enter(newick_buffer_t * b, const trav_stack_t * s, int tip)
+{
+  if (s->top > 1 && s->frames[s->top - 2].child == 2)
+    buffer_putc(b, ',');
+  if (!tip)
+    buffer_putc(b, '(');
+  return 1;
+}
+
+/* Appends the subtree rooted at root. Each inner node opens a parenthesis
+   before its first child, separates its children by commas and closes the
+   parenthesis after the last one, followed by its label and length */
+static void rtree_newick(newick_buffer_t * b, rtree_t * root)
+{
+  trav_stack_t s = {NULL, 0, 0};
+
+  TRAVERSE_BINARY(&s, rtree_t, root, node,
+                  !node->left || !node->right, node->left, node->right,
+                  buffer_enter(b, &s, !node->left || !node->right),
+                  {
+                    if (node->left && node->right)
+                    {
+                      buffer_putc(b, ')');
+                      buffer_label(b, node->label);
+                    }
+                    else
+                      buffer_tip(b, node->label);
+                    buffer_length(b, node->length, opt_precision);
+                  });
+
+  trav_stack_free(&s);
+}
+
+/* Appends the subtree of the unrooted tree behind node, i.e. the part of the
+   tree reached through node->next and node->next->next */
+static void utree_newick(newick_buffer_t * b, utree_t * root)
+{
+  trav_stack_t s = {NULL, 0, 0};
+
+  TRAVERSE_BINARY(&s, utree_t, root, node,
+                  !node->next, node->next->back, node->next->next->back,
+                  buffer_enter(b, &s, !node->next),
+                  {
+                    if (node->next)
+                    {
+                      buffer_putc(b, ')');
+                      buffer_label(b, node->label);
+                    }
+                    else
+                      buffer_tip(b, node->label);
+                    buffer_length(b, node->length, UTREE_PRECISION);
+                  });
+
+  trav_stack_free(&s);
+}
+
+/* Appends the n-ary subtree rooted at root. Branch lengths are written only
+   for branches that had a length in the input */
+static void ntree_newick(newick_buffer_t * b, ntree_t * root)
+{
+  trav_stack_t s = {NULL, 0, 0};
+
+  TRAV_PUSH(&s, root);
+  while (s.top)
+  {
+    trav_frame_t * f = s.frames + s.top - 1;
+    ntree_t * node = (ntree_t *)f->node;
+
+    if (f->child < node->children_count)
+    {
+      ntree_t * child = node->children[f->child];
+
+      buffer_putc(b, f->child++ ? ',' : '(');
+      TRAV_PUSH(&s, child);
+      continue;
+    }
+
+    if (node->children_count)
+    {
+      buffer_putc(b, ')');
+      buffer_label(b, node->label);
+    }
+    else
+      buffer_tip(b, node->label);
+    if (node->has_length)
+      buffer_length(b, node->length, opt_precision);
+    s.top--;
+  }
+
+  trav_stack_free(&s);
+}
+
+static const char * ftree_label(const ftree_t * tree, int node)
+{
+  return tree->taxon[node] == -1 ? NULL : label_string(tree->taxon[node]);
+}
+
+/* lengths of compact trees are written in single precision */
+static void ftree_length(newick_buffer_t * b, const ftree_t * tree, int node)
+{
+  if (!FTREE_HAS_LENGTH(tree, node))
+    return;
+
+  if (tree->compact)
+    buffer_length_float(b, tree->flength[node]);
+  else
+    buffer_length(b, tree->length[node], opt_precision);
+}
+
+/* Appends a flat tree like ntree_newick(). The links to parents and
+   siblings lead through the tree without a stack: from a node whose text
+   is complete we continue with its next sibling, or else close its parent */
+static void ftree_newick(newick_buffer_t * b, const ftree_t * tree)
+{
+  int node = tree->root;
+
+  while (1)
+  {
+    while (tree->left[node] != -1)
+    {
+      buffer_putc(b, '(');
+      node = tree->left[node];
+    }
+
+    buffer_tip(b, ftree_label(tree, node));
+    ftree_length(b, tree, node);
+
+    while (node != tree->root && tree->sibling[node] == -1)
+    {
+      node = tree->parent[node];
+      buffer_putc(b, ')');
+      buffer_label(b, ftree_label(tree, node));
+      ftree_length(b, tree, node);
+    }
+
+    if (node == tree->root)
+      break;
+
+    buffer_putc(b, ',');
+    node = tree->sibling[node];
+  }
+}
+
+/* the root of an unrooted tree is a node with three subtrees */
+static void utree_root_newick(newick_buffer_t * b, utree_t * root)
+{
+  buffer_putc(b, '(');
+  utree_newick(b, root->back);
+  buffer_putc(b, ',');
+  utree_newick(b, root->next->back);
+  buffer_putc(b, ',');
+  utree_newick(b, root->next->next->back);
+  buffer_putc(b, ')');
+
+  buffer_label(b, root->label);
+  buffer_length(b, root->length, UTREE_PRECISION);
+}
+
+char * rtree_export_newick(rtree_t * root)
+{
+  newick_buffer_t b;
+
+  if (!root) return NULL;
+
+  buffer_init(&b, NULL, NULL);
+  rtree_newick(&b, root);
+
+  return buffer_finish(&b);
+}
+
+char * utree_export_newick(utree_t * root)
+{
+  newick_buffer_t b;
+
+  if (!root) return NULL;
+
+  buffer_init(&b, NULL, NULL);
+  utree_root_newick(&b, root);
+
+  return buffer_finish(&b);
+}
+
+char * ntree_export_newick(ntree_t * root)
+{
+  newick_buffer_t b;
+
+  buffer_init(&b, NULL, NULL);
+  ntree_newick(&b, root);
+
+  return buffer_finish(&b);
+}
+
+/* Writes the tree followed by a newline to fp */
+void rtree_write_newick(FILE * fp, rtree_t * root)
+{
+  newick_buffer_t b;
+
+  buffer_init(&b, fp, NULL);
+  rtree_newick(&b, root);
+  buffer_finish(&b);
+}
+
+void utree_write_newick(FILE * fp, utree_t * root)
+{
+  newick_buffer_t b;
+
+  buffer_init(&b, fp, NULL);
+  utree_root_newick(&b, root);
+  buffer_finish(&b);
+}
+
+void ntree_write_newick(FILE * fp, ntree_t * root)
+{
+  newick_buffer_t b;
+
+  buffer_init(&b, fp, NULL);
+  ntree_newick(&b, root);
+  buffer_finish(&b);
+}
+
+/* Appends the tree to a writer, as a newick string or, with --nexus, as a
+   TREE command. In the latter case the first tree is formatted in memory,
+   which numbers its tips, such that the TRANSLATE table can be written
+   before the tree. Flat trees are passed in ftree instead of root */
+static void stream_tree(writer_t * w,
+                        void * root,
+                        int tree_type,
+                        const ftree_t * ftree)
+{
+  newick_buffer_t b;
+  char * text;
+  char prefix[64];
+
+  buffer_init(&b, NULL, (!opt_nexus || nexus_header_written()) ? w : NULL);
+
+  if (opt_nexus)
+  {
+    b.nexus = 1;
+    buffer_append(&b, prefix,
+                  (size_t)snprintf(prefix, 64, "  TREE tree_%ld = %s",
+                                   nexus_tree_number(),
+                                   tree_type == TREE_ROOTED ? "[&R] " :
+                                   tree_type == TREE_UNROOTED ? "[&U] " : ""));
+  }
+
+  if (ftree)
+    ftree_newick(&b, ftree);
+  else if (tree_type == TREE_ROOTED)
+    rtree_newick(&b, (rtree_t *)root);
+  else if (tree_type == TREE_UNROOTED)
+    utree_root_newick(&b, (utree_t *)root);
+  else
+    ntree_newick(&b, (ntree_t *)root);
+
+  text = buffer_finish(&b);
+  if (text)
+  {
+    nexus_write_header(w);
+    writer_write(w, text, strlen(text));
+    writer_write(w, "\n", 1);
+    free(text);
+  }
+}
+
+/* Same as above, but the text is handed to an asynchronous writer */
+void rtree_stream_newick(writer_t * w, rtree_t * root)
+{
+  stream_tree(w, root, TREE_ROOTED, NULL);
+}
+
+void utree_stream_newick(writer_t * w, utree_t * root)
+{
+  stream_tree(w, root, TREE_UNROOTED, NULL);
+}
+
+void ntree_stream_newick(writer_t * w, ntree_t * root)
+{
+  stream_tree(w, root, TREE_NARY, NULL);
+}
+
+/* Written like n-ary trees, with branch lengths only where the input had
+   them */
+void ftree_stream_newick(writer_t * w, const ftree_t * tree)
+{
+  stream_tree(w, NULL, TREE_NARY, tree);
+}
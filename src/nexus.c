@@ -0,0 +1,470 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* NEXUS support. On input, the lexer skips all commands of the file except
+   the newick strings of TREE commands, and tip labels are looked up in the
+   TRANSLATE table of the TREES block. The keys of the table are interned
+   like any other label, so the lookup is a search in the label pool and an
+   array access by label id.
+
+   On output, trees are written as TREE commands of a TREES block whose
+   TRANSLATE table numbers the tips of the first tree. Tips of later trees
+   that are not in the table are written with their labels */
+
+struct nexus_s
+{
+  char ** translate;            /* taxon labels indexed by label id of key */
+  int translate_size;
+};
+
+typedef struct nexus_token_s
+{
+  const char * str;             /* NULL at the end of the input */
+  size_t len;
+  char quote;                   /* quote character of a quoted token */
+} nexus_token_t;
+
+#define NEXUS_PUNCT(c) ((c) == ';' || (c) == ',' || (c) == '=' || \
+                        (c) == '(' || (c) == ')')
+
+/* numbering of the tips written so far, by label id */
+static int * out_number = NULL;
+static int out_number_alloc = 0;
+static char ** out_label = NULL;
+static int out_count = 0;
+static int out_alloc = 0;
+static int header_written = 0;
+static long trees_written = 0;
+
+/* skips white space and comments */
+static size_t skip_blank(const char * data, size_t size, size_t pos)
+{
+  while (pos < size)
+  {
+    if (isspace((unsigned char)data[pos]))
+      ++pos;
+    else if (data[pos] == '[')
+    {
+      const char * end = (const char *)memchr(data+pos, ']', size-pos);
+      pos = end ? (size_t)(end - data) + 1 : size;
+    }
+    else
+      break;
+  }
+
+  return pos;
+}
+
+/* Reads the token at pos and returns the position after it. Tokens are
+   punctuation characters, quoted words, whose text still contains doubled
+   quotes, or runs of other characters */
+static size_t read_token(const char * data,
+                         size_t size,
+                         size_t pos,
+                         nexus_token_t * tok)
+{
+  size_t start;
+
+  pos = skip_blank(data, size, pos);
+
+  tok->str = NULL;
+  tok->len = 0;
+  tok->quote = 0;
+
+  if (pos == size)
+    return size;
+
+  if (data[pos] == '\'' || data[pos] == '"')
+  {
+    tok->quote = data[pos++];
+    start = pos;
+    while (pos < size)
+    {
+      if (data[pos] == tok->quote)
+      {
+        if (pos+1 < size && data[pos+1] == tok->quote)
+        {
+          pos += 2;
+          continue;
+        }
+        break;
+      }
+      ++pos;
+    }
+
+    tok->str = data + start;
+    tok->len = pos - start;
+
+    return pos < size ? pos+1 : size;
+  }
+
+  start = pos;
+  if (NEXUS_PUNCT(data[pos]))
+    ++pos;
+  else
+    while (pos < size && !isspace((unsigned char)data[pos]) &&
+           !NEXUS_PUNCT(data[pos]) && data[pos] != '[' &&
+           data[pos] != '\'' && data[pos] != '"')
+      ++pos;
+
+  tok->str = data + start;
+  tok->len = pos - start;
+
+  return pos;
+}
+
+static int token_is(const nexus_token_t * tok, const char * word)
+{
+  return tok->str && !tok->quote && tok->len == strlen(word) &&
+         !strncasecmp(tok->str, word, tok->len);
+}
+
+/* returns the position after the semicolon ending the current command */
+static size_t skip_command(const char * data,
+                           size_t size,
+                           size_t pos,
+                           nexus_token_t * tok)
+{
+  while (tok->str && !token_is(tok, ";"))
+    pos = read_token(data, size, pos, tok);
+
+  return pos;
+}
+
+/* interns the text of a token, replacing doubled quotes by single ones */
+static char * token_intern(const nexus_token_t * tok)
+{
+  char * copy;
+  char * label;
+  size_t i;
+  size_t len = 0;
+
+  if (!tok->quote || !memchr(tok->str, tok->quote, tok->len))
+    return label_intern(tok->str, tok->len);
+
+  copy = (char *)xmalloc(tok->len);
+  for (i = 0; i < tok->len; ++i)
+  {
+    copy[len++] = tok->str[i];
+    if (tok->str[i] == tok->quote)
+      ++i;
+  }
+
+  label = label_intern(copy, len);
+  free(copy);
+
+  return label;
+}
+
+/* reads the pairs of a TRANSLATE command up to its semicolon */
+static size_t read_translate(nexus_t * nexus,
+                             const char * data,
+                             size_t size,
+                             size_t pos)
+{
+  nexus_token_t key;
+  nexus_token_t value;
+  nexus_token_t sep;
+  int id;
+
+  while (1)
+  {
+    pos = read_token(data, size, pos, &key);
+    if (token_is(&key, ";"))
+      return pos;
+
+    pos = read_token(data, size, pos, &value);
+    pos = read_token(data, size, pos, &sep);
+
+    if (!key.str || !value.str || (!key.quote && NEXUS_PUNCT(*key.str)) ||
+        (!value.quote && NEXUS_PUNCT(*value.str)) ||
+        !(token_is(&sep, ",") || token_is(&sep, ";")))
+    {
+      snprintf(errmsg, 200, "Invalid TRANSLATE command in NEXUS file");
+      return 0;
+    }
+
+    id = label_id(token_intern(&key));
+    if (id >= nexus->translate_size)
+    {
+      int size_new = MAX(2*nexus->translate_size, id+1);
+      nexus->translate = (char **)xrealloc(nexus->translate,
+                                           size_new * sizeof(char *));
+      memset(nexus->translate + nexus->translate_size, 0,
+             (size_new - nexus->translate_size) * sizeof(char *));
+      nexus->translate_size = size_new;
+    }
+    nexus->translate[id] = token_intern(&value);
+
+    if (token_is(&sep, ";"))
+      return pos;
+  }
+}
+
+/* checks whether the data starts with the #NEXUS header */
+int nexus_probe(const char * data, size_t size)
+{
+  size_t pos = 0;
+
+  while (pos < size && isspace((unsigned char)data[pos]))
+    ++pos;
+
+  return size - pos >= 6 && !strncasecmp(data+pos, "#NEXUS", 6);
+}
+
+/* Reads the TRANSLATE table, which precedes the first TREE command. Returns
+   NULL and sets errmsg if the table is malformed */
+nexus_t * nexus_create(const char * data, size_t size)
+{
+  nexus_t * nexus = (nexus_t *)xcalloc(1, sizeof(nexus_t));
+  nexus_token_t tok;
+  size_t pos = 0;
+
+  while (1)
+  {
+    pos = read_token(data, size, pos, &tok);
+    if (!tok.str || token_is(&tok, "TREE") || token_is(&tok, "UTREE"))
+      break;
+
+    if (!tok.quote && tok.str[0] == '#')
+      continue;
+
+    if (token_is(&tok, "TRANSLATE"))
+    {
+      pos = read_translate(nexus, data, size, pos);
+      if (!pos)
+      {
+        nexus_destroy(nexus);
+        return NULL;
+      }
+      continue;
+    }
+
+    pos = skip_command(data, size, pos, &tok);
+  }
+
+  return nexus;
+}
+
+void nexus_destroy(nexus_t * nexus)
+{
+  free(nexus->translate);
+  free(nexus);
+}
+
+/* Returns the position following the '=' of the next TREE command at or
+   after pos, skipping all other commands, or size if there is none. If
+   command is not NULL, the position of the TREE keyword is stored in it */
+size_t nexus_next_tree(const char * data,
+                       size_t size,
+                       size_t pos,
+                       size_t * command)
+{
+  nexus_token_t tok;
+
+  while (1)
+  {
+    pos = read_token(data, size, pos, &tok);
+    if (!tok.str)
+      return size;
+
+    if (!tok.quote && tok.str[0] == '#')
+      continue;
+
+    if (token_is(&tok, "TREE") || token_is(&tok, "UTREE"))
+    {
+      if (command)
+        *command = (size_t)(tok.str - data);
+
+      while (tok.str && !token_is(&tok, "=") && !token_is(&tok, ";"))
+        pos = read_token(data, size, pos, &tok);
+
+      if (token_is(&tok, "="))
+        return pos;
+    }
+
+    pos = skip_command(data, size, pos, &tok);
+  }
+}
+
+/* Returns 1 if the next command at or after pos is a complete END or
+   ENDBLOCK command, i.e. the end of the TREES block */
+int nexus_block_end(const char * data, size_t size, size_t pos)
+{
+  nexus_token_t tok;
+
+  do
+    pos = read_token(data, size, pos, &tok);
+  while (tok.str && !tok.quote && tok.str[0] == '#');
+
+  if (!token_is(&tok, "END") && !token_is(&tok, "ENDBLOCK"))
+    return 0;
+
+  read_token(data, size, pos, &tok);
+
+  return token_is(&tok, ";");
+}
+
+/* Returns the taxon label that the tip label s[0..len-1] translates to, or
+   NULL if it is not a key of the TRANSLATE table */
+char * nexus_translate(const nexus_t * nexus, const char * s, size_t len)
+{
+  int id;
+
+  if (!nexus->translate_size)
+    return NULL;
+
+  id = label_find(s, len);
+  if (id < 0 || id >= nexus->translate_size)
+    return NULL;
+
+  return nexus->translate[id];
+}
+
+/* Returns a quoted copy of the label if it contains characters that are not
+   allowed in unquoted NEXUS words, or NULL if it can be written as is */
+char * nexus_quote(const char * label)
+{
+  const char * p;
+  char * quoted;
+  size_t len = 0;
+
+  for (p = label; *p; ++p)
+    if (isspace((unsigned char)*p) || strchr("()[]{}/\\,;:=*'\"`+-<>", *p))
+      break;
+
+  if (!*p && p != label)
+    return NULL;
+
+  quoted = (char *)xmalloc(2*strlen(label) + 3);
+  quoted[len++] = '\'';
+  for (p = label; *p; ++p)
+  {
+    quoted[len++] = *p;
+    if (*p == '\'')
+      quoted[len++] = '\'';
+  }
+  quoted[len++] = '\'';
+  quoted[len] = 0;
+
+  return quoted;
+}
+
+/* Returns the translation number of a tip label. Labels get the next number
+   the first time they are seen, until the TRANSLATE table has been written.
+   Afterwards, unknown labels have number 0 */
+int nexus_tip_number(const char * label)
+{
+  int id = label_id(label_intern(label, strlen(label)));
+
+  if (id < out_number_alloc && out_number[id])
+    return out_number[id];
+
+  if (header_written)
+  {
+    /* a label equal to one of the numbers would be read back translated */
+    char * end;
+    long value = strtol(label, &end, 10);
+
+    if (!*end && isdigit((unsigned char)*label) && *label != '0' &&
+        value <= out_count)
+      fatal("Tip %s of tree %ld is not in the TRANSLATE table of the first "
+            "tree and cannot be told apart from a taxon number",
+            label, trees_written);
+
+    return 0;
+  }
+
+  if (id >= out_number_alloc)
+  {
+    int alloc = MAX(2*out_number_alloc, id+1);
+    out_number = (int *)xrealloc(out_number, alloc * sizeof(int));
+    memset(out_number + out_number_alloc, 0,
+           (alloc - out_number_alloc) * sizeof(int));
+    out_number_alloc = alloc;
+  }
+
+  if (out_count == out_alloc)
+  {
+    out_alloc = out_alloc ? 2*out_alloc : 64;
+    out_label = (char **)xrealloc(out_label, out_alloc * sizeof(char *));
+  }
+
+  out_label[out_count++] = (char *)label_string(id);
+  out_number[id] = out_count;
+
+  return out_count;
+}
+
+int nexus_header_written(void)
+{
+  return header_written;
+}
+
+/* returns the number of the next tree written */
+long nexus_tree_number(void)
+{
+  return ++trees_written;
+}
+
+/* Starts the TREES block with a TRANSLATE table of the tips numbered so
+   far, after which numbering stops */
+void nexus_write_header(writer_t * w)
+{
+  char number[32];
+  int i;
+
+  writer_write(w, "#NEXUS\n\nBEGIN TREES;\n", 21);
+
+  if (out_count)
+    writer_write(w, "  TRANSLATE\n", 12);
+
+  for (i = 0; i < out_count; ++i)
+  {
+    char * quoted = nexus_quote(out_label[i]);
+    const char * label = quoted ? quoted : out_label[i];
+
+    writer_write(w, number, (size_t)snprintf(number, 32, "    %d ", i+1));
+    writer_write(w, label, strlen(label));
+    writer_write(w, i+1 < out_count ? ",\n" : ";\n", 2);
+
+    free(quoted);
+  }
+
+  header_written = 1;
+}
+
+/* ends the TREES block, if one was started, and resets the numbering */
+void nexus_write_end(writer_t * w)
+{
+  if (header_written)
+    writer_write(w, "END;\n", 5);
+
+  free(out_number);
+  free(out_label);
+  out_number = NULL;
+  out_label = NULL;
+  out_number_alloc = out_count = out_alloc = 0;
+  header_written = 0;
+  trees_written = 0;
+}
@@ -21,107 +21,109 @@
 
 #include "newick-tools.h"
 
-int ntree_tipcount(ntree_t * node)
+/* Lists the nodes of the tree in postorder without recursion. The nodes are
+   first listed with an explicit stack such that each node precedes its
+   subtrees, taken from the last child to the first, and the list is then
+   reversed */
+static ntree_t ** ntree_postorder(ntree_t * root, int * count)
 {
   int i;
-  int count = 0;
+  int alloc = 64;
+  int n = 0;
+  trav_stack_t stack = {NULL, 0, 0};
+  ntree_t * node;
 
-  if (!node) return 0;
-  if (!node->children_count == 0) return 1;
+  ntree_t ** list = (ntree_t **)xmalloc(alloc * sizeof(ntree_t *));
+
+  TRAV_PUSH(&stack, root);
+  while (stack.top)
+  {
+    node = (ntree_t *)stack.frames[--stack.top].node;
 
-  for (i=0; i<node->children_count; ++i)
-    count += ntree_tipcount(node->children[i]);
+    if (n == alloc)
+    {
+      alloc *= 2;
+      list = (ntree_t **)xrealloc(list, alloc * sizeof(ntree_t *));
+    }
 
-  return count;
+    list[n++] = node;
+    for (i = 0; i < node->children_count; ++i)
+      TRAV_PUSH(&stack, node->children[i]);
+  }
+
+  for (i = 0; i < n/2; ++i)
+    SWAP(list[i], list[n-i-1]);
+
+  trav_stack_free(&stack);
+
+  *count = n;
+  return list;
 }
 
-static void ntree_query_tipnodes_recursive(ntree_t * node,
-                                           ntree_t ** node_list,
-                                           int * index) 
+int ntree_tipcount(ntree_t * node)
 {
   int i;
-  if (!node) return;
+  int count = 0;
+  trav_stack_t stack = {NULL, 0, 0};
+
+  if (!node) return 0;
 
-  if (!node->children_count)
+  TRAV_PUSH(&stack, node);
+  while (stack.top)
   {
-    node_list[*index] = node;
-    *index = *index + 1;
-    return;
+    node = (ntree_t *)stack.frames[--stack.top].node;
+
+    if (!node->children_count)
+      ++count;
+    for (i = 0; i < node->children_count; ++i)
+      TRAV_PUSH(&stack, node->children[i]);
   }
 
-  for (i=0; i<node->children_count; ++i)
-    ntree_query_tipnodes_recursive(node->children[i], node_list, index);
+  trav_stack_free(&stack);
+  return count;
 }
 
-
+/* Lists the tips below node from left to right. The children of a node
+   are pushed from the last to the first, so the first one is popped first */
 ntree_t ** ntree_query_tipnodes(ntree_t * node, int * count)
 {
   int i;
   ntree_t ** node_list;
+  trav_stack_t stack = {NULL, 0, 0};
 
   if (!node) return 0;
 
   *count = 0;
 
-  /* the passed node is a tip */
-  if (!node->children_count)
-  {
-    node_list = (ntree_t **)xmalloc(sizeof(ntree_t *));
-    node_list[*count] = node;
-    *count = 1;
-  }
-
   /* count number of tips and allocate memory */
   int tipcount = ntree_tipcount(node);
   node_list = (ntree_t **)xmalloc(tipcount*sizeof(ntree_t *));
 
   /* traverse all subtrees fill the array */
-  for (i=0; i<node->children_count; ++i)
-    ntree_query_tipnodes_recursive(node->children[i], node_list, count);
-
-  return node_list;
-}
-
-static void ntree_node_count_recursive(ntree_t * root,
-                                       int * inner_count,
-                                       int * tip_count,
-                                       int * min_inner_degree,
-                                       int * max_inner_degree)
-{
-  int i;
-
-  if (!root->children_count)
+  TRAV_PUSH(&stack, node);
+  while (stack.top)
   {
-    *tip_count = *tip_count + 1;
-    return;
-  }
-
-  *inner_count = *inner_count + 1;
-  
-  if (root->children_count + 1 > *max_inner_degree)
-    *max_inner_degree = root->children_count+1;
+    node = (ntree_t *)stack.frames[--stack.top].node;
 
-  if (root->children_count + 1 < *min_inner_degree)
-    *min_inner_degree = root->children_count + 1;
-
-  for (i = 0; i < root->children_count; ++i)
-  {
-    ntree_node_count_recursive(root->children[i],
-                               inner_count,
-                               tip_count,
-                               min_inner_degree,
-                               max_inner_degree);
+    if (!node->children_count)
+      node_list[(*count)++] = node;
+    for (i = node->children_count - 1; i >= 0; --i)
+      TRAV_PUSH(&stack, node->children[i]);
   }
+
+  trav_stack_free(&stack);
+  return node_list;
 }
 
+/* The degree of an inner node counts its parent, apart from the root */
 void ntree_node_count(ntree_t * root,
                       int * inner_count,
                       int * tip_count,
                       int * min_inner_degree,
                       int * max_inner_degree)
 {
-  
   int i;
+  trav_stack_t stack = {NULL, 0, 0};
 
   *inner_count = 0;
   *tip_count = 0;
@@ -133,215 +135,336 @@ void ntree_node_count(ntree_t * root,
     *tip_count = 1;
     return;
   }
-  else
-    *inner_count = 1;
 
   *min_inner_degree = root->children_count;
   *max_inner_degree = root->children_count;
 
-  for (i = 0; i < root->children_count; ++i)
+  TRAV_PUSH(&stack, root);
+  while (stack.top)
   {
-    ntree_node_count_recursive(root->children[i],
-                               inner_count,
-                               tip_count,
-                               min_inner_degree,
-                               max_inner_degree);
+    ntree_t * node = (ntree_t *)stack.frames[--stack.top].node;
+    int degree = node->children_count + (node != root);
+
+    if (!node->children_count)
+    {
+      *tip_count = *tip_count + 1;
+      continue;
+    }
+
+    *inner_count = *inner_count + 1;
+
+    if (degree > *max_inner_degree)
+      *max_inner_degree = degree;
+
+    if (degree < *min_inner_degree)
+      *min_inner_degree = degree;
+
+    for (i = 0; i < node->children_count; ++i)
+      TRAV_PUSH(&stack, node->children[i]);
   }
+
+  trav_stack_free(&stack);
 }
 
-static rtree_t * resolve_random(ntree_t * node)
+/* Follows the chain of nodes with a single child that starts at node, and
+   returns the node ending it together with the sum of their lengths */
+static ntree_t * chain_end(ntree_t * node, double * length)
 {
-  int i;
-  rtree_t * rtree;
-  double length = 0;
-
+  *length = 0;
   while (node->children_count == 1)
   {
-    length += node->length;
+    *length += node->length;
     node = node->children[0];
   }
-  length += node->length;
+  *length += node->length;
+
+  return node;
+}
+
+static rtree_t * rtree_node_create(arena_t * arena, char * label)
+{
+  rtree_t * rtree = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
 
-  /* allocate node */
-  rtree = (rtree_t *)xmalloc(sizeof(rtree_t));
+  rtree->label  = label;
+  rtree->length = 0;
+  rtree->left   = NULL;
+  rtree->right  = NULL;
+  rtree->parent = NULL;
+  rtree->leaves = 1;
   rtree->mark   = 0;
   rtree->color  = NULL;
   rtree->data   = NULL;
-  rtree->label  = (node->label) ? xstrdup(node->label) : NULL;
-  rtree->length = length;
 
+  return rtree;
+}
+
+static void rtree_node_join(rtree_t * rtree, rtree_t * left, rtree_t * right)
+{
+  rtree->left   = left;
+  rtree->right  = right;
+  rtree->leaves = left->leaves + right->leaves;
+
+  left->parent  = rtree;
+  right->parent = rtree;
+}
+
+/* joins the converted children of a node pairwise at random, until two of
+   them are left for rtree */
+static void resolve_random(arena_t * arena,
+                           rtree_t * rtree,
+                           rtree_t ** children,
+                           int count)
+{
+  int i = count;
 
-  if (node->children_count == 0)
+  while (i != 2)
   {
-    rtree->left   = NULL;
-    rtree->right  = NULL;
-    rtree->leaves = 1;
+    /* select two children such that r1 < r2 */
+    int r1 = (rand() % i);
+    int r2 = (rand() % i);
+    if (r1 == r2)
+      r2 = (r1 == i-1) ? r2-1 : r2+1;
+    if (r1 > r2) SWAP(r1,r2);
+
+    /* create a new node */
+    rtree_t * new = rtree_node_create(arena, NULL);
+    rtree_node_join(new, children[r1], children[r2]);
+
+    /* update list of children with new inner node and remove old
+       invalid children */
+    children[r1] = new;
+    if (r2 != i-1)
+      children[r2] = children[i-1];
+
+    --i;
   }
-  else if (node->children_count == 2)
-  {
-    rtree->left   = resolve_random(node->children[0]);
-    rtree->right  = resolve_random(node->children[1]);
-    rtree->leaves = rtree->left->leaves + rtree->right->leaves;
 
-    rtree->left->parent  = rtree;
-    rtree->right->parent = rtree;
+  /* now we have two children */
+  rtree_node_join(rtree, children[0], children[1]);
+}
+
+/* keeps the first child of a node on the left and nests the others to the
+   right of it, i.e. (c1,(c2,(c3,...))) */
+static void resolve_ladder(arena_t * arena,
+                           rtree_t * rtree,
+                           rtree_t ** children,
+                           int count)
+{
+  int i;
+  rtree_t * right = children[count-1];
+
+  for (i = count-2; i > 0; --i)
+  {
+    rtree_t * new = rtree_node_create(arena, NULL);
+    rtree_node_join(new, children[i], right);
+    right = new;
   }
-  else
+
+  rtree_node_join(rtree, children[0], right);
+}
+
+/* Converts the tree below root to a binary one without recursion. Chains of
+   nodes with a single child are merged into the node ending them, and nodes
+   with more children are resolved by --resolve_ladder or at random. Nodes
+   are converted in postorder, keeping the converted subtrees on a stack, so
+   that the random choices are made in the same order as by a recursive
+   conversion. The length of the returned root is set by the caller */
+static rtree_t * ntree_resolve(arena_t * arena, ntree_t * root)
+{
+  int i, j;
+  int count;
+  int top = 0;
+
+  ntree_t ** postorder = ntree_postorder(root, &count);
+  rtree_t ** stack = (rtree_t **)xmalloc(count * sizeof(rtree_t *));
+
+  for (i = 0; i < count; ++i)
   {
-    /* allocate array to hold resolved subtrees of the children of node */
-    rtree_t ** children = (rtree_t **)xmalloc(node->children_count *
-                                              sizeof(rtree_t *));
+    ntree_t * node = postorder[i];
+    int degree = node->children_count;
+    rtree_t ** children = stack + top - degree;
 
-    /* resolve all children */
-    for (i=0; i < node->children_count; ++i)
-      children[i] = resolve_random(node->children[i]);
+    /* the converted child stays on the stack for the end of the chain */
+    if (degree == 1) continue;
 
-    /* randomly resolve current node */
-    i = node->children_count;
-    while (i != 2)
+    rtree_t * rtree = rtree_node_create(arena, node->label);
+
+    if (degree)
     {
-      /* select two children such that r1 < r2 */
-      int r1 = (rand() % i);
-      int r2 = (rand() % i);
-      if (r1 == r2)
-        r2 = (r1 == i-1) ? r2-1 : r2+1;
-      if (r1 > r2) SWAP(r1,r2);
-
-      /* create a new node */
-      rtree_t * new = (rtree_t *)xmalloc(sizeof(rtree_t));
-      new->left   = children[r1];
-      new->right  = children[r2];
-      new->leaves = new->left->leaves + new->right->leaves;
-      new->length = 0;
-      new->label  = NULL;
-      new->mark   = 0;
-      new->color  = NULL;
-      new->data   = NULL;
-
-      new->left->parent = new;
-      new->right->parent = new;
-
-      /* update list of children with new inner node and remove old
-         invalid children */
-      children[r1] = new;
-      if (r2 != i-1)
-        children[r2] = children[i-1];
-
-      --i;
+      for (j = 0; j < degree; ++j)
+        chain_end(node->children[j], &children[j]->length);
+
+      if (opt_resolve_ladder)
+        resolve_ladder(arena, rtree, children, degree);
+      else
+        resolve_random(arena, rtree, children, degree);
     }
 
-    /* now we have two children */
-    rtree->left   = children[0];
-    rtree->right  = children[1];
-    rtree->leaves = rtree->left->leaves + rtree->right->leaves;
+    top -= degree;
+    stack[top++] = rtree;
+  }
+
+  rtree_t * rroot = stack[0];
 
-    rtree->left->parent  = rtree;
-    rtree->right->parent = rtree;
+  free(stack);
+  free(postorder);
 
-    free(children);
+  return rroot;
+}
+
+rtree_t * ntree_to_rtree(ntree_t * root)
+{
+  rtree_t * rtree;
+  arena_t * arena = arena_create();
+
+  /* a ladder starts at the first node with several children */
+  if (opt_resolve_ladder)
+  {
+    while (root->children_count == 1)
+      root = root->children[0];
+
+    if (!root->children_count)
+      fatal("Loaded n-tree is a caterpillar tree");
   }
 
-  return rtree;
+  rtree = ntree_resolve(arena, root);
+  chain_end(root, &rtree->length);
+  rtree->parent = NULL;
 
+  return rtree;
 }
 
-static rtree_t * ntree_to_rtree_recursive(ntree_t ** nodes, int count)
+/* Builds the rooted binary tree from an n-ary tree whose inner nodes all
+   have exactly two children. Branches without a length are set to 1 as in
+   parse_rtree.y. The n-ary tree is deallocated. Nodes are converted in
+   postorder, keeping the converted subtrees on a stack, such that deep trees
+   do not overflow the call stack */
+rtree_t * ntree_binary_to_rtree(ntree_t * root)
 {
-  rtree_t * rtree;
+  int i;
+  int count;
+  int top = 0;
 
-  ntree_t * node = nodes[0];
+  assert(root->children_count == 2);
 
-  if (count == 1)
+  ntree_t ** postorder = ntree_postorder(root, &count);
+  rtree_t ** stack = (rtree_t **)xmalloc(count * sizeof(rtree_t *));
+  arena_t * arena = arena_create();
+
+  for (i = 0; i < count; ++i)
   {
-    double length = 0;
-    while (node->children_count == 1)
-    {
-      length += node->length;
-      node = node->children[0];
-    }
-    
-    rtree = (rtree_t *)xmalloc(sizeof(rtree_t));
-    
-    rtree->label = (node->label) ? xstrdup(node->label) : NULL;
-    rtree->length = node->length + length;
-    rtree->color = NULL;
-    rtree->mark = 0;
-    rtree->data = NULL;
-
-    /* caterpillar subtree */
-    if (node->children == NULL)
-    {
-      rtree->left = NULL;
-      rtree->right = NULL;
+    ntree_t * node = postorder[i];
+    rtree_t * rtree = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
+
+    rtree->label  = node->label;
+    rtree->length = node->has_length ? node->length : 1;
+
+    if (!node->children_count)
       rtree->leaves = 1;
-    }
     else
     {
-      /*  n-ary subtree (n > 1) */
-      rtree->left = ntree_to_rtree_recursive(node->children, 1);
-      rtree->right = ntree_to_rtree_recursive(node->children+1, node->children_count - 1);
-
+      rtree->right  = stack[--top];
+      rtree->left   = stack[--top];
       rtree->leaves = rtree->left->leaves + rtree->right->leaves;
-      rtree->left->parent = rtree;
+
+      rtree->left->parent  = rtree;
       rtree->right->parent = rtree;
     }
-  }
-  else
-  {
-    rtree = (rtree_t *)xmalloc(sizeof(rtree_t));
-    rtree->length = 0;
-    rtree->label = NULL;
-    rtree->mark = 0;
-    rtree->color = NULL;
-    rtree->data = NULL;
-
-    rtree->left = ntree_to_rtree_recursive(nodes,1);
-    rtree->right = ntree_to_rtree_recursive(nodes+1,count-1);
-    rtree->leaves = rtree->left->leaves + rtree->right->leaves;
-    rtree->left->parent = rtree;
-    rtree->right->parent = rtree;
+
+    stack[top++] = rtree;
   }
 
-  return rtree;
+  rtree_t * rroot = stack[0];
+  rroot->parent = NULL;
+
+  free(stack);
+  free(postorder);
+  ntree_destroy(root);
+
+  return rroot;
 }
 
-rtree_t * ntree_to_rtree(ntree_t * root)
+/* Builds the unrooted binary tree from an n-ary tree whose root has three
+   children and all other inner nodes exactly two. Branches without a length
+   are set to 0.1. The n-ary tree is deallocated. As for
+   rooted trees, the conversion is done in postorder with an explicit stack */
+utree_t * ntree_binary_to_utree(ntree_t * root)
 {
-  rtree_t * rtree;
+  int i;
+  int count;
+  int top = 0;
+  utree_t * subtree[3];
+
+  assert(root->children_count == 3);
 
-  /* we want to resolve randomly */
-  if (!opt_resolve_ladder)
+  ntree_t ** postorder = ntree_postorder(root, &count);
+  utree_t ** stack = (utree_t **)xmalloc(count * sizeof(utree_t *));
+  arena_t * arena = arena_create();
+
+  /* the root is the last node in postorder */
+  for (i = 0; i < count-1; ++i)
   {
-    rtree = resolve_random(root);
-    rtree->parent = NULL;
-    return rtree;
+    ntree_t * node = postorder[i];
+    utree_t * unode = node->children_count ?
+                      utree_inner_create(arena) :
+                      (utree_t *)arena_alloc(arena, sizeof(utree_t));
+
+    unode->label  = node->label;
+    unode->length = node->has_length ? node->length : 0.1;
+
+    if (node->children_count)
+    {
+      utree_t * right = stack[--top];
+      utree_t * left  = stack[--top];
+
+      unode->next->back       = left;
+      unode->next->next->back = right;
+      left->back              = unode->next;
+      right->back             = unode->next->next;
+
+      unode->next->label        = unode->label;
+      unode->next->next->label  = unode->label;
+      unode->next->length       = left->length;
+      unode->next->next->length = right->length;
+
+      unode->height             = MAX(left->height, right->height) + 1;
+      unode->next->height       = unode->height;
+      unode->next->next->height = unode->height;
+    }
+
+    stack[top++] = unode;
   }
 
-  /* otherwise we want to resolve the multifurcations in a ladder way */
+  for (i = 0; i < 3; ++i)
+    subtree[i] = stack[i];
 
-  while (root->children_count == 1)
-    root = root->children[0];
+  free(stack);
+  free(postorder);
 
-  if (!root->children_count)
-    fatal("Loaded n-tree is a caterpillar tree");
+  utree_t * uroot = utree_inner_create(arena);
 
-  rtree = (rtree_t *)xmalloc(sizeof(rtree_t));
+  uroot->back             = subtree[0];
+  uroot->next->back       = subtree[1];
+  uroot->next->next->back = subtree[2];
 
-  /* create left subtrees (postorder traversal) */
-  rtree->left = ntree_to_rtree_recursive(root->children, 1);
+  subtree[0]->back        = uroot;
+  subtree[1]->back        = uroot->next;
+  subtree[2]->back        = uroot->next->next;
 
-  /* create right subtrees (postorder traversal) */
-  rtree->right = ntree_to_rtree_recursive(root->children+1, root->children_count - 1);
+  uroot->label              = root->label;
+  uroot->next->label        = root->label;
+  uroot->next->next->label  = root->label;
 
-  rtree->parent = NULL;
+  uroot->length             = subtree[0]->length;
+  uroot->next->length       = subtree[1]->length;
+  uroot->next->next->length = subtree[2]->length;
 
-  rtree->label = (root->label) ? xstrdup(root->label) : NULL;
-  rtree->leaves = rtree->left->leaves  + rtree->right->leaves;
-  rtree->length = root->length;
+  uroot->height = MAX(MAX(subtree[0]->height, subtree[1]->height),
+                      subtree[2]->height) + 1;
+  uroot->next->height       = uroot->height;
+  uroot->next->next->height = uroot->height;
 
-  rtree->color = NULL;
-  rtree->mark = 0;
-  rtree->data = NULL;
+  ntree_destroy(root);
 
-  return rtree;
+  return uroot;
 }
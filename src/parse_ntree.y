@@ -22,38 +22,49 @@
 %{
 #include "newick-tools.h"
 
-extern int ntree_lex();
-extern FILE * ntree_in;
-extern void ntree_lex_destroy();
+/* the parser stack is allocated on the heap and grows with the depth of the
+   tree, so the only limit on the depth is the available memory */
+#define YYMAXDEPTH INT_MAX
+
+/* State of one parser instance. The parser is pure, and all state lives in
+   this structure, such that several threads can parse different parts of a
+   file at the same time, each with its own instance. The degree statistics
+   of the tree being parsed are used for detecting whether the tree is binary
+   rooted, binary unrooted or n-ary without parsing it again */
+struct ntree_parser_s
+{
+  lexer_t lexer;
+  arena_t * arena;              /* nodes of the tree being parsed */
+  ntree_t * tree;
+  int eof_reached;
+  int tip_cnt;
+  int nonbinary_cnt;
+  int tree_type;
+  char errmsg[200];
+  size_t error_pos;             /* start of the token the error occurred at */
+  size_t tree_pos;              /* lexer position before the current tree */
+  int tree_seek;                /* whether the lexer was moved to the tree */
+};
 
 struct forest_s
 {
   ntree_t ** children;
   int count;
+  int alloc;
 };
 
+/* Deallocates the tree, together with the child arrays of its nodes, by
+   freeing the arena they were allocated from */
 void ntree_destroy(ntree_t * root)
 {
-  int i;
-
-  if (!root) return;
-
-  if (root->children)
-  {
-    for (i = 0; i < root->children_count; ++i)
-    {
-      ntree_destroy(root->children[i]);
-    }
-    free(root->children);
-  }
-  
-  free(root->label);
-  free(root);
+  if (root)
+    arena_destroy(arena_of(root));
 }
 
-
-static void ntree_error(ntree_t * tree, const char * s) 
+static void ntree_error(ntree_parser_t * parser, const char * s)
 {
+  snprintf(parser->errmsg, 200, "%s", s);
+  parser->error_pos = parser->lexer.token;
 }
 
 %}
@@ -61,24 +72,29 @@ static void ntree_error(ntree_t * tree, const char * s)
 
 %union
 {
-  char * s;
-  char * d;
+  lexeme_t lexeme;
   struct ntree_s * tree;
   struct forest_s * forest;
 }
 
+%code
+{
+int ntree_lex(YYSTYPE * lval, ntree_parser_t * parser);
+}
+
+%define api.pure full
 %error-verbose
-%parse-param {struct ntree_s * tree}
-%destructor { ntree_destroy($$); } subtree
+%parse-param {ntree_parser_t * parser}
+%lex-param {ntree_parser_t * parser}
 
 %token OPAR
 %token CPAR
 %token COMMA
 %token COLON SEMICOLON 
-%token<s> STRING
-%token<d> NUMBER
-%type<s> label optional_label
-%type<d> number optional_length
+%token<lexeme> STRING
+%token<lexeme> NUMBER
+%token ERROR "invalid character"
+%type<lexeme> label optional_label number optional_length
 %type<tree> subtree
 %type<forest> forest
 %start input
@@ -86,92 +102,261 @@ static void ntree_error(ntree_t * tree, const char * s)
 
 input: subtree SEMICOLON
 {
-  memcpy(tree,$1,sizeof(ntree_t));
-  tree->parent = NULL;
-  free($1);
+  int root_degree = $1->children_count;
+
+  parser->tree = $1;
+
+  /* the tree is binary if all inner nodes except the root have two
+     children, and the degree of the root decides whether it is rooted */
+  if (root_degree && root_degree != 2)
+    --parser->nonbinary_cnt;
+
+  parser->tree_type = TREE_NARY;
+  if (!parser->nonbinary_cnt && root_degree == 2)
+    parser->tree_type = TREE_ROOTED;
+  else if (!parser->nonbinary_cnt && root_degree == 3)
+    parser->tree_type = TREE_UNROOTED;
+
+  /* stop at the semicolon without reading ahead, such that the next call
+     to the parser starts at the beginning of the next tree */
+  YYACCEPT;
+}
+     |
+{
+  parser->eof_reached = 1;
 };
 
 forest: forest COMMA subtree
 {
-  /* allocate space for one more subtree */
-  ntree_t ** children = (ntree_t **)calloc($1->count + 1, sizeof(ntree_t *));
-  memcpy(children, $1->children, $1->count * sizeof(ntree_t *));
-  children[$1->count] = $3;
-  free($1->children);
-  $1->children = children;
-  $1->count++;
+  /* grow the list of subtrees geometrically */
+  if ($1->count == $1->alloc)
+  {
+    $1->children = (ntree_t **)arena_realloc(parser->arena,
+                                             $1->children,
+                                             $1->alloc * sizeof(ntree_t *),
+                                             2 * $1->alloc * sizeof(ntree_t *));
+    $1->alloc *= 2;
+  }
+  $1->children[$1->count++] = $3;
 
   $$ = $1;
 }
       | subtree
 {
-  $$ = (struct forest_s *)calloc(1, sizeof(struct forest_s));
-  $$->children = (ntree_t **)calloc(1,sizeof(ntree_t *));
+  $$ = (struct forest_s *)arena_alloc(parser->arena, sizeof(struct forest_s));
+  $$->children = (ntree_t **)arena_alloc(parser->arena, 2*sizeof(ntree_t *));
   $$->children[0] = $1;
   $$->count = 1;
+  $$->alloc = 2;
 }
 
 subtree: OPAR forest CPAR optional_label optional_length
 {
   int i;
 
-  $$ = (ntree_t *)calloc(1, sizeof(ntree_t));
+  $$ = (ntree_t *)arena_alloc(parser->arena, sizeof(ntree_t));
   $$->children = $2->children;
-  $$->label = $4;
-  $$->length = $5 ? atof($5) : 0;
+  $$->label = lexeme_intern($4);
+  $$->length = $5.str ? $5.number : 0;
+  $$->has_length = $5.str ? 1 : 0;
   $$->children_count = $2->count;
 
+  if ($2->count != 2)
+    ++parser->nonbinary_cnt;
+
   for (i = 0; i < $2->count; ++i)
     $$->children[i]->parent = $$;
   $$->mark = 0;
-
-  free($2);
-  free($5);
 }
        | label optional_length
 {
-  $$ = (ntree_t *)calloc(1, sizeof(ntree_t));
-  $$->label  = $1;
-  $$->length = $2 ? atof($2) : 0;
+  $$ = (ntree_t *)arena_alloc(parser->arena, sizeof(ntree_t));
+  $$->label  = lexer_tip_label(&parser->lexer, $1);
+  $$->length = $2.str ? $2.number : 0;
+  $$->has_length = $2.str ? 1 : 0;
   $$->children = NULL;
   $$->children_count = 0;
   $$->mark   = 0;
-  free($2);
+  parser->tip_cnt++;
 };
 
  
-optional_label:  {$$ = NULL;} | label  {$$ = $1;};
-optional_length: {$$ = NULL;} | COLON number {$$ = $2;};
+optional_label:  {$$.str = NULL;} | label  {$$ = $1;};
+optional_length: {$$.str = NULL;} | COLON number {$$ = $2;};
 label: STRING    {$$=$1;} | NUMBER {$$=$1;};
 number: NUMBER   {$$=$1;};
 
 %%
 
-ntree_t * ntree_parse_newick(const char * filename)
+/* grammar tokens indexed by the token codes returned by lexer_next() */
+static const int token_map[] = {0, OPAR, CPAR, COMMA, COLON, SEMICOLON,
+                                STRING, NUMBER, ERROR};
+
+int ntree_lex(YYSTYPE * lval, ntree_parser_t * parser)
 {
-  struct ntree_s * tree;
+  return token_map[lexer_next(&parser->lexer, &lval->lexeme)];
+}
 
-  tree = (ntree_t *)calloc(1, sizeof(ntree_t));
+/* name of a lexer token in the messages of the parser, without the quotes
+   of names given in the grammar */
+static void token_name(int token, char * name, size_t size)
+{
+  const char * s = yytname[YYTRANSLATE(token_map[token])];
+  int len = (int)strlen(s);
 
-  ntree_in = fopen(filename, "r");
-  if (!ntree_in)
+  if (s[0] == '"')
   {
-    ntree_destroy(tree);
-    snprintf(errmsg, 200, "Unable to open file (%s)", filename);
-    return NULL;
+    ++s;
+    len -= 2;
   }
-  else if (ntree_parse(tree))
+
+  snprintf(name, size, "%.*s", len, s);
+}
+
+/* Writes the message of a syntax error at the given token to msg, in the
+   words of the parser, for the parser of --compact (see ctree.c). The
+   expected tokens are listed in expected */
+void ntree_syntax_error(char * msg,
+                        size_t size,
+                        int token,
+                        const int * expected,
+                        int count)
+{
+  int i;
+  char name[32];
+  size_t len;
+
+  token_name(token, name, 32);
+  len = (size_t)snprintf(msg, size, "syntax error, unexpected %s", name);
+
+  for (i = 0; i < count && len < size; ++i)
+  {
+    token_name(expected[i], name, 32);
+    len += (size_t)snprintf(msg + len, size - len, "%s %s",
+                            i ? " or" : ", expecting", name);
+  }
+}
+
+ntree_parser_t * ntree_parser_create(void)
+{
+  return (ntree_parser_t *)xcalloc(1, sizeof(ntree_parser_t));
+}
+
+void ntree_parser_destroy(ntree_parser_t * parser)
+{
+  lexer_close(&parser->lexer);
+  free(parser);
+}
+
+/* Parses the trees of a file. A compressed file is inflated as the trees
+   are read, for which the caller moves the window of the lexer forward
+   with lexer_window() before each tree */
+int ntree_parser_open(ntree_parser_t * parser, const char * filename)
+{
+  parser->eof_reached = 0;
+  parser->errmsg[0] = 0;
+
+  return lexer_open_stream(&parser->lexer, filename);
+}
+
+/* Parses the trees in data[0..size-1], which is owned by the caller and must
+   be followed by a zero byte or a delimiter. The NEXUS table, if any, is
+   that of the file the data comes from */
+void ntree_parser_set_buffer(ntree_parser_t * parser,
+                             const char * data,
+                             size_t size,
+                             nexus_t * nexus)
+{
+  lexer_close(&parser->lexer);
+  lexer_init(&parser->lexer, data, size, nexus);
+
+  parser->eof_reached = 0;
+  parser->errmsg[0] = 0;
+}
+
+/* Returns the next tree, or NULL at the end of the input or when the tree
+   cannot be parsed, which can be told apart with ntree_parser_eof() */
+ntree_t * ntree_parser_next(ntree_parser_t * parser,
+                            int * tip_count,
+                            int * type)
+{
+  if (parser->eof_reached) return NULL;
+
+  parser->tree_pos = parser->lexer.pos;
+  parser->tree_seek = parser->lexer.in_tree;
+  parser->errmsg[0] = 0;
+  parser->tip_cnt = 0;
+  parser->nonbinary_cnt = 0;
+  parser->tree_type = TREE_NONE;
+
+  parser->arena = arena_create();
+  parser->tree = NULL;
+
+  /* an invalid first token is seen only after the empty input was reduced,
+     so a failed parse is never the end of the input */
+  if (ntree_parse(parser))
+    parser->eof_reached = 0;
+
+  /* a tree that cannot be parsed, or the end of the input, leaves nothing
+     in the arena that is needed */
+  if (!parser->tree || parser->eof_reached)
   {
-    ntree_destroy(tree);
-    tree = NULL;
-    fclose(ntree_in);
-    ntree_lex_destroy();
+    arena_destroy(parser->arena);
     return NULL;
   }
-  
-  if (ntree_in) fclose(ntree_in);
 
-  ntree_lex_destroy();
+  if (tip_count)
+    *tip_count = parser->tip_cnt;
+  if (type)
+    *type = parser->tree_type;
+
+  return parser->tree;
+}
 
-  return tree;
+int ntree_parser_eof(ntree_parser_t * parser)
+{
+  return parser->eof_reached;
+}
+
+const char * ntree_parser_error(ntree_parser_t * parser)
+{
+  return parser->errmsg;
+}
+
+/* position in the input of the token at which parsing failed */
+size_t ntree_parser_error_pos(ntree_parser_t * parser)
+{
+  return parser->error_pos;
+}
+
+/* Once ntree_parser_next() failed, skips the rest of the tree it could not
+   parse, i.e. everything up to the next semicolon outside quotes and
+   comments, such that the next call continues with the following tree. The
+   extent of the skipped tree is stored in start and end */
+void ntree_parser_skip(ntree_parser_t * parser, size_t * start, size_t * end)
+{
+  lexer_t * lexer = &parser->lexer;
+
+  /* a tree the lexer was moved to starts right there, as the TREE command
+     of NEXUS input was passed already */
+  *start = parser->tree_pos;
+  if (!lexer->nexus || !parser->tree_seek)
+    *start = lexer_tree_start(lexer, *start);
+
+  *end = lexer_tree_end(lexer, *start);
+
+  lexer->pos = *end;
+  lexer->in_tree = 0;
+  parser->eof_reached = 0;
+}
+
+/* the lexer of the parser, which callers may move to another tree */
+lexer_t * ntree_parser_lexer(ntree_parser_t * parser)
+{
+  return &parser->lexer;
+}
+
+void ntree_parser_close(ntree_parser_t * parser)
+{
+  lexer_close(&parser->lexer);
 }
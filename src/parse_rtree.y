@@ -21,26 +21,36 @@
 %{
 #include "newick-tools.h"
 
-extern int rtree_lex();
-extern FILE * rtree_in;
-extern void rtree_lex_destroy();
 
-void rtree_destroy(rtree_t * root)
-{
-  if (!root) return;
+/* the parser stack lives on the heap, so let it grow with the depth of the
+   tree instead of failing at bison's default depth of 10000 */
+#define YYMAXDEPTH INT_MAX
 
-  rtree_destroy(root->left);
-  rtree_destroy(root->right);
-  if (root->data)
-    free(root->data);
+/* parser state, passed to the pure parser instead of being kept in globals
+   such that the parser is reentrant */
+struct rtree_parser_s
+{
+  lexer_t lexer;
+  arena_t * arena;              /* nodes of the tree being parsed */
+  rtree_t * tree;
+  int eof_reached;
+};
 
-  free(root->label);
-  free(root);
+/* Deallocates the tree, whose nodes are all allocated from the arena of the
+   tree, in one go */
+void rtree_destroy(rtree_t * root)
+{
+  if (root)
+    arena_destroy(arena_of(root));
 }
 
 
-static void rtree_error(rtree_t * tree, const char * s) 
+static void rtree_error(struct rtree_parser_s * parser, const char * s)
 {
+  size_t pos = parser->lexer.token;
+
+  snprintf(errmsg, 200, "%s at byte %ld, line %ld", s, (long)pos,
+           1 + lexer_count_lines(&parser->lexer, 0, pos));
 }
 
 %}
@@ -48,52 +58,66 @@ static void rtree_error(rtree_t * tree, const char * s)
 
 %union
 {
-  char * s;
-  char * d;
+  lexeme_t lexeme;
   struct rtree_s * tree;
 }
 
+%code
+{
+int rtree_lex(YYSTYPE * lval, struct rtree_parser_s * parser);
+}
+
+%define api.pure full
 %error-verbose
-%parse-param {struct rtree_s * tree}
-%destructor { rtree_destroy($$); } subtree
+%parse-param {struct rtree_parser_s * parser}
+%lex-param {struct rtree_parser_s * parser}
 
 %token OPAR
 %token CPAR
 %token COMMA
 %token COLON SEMICOLON 
-%token<s> STRING
-%token<d> NUMBER
-%type<s> label optional_label
-%type<d> number optional_length
+%token<lexeme> STRING
+%token<lexeme> NUMBER
+%token ERROR "invalid character"
+%type<lexeme> label optional_label number optional_length
 %type<tree> subtree
 %start input
 %%
 
 input: OPAR subtree COMMA subtree CPAR optional_label optional_length SEMICOLON
 {
+  rtree_t * tree = (rtree_t *)arena_alloc(parser->arena, sizeof(rtree_t));
+
   tree->left   = $2;
   tree->right  = $4;
-  tree->label  = $6;
-  tree->length = $7 ? atof($7) : 1;
+  tree->label  = lexeme_intern($6);
+  tree->length = $7.str ? $7.number : 1;
   tree->leaves = $2->leaves + $4->leaves;
   tree->parent = NULL;
   tree->mark   = 0;
-  free($7);
 
   tree->left->parent  = tree;
   tree->right->parent = tree;
+  parser->tree = tree;
+
+  /* stop at the semicolon without reading ahead, such that the next call
+     to the parser starts at the beginning of the next tree */
+  YYACCEPT;
+}
+     |
+{
+  parser->eof_reached = 1;
 };
 
 subtree: OPAR subtree COMMA subtree CPAR optional_label optional_length
 {
-  $$ = (rtree_t *)calloc(1, sizeof(rtree_t));
+  $$ = (rtree_t *)arena_alloc(parser->arena, sizeof(rtree_t));
   $$->left   = $2;
   $$->right  = $4;
-  $$->label  = $6;
-  $$->length = $7 ? atof($7) : 1;
+  $$->label  = lexeme_intern($6);
+  $$->length = $7.str ? $7.number : 1;
   $$->leaves = $2->leaves + $4->leaves;
   $$->mark   = 0;
-  free($7);
 
   $$->left->parent  = $$;
   $$->right->parent = $$;
@@ -101,49 +125,54 @@ subtree: OPAR subtree COMMA subtree CPAR optional_label optional_length
 }
        | label optional_length
 {
-  $$ = (rtree_t *)calloc(1, sizeof(rtree_t));
-  $$->label  = $1;
-  $$->length = $2 ? atof($2) : 1;
+  $$ = (rtree_t *)arena_alloc(parser->arena, sizeof(rtree_t));
+  $$->label  = lexer_tip_label(&parser->lexer, $1);
+  $$->length = $2.str ? $2.number : 1;
   $$->left   = NULL;
   $$->right  = NULL;
   $$->leaves = 1;
   $$->mark   = 0;
-  free($2);
 };
 
  
-optional_label:  {$$ = NULL;} | label  {$$ = $1;};
-optional_length: {$$ = NULL;} | COLON number {$$ = $2;};
+optional_label:  {$$.str = NULL;} | label  {$$ = $1;};
+optional_length: {$$.str = NULL;} | COLON number {$$ = $2;};
 label: STRING    {$$=$1;} | NUMBER {$$=$1;};
 number: NUMBER   {$$=$1;};
 
 %%
 
+/* grammar tokens indexed by the token codes returned by lexer_next() */
+static const int token_map[] = {0, OPAR, CPAR, COMMA, COLON, SEMICOLON,
+                                STRING, NUMBER, ERROR};
+
+int rtree_lex(YYSTYPE * lval, struct rtree_parser_s * parser)
+{
+  return token_map[lexer_next(&parser->lexer, &lval->lexeme)];
+}
+
+/* Parses the first tree of a file. Each call has its own parser state */
 rtree_t * rtree_parse_newick(const char * filename)
 {
-  struct rtree_s * tree;
+  struct rtree_parser_s state;
 
-  tree = (rtree_t *)calloc(1, sizeof(rtree_t));
+  memset(&state, 0, sizeof(state));
 
-  rtree_in = fopen(filename, "r");
-  if (!rtree_in)
-  {
-    rtree_destroy(tree);
-    snprintf(errmsg, 200, "Unable to open file (%s)", filename);
+  if (!lexer_open(&state.lexer, filename))
     return NULL;
-  }
-  else if (rtree_parse(tree))
+
+  /* the nodes of a tree that cannot be parsed are freed with the arena, and
+     so are never freed one by one */
+  state.arena = arena_create();
+  state.tree = NULL;
+
+  if (rtree_parse(&state) || state.eof_reached)
   {
-    rtree_destroy(tree);
-    tree = NULL;
-    fclose(rtree_in);
-    rtree_lex_destroy();
-    return NULL;
+    arena_destroy(state.arena);
+    state.tree = NULL;
   }
-  
-  if (rtree_in) fclose(rtree_in);
 
-  rtree_lex_destroy();
+  lexer_close(&state.lexer);
 
-  return tree;
+  return state.tree;
 }
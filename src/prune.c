@@ -43,13 +43,6 @@ static void prune_taxa(rtree_t ** root,
     
     rtree_t * temp = (parent->left == prune_tips_list[i]) ?
                            parent->right : parent->left;
-    
-    if (prune_tips_list[i]->label)
-      free(prune_tips_list[i]->label);
-    free(prune_tips_list[i]);
-
-    if (parent->label)
-      free(parent->label);
 
     if (grandparent)
     {
@@ -71,7 +64,9 @@ static void prune_taxa(rtree_t ** root,
       /* temp->length = 0; */
       *root = temp;
     }
-    free(parent);
+
+    /* the pruned tip and its parent are left in the arena of the tree, and
+       are freed with the rest of it */
   }
 }
 
@@ -91,18 +86,11 @@ static utree_t * utree_prune_taxa(utree_t ** prune_tips_list,
 
     double len = x->length + y->length;
 
-    free(parent->next->next);
-    free(parent->next);
-    free(parent->label);
-    free(parent);
-
+    /* the unlinked nodes stay allocated until the tree is destroyed */
     x->back = y;
     y->back = x;
     x->length = y->length = len;
 
-    free(prune_tips_list[i]->label);
-    free(prune_tips_list[i]);
-
     if (!(x->next))
       root = y;
     else
@@ -130,89 +118,89 @@ static rtree_t ** rtree_random_tiplist(rtree_t * root)
 void cmd_prune_tips()
 {
   FILE * out;
+  writer_t * w;
   unsigned int prune_tips_count;
-  char * newick;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
           xopen(opt_outfile,"w") : stdout;
+  w = writer_open(out);
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
   {
-    int tip_count;
-    utree_t * utree = utree_parse_newick(opt_treefile, &tip_count);
-    if (!utree)
-      fatal("Tree is neither unrooted nor rooted. Go fix your tree.");
-
-    if (!opt_quiet)
-      fprintf(stdout, "Loaded unrooted tree...\n");
+    if (tree_type == TREE_UNROOTED)
+    {
+      if (!opt_quiet)
+        fprintf(stdout, "Loaded unrooted tree...\n");
 
-    utree_t ** prune_tips_list;
+      utree_t ** prune_tips_list;
 
-    if (opt_prune_random)
-    {
-      prune_tips_list = utree_random_tiplist(utree, tip_count);
-      prune_tips_count = opt_prune_random;
-    }
-    else
-      prune_tips_list = utree_tipstring_nodes(utree,
-                                              tip_count,
-                                              opt_prune_tips,
-                                              &prune_tips_count);
+      if (opt_prune_random)
+      {
+        prune_tips_list = utree_random_tiplist(utree, tip_count);
+        prune_tips_count = opt_prune_random;
+      }
+      else
+        prune_tips_list = utree_tipstring_nodes(utree,
+                                                tip_count,
+                                                opt_prune_tips,
+                                                &prune_tips_count);
       
-    if (prune_tips_count+3 > (unsigned int)tip_count)
-      fatal("Error, the resulting tree must have at least 3 taxa.");
+      if (prune_tips_count+3 > (unsigned int)tip_count)
+        fatal("Error, the resulting tree must have at least 3 taxa.");
 
-    utree_t * uroot = utree_prune_taxa(prune_tips_list, prune_tips_count);
-    free(prune_tips_list);
+      utree_t * uroot = utree_prune_taxa(prune_tips_list, prune_tips_count);
+      free(prune_tips_list);
 
-    /* export tree structure to newick string */
-    newick = utree_export_newick(uroot);
+      utree_stream_newick(w, uroot);
 
-    /* deallocate tree structure */
-    utree_destroy(uroot);
-  }
-  else
-  {
-    rtree_t ** prune_tips_list;
-   
-    if (opt_prune_random)
-    {
-      prune_tips_list = rtree_random_tiplist(rtree);
-      prune_tips_count = opt_prune_random;
+      /* deallocate tree structure */
+      utree_destroy(uroot);
     }
-    else
-      prune_tips_list = rtree_tipstring_nodes(rtree,
-                                              opt_prune_tips,
-                                              &prune_tips_count);
+    else if (tree_type == TREE_ROOTED)
+    {
+      rtree_t ** prune_tips_list;
+     
+      if (opt_prune_random)
+      {
+        prune_tips_list = rtree_random_tiplist(rtree);
+        prune_tips_count = opt_prune_random;
+      }
+      else
+        prune_tips_list = rtree_tipstring_nodes(rtree,
+                                                opt_prune_tips,
+                                                &prune_tips_count);
 
-    prune_taxa(&rtree, prune_tips_list, prune_tips_count);
-    free(prune_tips_list);
+      prune_taxa(&rtree, prune_tips_list, prune_tips_count);
+      free(prune_tips_list);
 
-    rtree_reset_leaves(rtree);
+      rtree_reset_leaves(rtree);
 
-    /* export tree structure to newick string */
-    newick = rtree_export_newick(rtree);
+      rtree_stream_newick(w, rtree);
 
-    /* deallocate tree structure */
-    rtree_destroy(rtree);
+      /* deallocate tree structure */
+      rtree_destroy(rtree);
+    }
+    else
+      fatal("Tree is neither unrooted nor rooted. Go fix your tree.");
   }
 
-
-
-  fprintf(out, "%s\n", newick);
+  forest_close();
+  writer_close(w);
 
   if (opt_outfile)
     fclose(out);
 
-  free(newick);
-
   if (!opt_quiet)
     fprintf(stdout, "Done...\n");
 }
@@ -220,41 +208,52 @@ void cmd_prune_tips()
 void cmd_induce_tree()
 {
   FILE * out;
+  writer_t * w;
   rtree_t ** complement_tiplist;
   rtree_t ** prune_tiplist;
   unsigned int complement_tips_count = 0;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
           xopen(opt_outfile,"w") : stdout;
+  w = writer_open(out);
 
   /* parse tree */
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  complement_tiplist = rtree_tipstring_nodes(rtree,
-                                           opt_induce_subtree,
-                                           &complement_tips_count);
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
+  {
+    if (tree_type != TREE_ROOTED)
+      fatal("Tree must be rooted...");
 
-  prune_tiplist = rtree_tiplist_complement(rtree,
-                                           complement_tiplist,
-                                           complement_tips_count);
-  free(complement_tiplist);
+    complement_tiplist = rtree_tipstring_nodes(rtree,
+                                             opt_induce_subtree,
+                                             &complement_tips_count);
 
-  prune_taxa(&rtree, prune_tiplist, rtree->leaves - complement_tips_count);
-  free(prune_tiplist);
-   
-  rtree_reset_leaves(rtree);
-  char * newick = rtree_export_newick(rtree);
+    prune_tiplist = rtree_tiplist_complement(rtree,
+                                             complement_tiplist,
+                                             complement_tips_count);
+    free(complement_tiplist);
 
-  fprintf(out, "%s\n", newick);
+    prune_taxa(&rtree, prune_tiplist, rtree->leaves - complement_tips_count);
+    free(prune_tiplist);
+     
+    rtree_reset_leaves(rtree);
+    rtree_stream_newick(w, rtree);
 
-  free(newick);
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+  }
 
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
+  forest_close();
+  writer_close(w);
 
   if (!opt_quiet)
     fprintf(stdout, "Done...\n");
@@ -25,8 +25,12 @@ static int indend_space = 4;
 
 static void print_node_info(FILE * stream, rtree_t * tree)
 {
+  char length[FORMAT_BUFFER_SIZE];
+
+  format_double(length, FORMAT_BUFFER_SIZE, tree->length, opt_precision);
+
   fprintf(stream," %s", tree->label);
-  fprintf(stream," %.*f", opt_precision, tree->length);
+  fprintf(stream," %s", length);
   fprintf(stream,"\n");
 }
 
@@ -52,7 +56,6 @@ double rtree_longest_path(rtree_t * root)
   count = rtree_query_tipnodes(root, tips);
   for (i = 0; i < count; ++i)
   {
-    maxlength = 0;
     double length = 0;
     rtree_t * node = tips[i];
     while (node)
@@ -68,14 +71,25 @@ double rtree_longest_path(rtree_t * root)
   return maxlength;
 }
 
-static void print_tree_recurse(FILE * stream,
-                               rtree_t * tree, 
-                               int indend_level, 
-                               int * active_node_order)
+/* Prints a node of --tree_show, below the lines of the subtrees that are
+   still open at smaller depths. The depth of the node is that of its frame
+   on the traversal stack, and the frame of its parent tells whether the
+   node is the first or the second child */
+static int print_tree_node(FILE * stream,
+                           rtree_t * tree,
+                           const trav_stack_t * stack,
+                           int * active_node_order)
 {
   int i,j;
+  int indend_level = stack->top - 1;
+
+  if (!indend_level)
+  {
+    print_node_info(stream,tree);
+    return 1;
+  }
 
-  if (!tree) return;
+  active_node_order[indend_level-1] = stack->frames[stack->top-2].child;
 
   for (i = 0; i < indend_level; ++i)
   {
@@ -111,122 +125,43 @@ static void print_tree_recurse(FILE * stream,
   if (active_node_order[indend_level-1] == 2) 
     active_node_order[indend_level-1] = 0;
 
-  active_node_order[indend_level] = 1;
-  print_tree_recurse(stream,
-                     tree->left,
-                     indend_level+1,
-                     active_node_order);
-  active_node_order[indend_level] = 2;
-  print_tree_recurse(stream,
-                     tree->right,
-                     indend_level+1,
-                     active_node_order);
-
+  return 1;
 }
 
-static int tree_indend_level(rtree_t * tree, int indend)
+/* returns the number of nodes on the longest path from the root */
+static int tree_indend_level(rtree_t * tree, trav_stack_t * stack)
 {
-  if (!tree) return indend;
+  int indend = 0;
 
-  int a = tree_indend_level(tree->left,  indend+1);
-  int b = tree_indend_level(tree->right, indend+1);
+  TRAVERSE_BINARY(stack, rtree_t, tree, node,
+                  !node->left && !node->right, node->left, node->right,
+                  1,
+                  indend = MAX(indend, stack->top));
 
-  return (a > b ? a : b);
+  return indend;
 }
 
 void rtree_show_ascii(FILE * stream, rtree_t * tree)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   
-  int indend_max = tree_indend_level(tree,0);
+  int indend_max = tree_indend_level(tree, &stack);
 
   int * active_node_order = (int *)xmalloc((indend_max+1) * sizeof(int));
-  active_node_order[0] = 1;
-  active_node_order[1] = 1;
 
-  print_node_info(stream,tree);
-  print_tree_recurse(stream, tree->left,  1, active_node_order);
-  active_node_order[0] = 2;
-  print_tree_recurse(stream, tree->right, 1, active_node_order);
+  TRAVERSE_BINARY(&stack, rtree_t, tree, node,
+                  !node->left && !node->right, node->left, node->right,
+                  print_tree_node(stream, node, &stack, active_node_order),
+                  );
+  trav_stack_free(&stack);
   free(active_node_order);
 }
 
-static char * rtree_export_newick_recursive(rtree_t * root)
-{
-  char * newick;
-
-  if (!root) return NULL;
-
-  if (!(root->left) || !(root->right))
-    asprintf(&newick, "%s:%.*f", root->label, opt_precision, root->length);
-  else
-  {
-    char * subtree1 = rtree_export_newick_recursive(root->left);
-    char * subtree2 = rtree_export_newick_recursive(root->right);
-
-    asprintf(&newick, "(%s,%s)%s:%.*f", subtree1,
-                                        subtree2,
-                                        root->label ? root->label : "",
-                                        opt_precision,
-                                        root->length);
-    free(subtree1);
-    free(subtree2);
-  }
-
-  return newick;
-}
-
-char * rtree_export_newick(rtree_t * root)
-{
-  char * newick;
-
-  if (!root) return NULL;
-
-  if (!(root->left) || !(root->right))
-    asprintf(&newick, "%s:%.*f", root->label, opt_precision, root->length);
-  else
-  {
-    char * subtree1 = rtree_export_newick_recursive(root->left);
-    char * subtree2 = rtree_export_newick_recursive(root->right);
-
-    asprintf(&newick, "(%s,%s)%s:%.*f;", subtree1,
-                                         subtree2,
-                                         root->label ? root->label : "",
-                                         opt_precision,
-                                         root->length);
-    free(subtree1);
-    free(subtree2);
-  }
-
-  return newick;
-}
-
-static void rtree_traverse_recursive(rtree_t * node,
-                                     int (*cbtrav)(rtree_t *),
-                                     int * index,
-                                     rtree_t ** outbuffer)
-{
-  if (!node->left)
-  {
-    if (cbtrav(node))
-    {
-      outbuffer[*index] = node;
-      *index = *index + 1;
-    }
-    return;
-  }
-  if (!cbtrav(node))
-    return;
-  rtree_traverse_recursive(node->left, cbtrav, index, outbuffer);
-  rtree_traverse_recursive(node->right, cbtrav, index, outbuffer);
-
-  outbuffer[*index] = node;
-  *index = *index + 1;
-}
-
 int rtree_traverse(rtree_t * root,
                    int (*cbtrav)(rtree_t *),
                    rtree_t ** outbuffer)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   int index = 0;
 
   if (!root->left) return -1;
@@ -241,25 +176,13 @@ int rtree_traverse(rtree_t * root,
      at each node the callback function is called to decide whether we
      are going to traversing the subtree rooted at the specific node */
 
-  rtree_traverse_recursive(root, cbtrav, &index, outbuffer);
-  return index;
-}
-
-static void rtree_traverse_postorder_recursive(rtree_t * node,
-                                               int (*cbtrav)(rtree_t *),
-                                               int * index,
-                                               rtree_t ** outbuffer)
-{
-  if (!node) return;
-
-  rtree_traverse_postorder_recursive(node->left,  cbtrav, index, outbuffer);
-  rtree_traverse_postorder_recursive(node->right, cbtrav, index, outbuffer);
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  cbtrav(node),
+                  outbuffer[index++] = node);
 
-  if (cbtrav(node))
-  {
-    outbuffer[*index] = node;
-    *index = *index + 1;
-  }
+  trav_stack_free(&stack);
+  return index;
 }
 
 static int cb_rtree_all(rtree_t * node)
@@ -296,6 +219,7 @@ int rtree_traverse_postorder(rtree_t * root,
                              int (*cbtrav)(rtree_t *),
                              rtree_t ** outbuffer)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   int index = 0;
 
   if (!root->left) return -1;
@@ -310,7 +234,12 @@ int rtree_traverse_postorder(rtree_t * root,
      at each node the callback function is called to decide whether to
      place the node in the list */
 
-  rtree_traverse_postorder_recursive(root, cbtrav, &index, outbuffer);
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  1,
+                  if (cbtrav(node)) outbuffer[index++] = node);
+  trav_stack_free(&stack);
+
   if (cbtrav(root))
   {
     outbuffer[index] = root;
@@ -319,22 +248,18 @@ int rtree_traverse_postorder(rtree_t * root,
   return index;
 }
 
-void rtree_traverse_sorted(rtree_t * root, rtree_t ** node_list, int * index)
+/* Orders the lists of the two subtrees of an inner node, which end at
+   position end of node_list, by their size and then by the kinds and labels
+   of their nodes. The list of a subtree has 2*leaves-1 nodes */
+static void sort_subtrees(rtree_t ** node_list,
+                          int end,
+                          rtree_t * left,
+                          rtree_t * right)
 {
-  if (!root) return;
-  if (!root->left)
-  {
-    node_list[(*index)++] = root;
-    return;
-  }
-
-  int left_start = *index;
-  rtree_traverse_sorted(root->left, node_list, index);
-  int right_start = *index;
-  rtree_traverse_sorted(root->right, node_list, index);
-
-  int left_len = right_start - left_start;
-  int right_len = *index - right_start;
+  int right_len = right ? 2*right->leaves - 1 : 0;
+  int left_len = 2*left->leaves - 1;
+  int right_start = end - right_len;
+  int left_start = right_start - left_len;
 
   int swap = 0;
 
@@ -385,34 +310,33 @@ void rtree_traverse_sorted(rtree_t * root, rtree_t ** node_list, int * index)
     /* swap the two trees */
     rtree_t ** temp = (rtree_t **)xmalloc(left_len * sizeof(rtree_t *));
     memcpy(temp, node_list+left_start, left_len * sizeof(rtree_t *));
-    memcpy(node_list+left_start, node_list+right_start, right_len * sizeof(rtree_t *));
+    memcpy(node_list+left_start,
+           node_list+right_start,
+           right_len * sizeof(rtree_t *));
     memcpy(node_list+left_start+right_len, temp, left_len * sizeof(rtree_t *));
     free(temp);
   }
-
-  node_list[(*index)++] = root;
 }
 
-static void rtree_query_tipnodes_recursive(rtree_t * node,
-                                           rtree_t ** node_list,
-                                           int * index)
+void rtree_traverse_sorted(rtree_t * root, rtree_t ** node_list, int * index)
 {
-  if (!node) return;
-
-  if (!node->left)
-  {
-    node_list[*index] = node;
-    *index = *index + 1;
-    return;
-  }
-
-  rtree_query_tipnodes_recursive(node->left,  node_list, index);
-  rtree_query_tipnodes_recursive(node->right, node_list, index);
+  trav_stack_t stack = {NULL, 0, 0};
+
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  1,
+                  {
+                    if (node->left)
+                      sort_subtrees(node_list, *index, node->left, node->right);
+                    node_list[(*index)++] = node;
+                  });
+  trav_stack_free(&stack);
 }
 
 int rtree_query_tipnodes(rtree_t * root,
                          rtree_t ** node_list)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   int index = 0;
 
   if (!root) return 0;
@@ -422,57 +346,45 @@ int rtree_query_tipnodes(rtree_t * root,
     return index;
   }
 
-  rtree_query_tipnodes_recursive(root->left,  node_list, &index);
-  rtree_query_tipnodes_recursive(root->right, node_list, &index);
+  /* tips are left before any other node is, hence in left to right order */
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  1,
+                  if (!node->left) node_list[index++] = node);
+  trav_stack_free(&stack);
 
   return index;
 }
 
-static void rtree_query_innernodes_recursive(rtree_t * root,
-                                             rtree_t ** node_list,
-                                             int * index)
-{
-  if (!root) return;
-  if (!root->left) return;
-
-  /* postorder traversal */
-
-  rtree_query_innernodes_recursive(root->left,  node_list, index);
-  rtree_query_innernodes_recursive(root->right, node_list, index);
-
-  node_list[*index] = root;
-  *index = *index + 1;
-  return;
-}
-
 int rtree_query_innernodes(rtree_t * root,
                            rtree_t ** node_list)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   int index = 0;
 
   if (!root) return 0;
   if (!root->left) return 0;
 
-  rtree_query_innernodes_recursive(root->left,  node_list, &index);
-  rtree_query_innernodes_recursive(root->right, node_list, &index);
-
-  node_list[index++] = root;
+  /* postorder traversal, which ends with the root */
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  node->left,
+                  node_list[index++] = node);
+  trav_stack_free(&stack);
 
   return index;
 }
 
 void rtree_reset_leaves(rtree_t * root)
 {
-  if (!root->left)
-  {
-    root->leaves = 1;
-    return;
-  }
-  
-  rtree_reset_leaves(root->left);
-  rtree_reset_leaves(root->right);
-
-  root->leaves = root->left->leaves + root->right->leaves;
+  trav_stack_t stack = {NULL, 0, 0};
+
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  1,
+                  node->leaves = node->left ?
+                                 node->left->leaves + node->right->leaves : 1);
+  trav_stack_free(&stack);
 }
 
 rtree_t ** rtree_tipstring_nodes(rtree_t * root, char * tipstring, unsigned int * tiplist_count)
@@ -481,11 +393,9 @@ rtree_t ** rtree_tipstring_nodes(rtree_t * root, char * tipstring, unsigned int
   unsigned int k;
   unsigned int commas_count = 0;
 
-  char * taxon;
+  int id;
   unsigned int taxon_len;
 
-  ENTRY * found = NULL;
-
   for (i = 0; i < strlen(tipstring); ++i)
     if (tipstring[i] == ',')
       commas_count++;
@@ -496,15 +406,19 @@ rtree_t ** rtree_tipstring_nodes(rtree_t * root, char * tipstring, unsigned int
   rtree_t ** out_node_list = (rtree_t **)xmalloc((commas_count+1) *
                                                    sizeof(rtree_t *));
 
-  /* create a hashtable of tip labels */
-  hcreate(2 * root->leaves);
+  /* index the tip nodes by the ids of their interned labels. A label that
+     occurs more than once stands for its first tip, and unlabelled tips
+     cannot be listed */
+  rtree_t ** tip_by_id = (rtree_t **)xcalloc(label_count(), sizeof(rtree_t *));
 
   for (i = 0; i < root->leaves; ++i)
   {
-    ENTRY entry;
-    entry.key  = node_list[i]->label;
-    entry.data = node_list[i];
-    hsearch(entry,ENTER);
+    if (!node_list[i]->label)
+      continue;
+
+    id = label_id(node_list[i]->label);
+    if (!tip_by_id[id])
+      tip_by_id[id] = node_list[i];
   }
 
   char * s = tipstring;
@@ -517,30 +431,22 @@ rtree_t ** rtree_tipstring_nodes(rtree_t * root, char * tipstring, unsigned int
     if (!taxon_len)
       fatal("Erroneous prune list format (double comma)/taxon missing");
 
-    taxon = strndup(s, taxon_len);
-
-    /* search tip in hash table */
-    ENTRY query;
-    query.key = taxon;
-    found = NULL;
-    found = hsearch(query,FIND);
+    /* look up the taxon id, which exists only if some tree had the label */
+    id = label_find(s, taxon_len);
     
-    if (!found)
-      fatal("Taxon %s in does not appear in the tree", taxon);
+    if (id == -1 || !tip_by_id[id])
+      fatal("Taxon %.*s in does not appear in the tree", taxon_len, s);
 
     /* store pointer in output list */
-    out_node_list[k++] = (rtree_t *)(found->data);
+    out_node_list[k++] = tip_by_id[id];
 
-    /* free tip label, and move to the beginning of next tip if available */
-    free(taxon);
+    /* move to the beginning of next tip if available */
     s += taxon_len;
     if (*s == ',') 
       s += 1;
   }
 
-  /* kill the hash table */
-  hdestroy();
-
+  free(tip_by_id);
   free(node_list);
 
   /* return number of tips in the list */
@@ -556,17 +462,14 @@ rtree_t ** rtree_tiplist_complement(rtree_t * root,
 {
   unsigned int i;
   unsigned int k;
-  ENTRY * found = NULL;
 
-  hcreate(2 * tiplist_count);
+  /* index the tips in the list by their taxon ids. Of the tips sharing a
+     label, only the listed one, i.e. the first, is left out */
+  rtree_t ** in_list = (rtree_t **)xcalloc(label_count(), sizeof(rtree_t *));
 
   for (i = 0; i < tiplist_count; ++i)
-  {
-    ENTRY entry;
-    entry.key  = tiplist[i]->label;
-    entry.data = tiplist[i];
-    hsearch(entry,ENTER);
-  }
+    if (tiplist[i]->label)
+      in_list[label_id(tiplist[i]->label)] = tiplist[i];
   
   rtree_t ** node_list = (rtree_t **)xmalloc(root->leaves * sizeof(rtree_t *));
   rtree_query_tipnodes(root, node_list);
@@ -576,17 +479,13 @@ rtree_t ** rtree_tiplist_complement(rtree_t * root,
   
   for (k = 0, i = 0; i < root->leaves; ++i)
   {
-    ENTRY query;
-    query.key = node_list[i]->label;
-    found = NULL;
-    found = hsearch(query,FIND);
-    
-    /* store pointer in output list */
-    if (!found)
+    /* store pointer in output list, unlabelled tips are never listed */
+    if (!node_list[i]->label ||
+        in_list[label_id(node_list[i]->label)] != node_list[i])
       out_node_list[k++] = node_list[i];
   }
 
-  hdestroy();
+  free(in_list);
   free(node_list);
 
   assert(k == (root->leaves - tiplist_count));
@@ -0,0 +1,702 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Binary snapshot format. A snapshot file starts with a file header and is
+   followed by one record per tree. Nodes are numbered in breadth-first order
+   starting from the root, such that the children of each node are numbered
+   consecutively and after their parent. Each record consists of a record
+   header and the following arrays, each starting at a multiple of 8 bytes:
+
+     double        length[n]          branch lengths
+     int           parent[n]          parent index, -1 for the root
+     int           child_start[n+1]   children of i are child_start[i] to
+                                      child_start[i+1]-1
+     unsigned int  label[n]           offset of the label in the string
+                                      table, or SNAPSHOT_NOLABEL
+     unsigned char has_length[n]      whether the branch length was given
+     char          strings[]          zero-terminated labels
+
+   The arrays are stored in the byte order of the machine that wrote them,
+   which is recorded in the file header, and a mapped record can be used as
+   it is through the views in snapshot_tree_t */
+
+#define SNAPSHOT_MAGIC      "NWKSNAP"
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_NOLABEL    0xFFFFFFFFU
+
+#define ALIGN8(x) (((x) + 7) & ~((size_t)7))
+
+typedef struct snapshot_header_s
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int byte_order;
+} snapshot_header_t;
+
+typedef struct snapshot_record_s
+{
+  unsigned long record_size;
+  unsigned long strings_size;
+  unsigned int tree_type;
+  unsigned int node_count;
+  unsigned int tip_count;
+  unsigned int reserved;
+} snapshot_record_t;
+
+/* offsets of the arrays within a record */
+typedef struct record_layout_s
+{
+  size_t length;
+  size_t parent;
+  size_t child_start;
+  size_t label;
+  size_t has_length;
+  size_t strings;
+  size_t size;
+} record_layout_t;
+
+static lexer_t snapshot_file;
+static int snapshot_eof_reached;
+
+static void record_layout(size_t n, size_t strings_size, record_layout_t * l)
+{
+  l->length      = ALIGN8(sizeof(snapshot_record_t));
+  l->parent      = ALIGN8(l->length + n * sizeof(double));
+  l->child_start = ALIGN8(l->parent + n * sizeof(int));
+  l->label       = ALIGN8(l->child_start + (n+1) * sizeof(int));
+  l->has_length  = ALIGN8(l->label + n * sizeof(unsigned int));
+  l->strings     = ALIGN8(l->has_length + n);
+  l->size        = ALIGN8(l->strings + strings_size);
+}
+
+/* Returns 1 if the file is a regular file starting with the snapshot magic,
+   possibly after gzip compression. Only the header is read, such that pipes
+   are left untouched */
+int snapshot_probe(const char * filename)
+{
+  struct stat st;
+  snapshot_header_t header;
+  gzFile gz;
+  int is_snapshot = 0;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return 0;
+
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return 0;
+  }
+
+  /* gzread() also reads uncompressed files */
+  gz = gzdopen(fd, "r");
+  if (!gz)
+  {
+    close(fd);
+    return 0;
+  }
+
+  if (gzread(gz, &header, sizeof(header)) == (int)sizeof(header) &&
+      !memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)))
+    is_snapshot = 1;
+
+  gzclose(gz);
+
+  return is_snapshot;
+}
+
+int snapshot_open(const char * filename)
+{
+  snapshot_header_t * header;
+
+  snapshot_eof_reached = 0;
+
+  if (!lexer_open(&snapshot_file, filename))
+    return 0;
+
+  header = (snapshot_header_t *)snapshot_file.data;
+
+  if (snapshot_file.size < sizeof(snapshot_header_t) ||
+      memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)))
+  {
+    snprintf(errmsg, 200, "File %s is not a snapshot", filename);
+    lexer_close(&snapshot_file);
+    return 0;
+  }
+
+  if (header->byte_order != SNAPSHOT_BYTE_ORDER)
+  {
+    snprintf(errmsg, 200, "Snapshot %s was written on a machine with "
+             "different byte order", filename);
+    lexer_close(&snapshot_file);
+    return 0;
+  }
+
+  if (header->version != SNAPSHOT_VERSION)
+  {
+    snprintf(errmsg, 200, "Snapshot %s has unsupported version %u",
+             filename, header->version);
+    lexer_close(&snapshot_file);
+    return 0;
+  }
+
+  snapshot_file.pos = sizeof(snapshot_header_t);
+
+  return 1;
+}
+
+/* Checks that the record describes a tree, such that the conversions below
+   cannot access memory outside the record, and returns the tree type implied
+   by the node degrees, or TREE_NONE */
+static int record_check(const snapshot_tree_t * tree, size_t strings_size)
+{
+  int i, j;
+  int n = tree->node_count;
+  int tips = 0;
+  int nonbinary = 0;
+  int root_degree = tree->child_start[1] - tree->child_start[0];
+
+  if (tree->child_start[0] != 1 || tree->child_start[n] != n ||
+      tree->parent[0] != -1)
+    return TREE_NONE;
+
+  for (i = 0; i < n; ++i)
+  {
+    int degree = tree->child_start[i+1] - tree->child_start[i];
+
+    if (tree->child_start[i] <= i || degree < 0 || tree->child_start[i+1] > n)
+      return TREE_NONE;
+
+    for (j = tree->child_start[i]; j < tree->child_start[i+1]; ++j)
+      if (tree->parent[j] != i)
+        return TREE_NONE;
+
+    if (tree->label[i] != SNAPSHOT_NOLABEL && tree->label[i] >= strings_size)
+      return TREE_NONE;
+
+    if (!degree)
+      ++tips;
+    else if (i && degree != 2)
+      ++nonbinary;
+  }
+
+  if (strings_size && tree->strings[strings_size-1])
+    return TREE_NONE;
+
+  if (tips != tree->tip_count)
+    return TREE_NONE;
+
+  if (!nonbinary && root_degree == 2)
+    return TREE_ROOTED;
+  if (!nonbinary && root_degree == 3)
+    return TREE_UNROOTED;
+
+  return TREE_NARY;
+}
+
+/* Points the views of tree to the next record of the file. Returns 0 after
+   the last record, or if the record is damaged, in which case the error is
+   stored in errmsg and snapshot_eof() returns 0 */
+int snapshot_next(snapshot_tree_t * tree)
+{
+  record_layout_t layout;
+  snapshot_record_t * record;
+  size_t left = snapshot_file.size - snapshot_file.pos;
+  const char * base = snapshot_file.data + snapshot_file.pos;
+
+  if (!left)
+  {
+    snapshot_eof_reached = 1;
+    return 0;
+  }
+
+  record = (snapshot_record_t *)base;
+
+  if (left < sizeof(snapshot_record_t) || !record->node_count ||
+      record->node_count > INT_MAX - 1 ||
+      record->strings_size > left)
+  {
+    snprintf(errmsg, 200, "Damaged snapshot record header");
+    return 0;
+  }
+
+  record_layout(record->node_count, record->strings_size, &layout);
+  if (record->record_size != layout.size || layout.size > left)
+  {
+    snprintf(errmsg, 200, "Damaged snapshot record size");
+    return 0;
+  }
+
+  tree->tree_type   = (int)record->tree_type;
+  tree->node_count  = (int)record->node_count;
+  tree->tip_count   = (int)record->tip_count;
+  tree->length      = (const double *)(base + layout.length);
+  tree->parent      = (const int *)(base + layout.parent);
+  tree->child_start = (const int *)(base + layout.child_start);
+  tree->label       = (const unsigned int *)(base + layout.label);
+  tree->has_length  = (const unsigned char *)(base + layout.has_length);
+  tree->strings     = base + layout.strings;
+
+  if (record_check(tree, record->strings_size) != tree->tree_type)
+  {
+    snprintf(errmsg, 200, "Damaged snapshot record");
+    return 0;
+  }
+
+  snapshot_file.pos += layout.size;
+
+  return 1;
+}
+
+int snapshot_eof(void)
+{
+  return snapshot_eof_reached;
+}
+
+void snapshot_close(void)
+{
+  lexer_close(&snapshot_file);
+}
+
+static char * node_label(const snapshot_tree_t * tree, int i)
+{
+  if (tree->label[i] == SNAPSHOT_NOLABEL)
+    return NULL;
+
+  const char * s = tree->strings + tree->label[i];
+
+  return label_intern(s, strlen(s));
+}
+
+/* Builds the n-ary tree of the record. Nodes are allocated in index order
+   and linked to their parents, which always come first */
+ntree_t * snapshot_tree_ntree(const snapshot_tree_t * tree)
+{
+  int i, j;
+  int n = tree->node_count;
+  ntree_t ** nodes = (ntree_t **)xmalloc(n * sizeof(ntree_t *));
+  arena_t * arena = arena_create();
+
+  for (i = 0; i < n; ++i)
+  {
+    ntree_t * node = (ntree_t *)arena_alloc(arena, sizeof(ntree_t));
+
+    node->label = node_label(tree, i);
+    node->length = tree->length[i];
+    node->has_length = tree->has_length[i];
+    node->children_count = tree->child_start[i+1] - tree->child_start[i];
+    if (node->children_count)
+      node->children = (ntree_t **)arena_alloc(arena,
+                                               node->children_count *
+                                               sizeof(ntree_t *));
+    if (i)
+    {
+      node->parent = nodes[tree->parent[i]];
+      j = i - tree->child_start[tree->parent[i]];
+      node->parent->children[j] = node;
+    }
+
+    nodes[i] = node;
+  }
+
+  ntree_t * root = nodes[0];
+  free(nodes);
+
+  return root;
+}
+
+/* Builds the rooted binary tree of the record. The first child of a node is
+   its left child. Missing lengths are set to 1, and the number of leaves is
+   accumulated in reverse index order, which visits children before their
+   parents */
+rtree_t * snapshot_tree_rtree(const snapshot_tree_t * tree)
+{
+  int i;
+  int n = tree->node_count;
+  rtree_t ** nodes = (rtree_t **)xmalloc(n * sizeof(rtree_t *));
+  arena_t * arena = arena_create();
+
+  for (i = 0; i < n; ++i)
+  {
+    rtree_t * node = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
+
+    node->label = node_label(tree, i);
+    node->length = tree->has_length[i] ? tree->length[i] : 1;
+
+    if (i)
+    {
+      node->parent = nodes[tree->parent[i]];
+      if (i == tree->child_start[tree->parent[i]])
+        node->parent->left = node;
+      else
+        node->parent->right = node;
+    }
+
+    nodes[i] = node;
+  }
+
+  for (i = n-1; i >= 0; --i)
+    nodes[i]->leaves = nodes[i]->left ?
+                       nodes[i]->left->leaves + nodes[i]->right->leaves : 1;
+
+  rtree_t * root = nodes[0];
+  free(nodes);
+
+  return root;
+}
+
+static utree_t * utree_triplet(arena_t * arena, char * label)
+{
+  utree_t * node = utree_inner_create(arena);
+
+  node->label             = label;
+  node->next->label       = label;
+  node->next->next->label = label;
+
+  return node;
+}
+
+/* Builds the unrooted binary tree of the record, whose root has three
+   children. Each non-root node i is represented by the utree_t facing its
+   parent, and missing lengths are set to 0.1 as in the Newick parsers */
+utree_t * snapshot_tree_utree(const snapshot_tree_t * tree)
+{
+  int i;
+  int n = tree->node_count;
+  utree_t ** nodes = (utree_t **)xmalloc(n * sizeof(utree_t *));
+  arena_t * arena = arena_create();
+
+  nodes[0] = utree_triplet(arena, node_label(tree, 0));
+
+  for (i = 1; i < n; ++i)
+  {
+    utree_t * node;
+    utree_t * slot;
+    int p = tree->parent[i];
+    int k;
+
+    if (tree->child_start[i+1] > tree->child_start[i])
+      node = utree_triplet(arena, node_label(tree, i));
+    else
+    {
+      node = (utree_t *)arena_alloc(arena, sizeof(utree_t));
+      node->label = node_label(tree, i);
+    }
+
+    node->length = tree->has_length[i] ? tree->length[i] : 0.1;
+
+    /* the root uses its own utree_t for the first child, other nodes use
+       the two following ones of the triplet */
+    slot = p ? nodes[p]->next : nodes[p];
+    for (k = tree->child_start[p]; k < i; ++k)
+      slot = slot->next;
+
+    slot->back = node;
+    slot->length = node->length;
+    node->back = slot;
+
+    nodes[i] = node;
+  }
+
+  for (i = n-1; i >= 0; --i)
+  {
+    utree_t * node = nodes[i];
+    utree_t * first = i ? node->next : node;
+    int k;
+
+    if (!node->next)
+      continue;
+
+    node->height = 0;
+    for (k = 0; k < tree->child_start[i+1] - tree->child_start[i]; ++k)
+    {
+      node->height = MAX(node->height, first->back->height + 1);
+      first = first->next;
+    }
+    node->next->height = node->height;
+    node->next->next->height = node->height;
+  }
+
+  utree_t * root = nodes[0];
+  free(nodes);
+
+  return root;
+}
+
+/* Writes the file header of a snapshot */
+void snapshot_write_header(FILE * fp)
+{
+  snapshot_header_t header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    fatal("Unable to write snapshot header");
+}
+
+/* Appends the n-ary tree as a snapshot record */
+void snapshot_write_ntree(FILE * fp, ntree_t * root, int tree_type)
+{
+  int i, j;
+  int n = 0;
+  int alloc = 64;
+  int tip_count = 0;
+  size_t strings_size = 0;
+  record_layout_t layout;
+  snapshot_record_t * record;
+
+  /* number the nodes in breadth-first order; the queue is the list of
+     nodes itself */
+  ntree_t ** queue = (ntree_t **)xmalloc(alloc * sizeof(ntree_t *));
+  queue[n++] = root;
+  for (i = 0; i < n; ++i)
+  {
+    if (n + queue[i]->children_count > alloc)
+    {
+      alloc = 2*alloc + queue[i]->children_count;
+      queue = (ntree_t **)xrealloc(queue, alloc * sizeof(ntree_t *));
+    }
+    for (j = 0; j < queue[i]->children_count; ++j)
+      queue[n++] = queue[i]->children[j];
+
+    if (queue[i]->label)
+      strings_size += strlen(queue[i]->label) + 1;
+    if (!queue[i]->children_count)
+      ++tip_count;
+  }
+
+  record_layout(n, strings_size, &layout);
+
+  char * mem = (char *)xcalloc(1, layout.size);
+  record = (snapshot_record_t *)mem;
+  record->record_size  = layout.size;
+  record->strings_size = strings_size;
+  record->tree_type    = tree_type;
+  record->node_count   = n;
+  record->tip_count    = tip_count;
+
+  double * length = (double *)(mem + layout.length);
+  int * parent = (int *)(mem + layout.parent);
+  int * child_start = (int *)(mem + layout.child_start);
+  unsigned int * label = (unsigned int *)(mem + layout.label);
+  unsigned char * has_length = (unsigned char *)(mem + layout.has_length);
+  char * strings = mem + layout.strings;
+
+  size_t offset = 0;
+  int next_child = 1;
+  parent[0] = -1;
+  for (i = 0; i < n; ++i)
+  {
+    ntree_t * node = queue[i];
+
+    length[i] = node->length;
+    has_length[i] = node->has_length ? 1 : 0;
+
+    child_start[i] = next_child;
+    for (j = 0; j < node->children_count; ++j)
+      parent[next_child++] = i;
+
+    if (node->label)
+    {
+      size_t len = strlen(node->label);
+      memcpy(strings + offset, node->label, len + 1);
+      label[i] = (unsigned int)offset;
+      offset += len + 1;
+    }
+    else
+      label[i] = SNAPSHOT_NOLABEL;
+  }
+  child_start[n] = next_child;
+
+  if (fwrite(mem, layout.size, 1, fp) != 1)
+    fatal("Unable to write snapshot record");
+
+  free(mem);
+  free(queue);
+}
+
+/* Appends a flat tree as a snapshot record, numbering its nodes in
+   breadth-first order like snapshot_write_ntree() */
+void snapshot_write_ftree(FILE * fp, const ftree_t * tree)
+{
+  int i, c;
+  int n = tree->node_count;
+  size_t strings_size = 0;
+  record_layout_t layout;
+  snapshot_record_t * record;
+
+  int * queue = (int *)xmalloc(n * sizeof(int));
+  int tail = 0;
+
+  queue[tail++] = tree->root;
+  for (i = 0; i < n; ++i)
+  {
+    for (c = tree->left[queue[i]]; c != -1; c = tree->sibling[c])
+      queue[tail++] = c;
+
+    if (tree->taxon[queue[i]] != -1)
+      strings_size += strlen(label_string(tree->taxon[queue[i]])) + 1;
+  }
+
+  record_layout(n, strings_size, &layout);
+
+  char * mem = (char *)xcalloc(1, layout.size);
+  record = (snapshot_record_t *)mem;
+  record->record_size  = layout.size;
+  record->strings_size = strings_size;
+  record->tree_type    = tree->tree_type;
+  record->node_count   = n;
+  record->tip_count    = tree->tip_count;
+
+  double * length = (double *)(mem + layout.length);
+  int * parent = (int *)(mem + layout.parent);
+  int * child_start = (int *)(mem + layout.child_start);
+  unsigned int * label = (unsigned int *)(mem + layout.label);
+  unsigned char * has_length = (unsigned char *)(mem + layout.has_length);
+  char * strings = mem + layout.strings;
+
+  size_t offset = 0;
+  int next_child = 1;
+  parent[0] = -1;
+  for (i = 0; i < n; ++i)
+  {
+    int node = queue[i];
+
+    length[i] = FTREE_LENGTH(tree, node);
+    has_length[i] = FTREE_HAS_LENGTH(tree, node);
+
+    child_start[i] = next_child;
+    for (c = tree->left[node]; c != -1; c = tree->sibling[c])
+      parent[next_child++] = i;
+
+    if (tree->taxon[node] != -1)
+    {
+      const char * s = label_string(tree->taxon[node]);
+      size_t len = strlen(s);
+
+      memcpy(strings + offset, s, len + 1);
+      label[i] = (unsigned int)offset;
+      offset += len + 1;
+    }
+    else
+      label[i] = SNAPSHOT_NOLABEL;
+  }
+  child_start[n] = next_child;
+
+  if (fwrite(mem, layout.size, 1, fp) != 1)
+    fatal("Unable to write snapshot record");
+
+  free(mem);
+  free(queue);
+}
+
+void cmd_export_snapshot(void)
+{
+  FILE * out;
+  int tree_type;
+  ntree_t * ntree;
+
+  if (!opt_outfile)
+    fatal("--export_snapshot requires --output_file");
+
+  out = xopen(opt_outfile, "w");
+
+  if (!opt_quiet)
+    fprintf(stdout, "Parsing tree file...\n");
+
+  forest_open_ntree(opt_treefile);
+
+  snapshot_write_header(out);
+
+  if (opt_compact)
+  {
+    ftree_t * tree;
+
+    while ((tree = forest_next_ftree()))
+    {
+      snapshot_write_ftree(out, tree);
+      ftree_destroy(tree);
+    }
+  }
+  else
+  {
+    while ((ntree = forest_next_ntree(&tree_type)))
+    {
+      snapshot_write_ntree(out, ntree, tree_type);
+      ntree_destroy(ntree);
+    }
+  }
+
+  forest_close();
+
+  if (!opt_quiet)
+    fprintf(stdout, "Snapshot written to %s\n", opt_outfile);
+
+  fclose(out);
+}
+
+void cmd_export_newick(void)
+{
+  FILE * out;
+  writer_t * w;
+  int tree_type;
+  ntree_t * ntree;
+
+  out = opt_outfile ? xopen(opt_outfile, "w") : stdout;
+  w = writer_open(out);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Parsing tree file...\n");
+
+  forest_open_ntree(opt_treefile);
+
+  if (opt_compact)
+  {
+    ftree_t * tree;
+
+    while ((tree = forest_next_ftree()))
+    {
+      ftree_stream_newick(w, tree);
+      ftree_destroy(tree);
+    }
+  }
+  else
+  {
+    while ((ntree = forest_next_ntree(&tree_type)))
+    {
+      ntree_stream_newick(w, ntree);
+      ntree_destroy(ntree);
+    }
+  }
+
+  forest_close();
+  writer_close(w);
+
+  if (opt_outfile)
+    fclose(out);
+}
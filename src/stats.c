@@ -66,7 +66,7 @@ void stats(double * values, int count,
   if (count % 2)
     *median = values[count/2];
   else
-    *median = (values[count/2] + values[count/2+1])/2;
+    *median = (values[count/2-1] + values[count/2])/2;
 
   /* variance */
   for (i=0; i<count; ++i)
@@ -68,6 +68,10 @@ void cmd_subtree_short()
   int inner_list_count = 0;
   int tip_list_count = 0;
   int i,j;
+  int tip_count;
+  int tree_type;
+  rtree_t * rtree;
+  utree_t * utree;
 
   /* attempt to open output file */
   out = opt_outfile ?
@@ -77,36 +81,42 @@ void cmd_subtree_short()
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
-  if (!rtree)
-    fatal("Error: --subtree_short is only implemented for rooted trees");
+  forest_open(opt_treefile);
 
   fprintf(stdout, "Printing largest subtrees made of branch-lengths smaller "
                   "or equal to %.17f\n", opt_subtree_short);
 
-  /* get inner nodes that are roots of of the largest short subtrees. Short are such subtrees
-     where all branch lengths within them are less or equal to opt_subtree_short. The largest
-     such subtrees are those that are not subtrees of short subtrees. */
-  inner_node_list = (rtree_t **)xmalloc((rtree->leaves-1)*sizeof(rtree_t *));
-  inner_list_count = rtree_traverse_postorder(rtree, cb_short_trees, inner_node_list);
-
-  /* traverse the roots and grab the tips */
-  tip_node_list = (rtree_t **)xmalloc((rtree->leaves)*sizeof(rtree_t *));
-  for (i = 0; i < inner_list_count; ++i)
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
   {
-    tip_list_count = rtree_query_tipnodes(inner_node_list[i], tip_node_list);
-    fprintf(stdout, "Subtree %d\n", i+1);
-    for (j = 0; j < tip_list_count; ++j)
+    if (tree_type != TREE_ROOTED)
+      fatal("Error: --subtree_short is only implemented for rooted trees");
+
+    /* get inner nodes that are roots of of the largest short subtrees. Short are such subtrees
+       where all branch lengths within them are less or equal to opt_subtree_short. The largest
+       such subtrees are those that are not subtrees of short subtrees. */
+    inner_node_list = (rtree_t **)xmalloc((rtree->leaves-1)*sizeof(rtree_t *));
+    inner_list_count = rtree_traverse_postorder(rtree, cb_short_trees, inner_node_list);
+
+    /* traverse the roots and grab the tips */
+    tip_node_list = (rtree_t **)xmalloc((rtree->leaves)*sizeof(rtree_t *));
+    for (i = 0; i < inner_list_count; ++i)
     {
-      fprintf(stdout, "\t%s\n", tip_node_list[j]->label);
+      tip_list_count = rtree_query_tipnodes(inner_node_list[i], tip_node_list);
+      fprintf(stdout, "Subtree %d\n", i+1);
+      for (j = 0; j < tip_list_count; ++j)
+      {
+        fprintf(stdout, "\t%s\n", tip_node_list[j]->label);
+      }
     }
-  }
 
-  free(inner_node_list);
-  free(tip_node_list);
+    free(inner_node_list);
+    free(tip_node_list);
+
+    /* deallocate tree structure */
+    rtree_destroy(rtree);
+  }
 
-  /* deallocate tree structure */
-  rtree_destroy(rtree);
+  forest_close();
 
   if (!opt_quiet)
     fprintf(stdout, "Done...\n");
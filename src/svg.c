@@ -36,6 +36,7 @@ double canvas_height;
 double canvas_width;
 
 static int tip_count;
+static int tip_occ = 0;
 
 typedef struct coord_s 
 {
@@ -43,37 +44,61 @@ typedef struct coord_s
   double y;
 } coord_t; 
 
-static coord_t * create_coord(double x, double y)
+/* the coordinates of a node are allocated from the arena of its tree, and
+   are freed when the tree is destroyed */
+static coord_t * create_coord(const void * node, double x, double y)
 {
-  coord_t * coord = (coord_t *)xmalloc(sizeof(coord_t));
+  coord_t * coord = (coord_t *)arena_alloc(arena_of(node), sizeof(coord_t));
   coord->x = x;
   coord->y = y;
   return coord;
 }
 
+/* Formats a number with format_double(). Results are kept in a small ring
+   of buffers, such that one fprintf call can use up to SVG_NUMBER_SLOTS of
+   them */
+#define SVG_NUMBER_SLOTS 8
+
+static const char * svg_number(double x, int precision)
+{
+  static char buffer[SVG_NUMBER_SLOTS][FORMAT_BUFFER_SIZE];
+  static int slot = 0;
+
+  slot = (slot + 1) % SVG_NUMBER_SLOTS;
+  format_double(buffer[slot], FORMAT_BUFFER_SIZE, x, precision);
+
+  return buffer[slot];
+}
+
+/* coordinates are written with six decimals, as with %f */
+#define COORD(x) svg_number(x, 6)
+
 static void svg_line(double x1, double y1, double x2, double y2, double stroke_width)
 {
   fprintf(svg_fp,
-          "<line x1=\"%f\" y1=\"%f\" x2=\"%f\" y2=\"%f\" "
-          "stroke=\"#31a354\" stroke-width=\"%f\" />\n",
-          x1, y1, x2, y2, stroke_width);
+          "<line x1=\"%s\" y1=\"%s\" x2=\"%s\" y2=\"%s\" "
+          "stroke=\"#31a354\" stroke-width=\"%s\" />\n",
+          COORD(x1), COORD(y1), COORD(x2), COORD(y2), COORD(stroke_width));
 }
 
 static void svg_circle(double cx, double cy, double r)
 {
   fprintf(svg_fp,
-          "<circle cx=\"%f\" cy=\"%f\" r=\"%f\" fill=\"#31a354\" "
+          "<circle cx=\"%s\" cy=\"%s\" r=\"%s\" fill=\"#31a354\" "
           "stroke=\"#31a354\" />\n",
-          cx, cy, r);
+          COORD(cx), COORD(cy), COORD(r));
 }
 
-static void utree_set_xcoord(utree_t * node)
+/* sets the x coordinate of a node from that of its parent, which is set
+   already as nodes are visited in preorder. Always returns 1, such that it
+   can be given as the visitor of a traversal */
+static int utree_node_xcoord(utree_t * node)
 {
   utree_t * parent = NULL;
 
   /* create the coordinate info of the node's scaled branch length (edge
      towards root) */
-  coord_t * coord = create_coord(node->length * scaler, 0);
+  coord_t * coord = create_coord(node, node->length * scaler, 0);
   node->data = (void *)coord;
   
   /* now set this info to all nodes in the round-about structure */
@@ -93,21 +118,34 @@ static void utree_set_xcoord(utree_t * node)
   else
     coord->x = opt_svg_marginleft;
 
-  if (!node->next) 
-    return;
-  
-  /* recursively set coordinates of the other nodes in a pre-order fashion */
-  utree_set_xcoord(node->next->back);
-  utree_set_xcoord(node->next->next->back);
-  if (!parent)
-    utree_set_xcoord(node->back);
+  return 1;
 }
 
-static void rtree_set_xcoord(rtree_t * node)
+static void utree_set_xcoord(utree_t * root)
+{
+  trav_stack_t stack = {NULL, 0, 0};
+
+  /* set coordinates in a pre-order fashion, starting from the root and
+     continuing with the subtree behind it if the root has no parent */
+  TRAVERSE_BINARY(&stack, utree_t, root, node,
+                  !node->next, node->next->back, node->next->next->back,
+                  utree_node_xcoord(node),
+                  );
+
+  if (root->next && root->back->height <= root->height)
+    TRAVERSE_BINARY(&stack, utree_t, root->back, node,
+                    !node->next, node->next->back, node->next->next->back,
+                    utree_node_xcoord(node),
+                    );
+
+  trav_stack_free(&stack);
+}
+
+static int rtree_node_xcoord(rtree_t * node)
 {
   /* create the coordinate info of the node's scaled branch length (edge
      towards root) */
-  coord_t * coord = create_coord(node->length * scaler, 0);
+  coord_t * coord = create_coord(node, node->length * scaler, 0);
   node->data = (void *)coord;
 
   /* if the node has a parent then add the x coord of the parent such that
@@ -122,32 +160,31 @@ static void rtree_set_xcoord(rtree_t * node)
     coord->x += opt_svg_marginleft;
   }
 
-  if (!node->left) 
-    return;
-  
-  /* recursively set coordinates of the other nodes in a pre-order fashion */
-  rtree_set_xcoord(node->left);
-  rtree_set_xcoord(node->right);
+  return 1;
+}
+
+static void rtree_set_xcoord(rtree_t * root)
+{
+  trav_stack_t stack = {NULL, 0, 0};
+
+  /* set coordinates of the nodes in a pre-order fashion */
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  rtree_node_xcoord(node),
+                  );
+
+  trav_stack_free(&stack);
 }
 
-static void svg_utree_plot(utree_t * node)
+/* draws a node once its children are drawn */
+static void svg_utree_plot_node(utree_t * node)
 {
   double y;
-  static int tip_occ = 0;
   utree_t * parent = NULL;
 
   if (node->back->height > node->height)
     parent = node->back;
 
-  if (node->next)
-  {
-    svg_utree_plot(node->next->back);
-    svg_utree_plot(node->next->next->back);
-    if (!parent)
-      svg_utree_plot(node->back);
-      
-  }
-
   if (parent)
   {
     double x,px;
@@ -188,10 +225,10 @@ static void svg_utree_plot(utree_t * node)
 
     if (!node->next)
     {
-      fprintf(svg_fp, "<text x=\"%f\" y=\"%f\" "
+      fprintf(svg_fp, "<text x=\"%s\" y=\"%s\" "
                       "font-size=\"%ld\" font-family=\"Arial;\">%s</text>\n",
-              x+5,
-              y+opt_svg_fontsize/3.0,
+              COORD(x+5),
+              COORD(y+opt_svg_fontsize/3.0),
               opt_svg_fontsize,
               node->label);
     }
@@ -216,18 +253,37 @@ static void svg_utree_plot(utree_t * node)
   }
 }
 
-static void svg_rtree_plot(rtree_t * node)
+static void svg_utree_plot(utree_t * root)
 {
-  double y;
-  static int tip_occ = 0;
+  trav_stack_t stack = {NULL, 0, 0};
+  utree_t * subtree[3];
+  int count = 0;
+  int i;
 
-  /* traverse tree in post-order */
-  if (node->left)
+  /* traverse tree in post-order, where a root without parent has the subtree
+     behind it as third child */
+  if (root->next)
   {
-    svg_rtree_plot(node->left);
-    svg_rtree_plot(node->right);
+    subtree[count++] = root->next->back;
+    subtree[count++] = root->next->next->back;
+    if (root->back->height <= root->height)
+      subtree[count++] = root->back;
   }
 
+  for (i = 0; i < count; ++i)
+    TRAVERSE_BINARY(&stack, utree_t, subtree[i], node,
+                    !node->next, node->next->back, node->next->next->back,
+                    1,
+                    svg_utree_plot_node(node));
+
+  trav_stack_free(&stack);
+  svg_utree_plot_node(root);
+}
+
+static void svg_rtree_plot_node(rtree_t * node)
+{
+  double y;
+
   if (node->parent)
   {
     double x,px;
@@ -267,10 +323,10 @@ static void svg_rtree_plot(rtree_t * node)
 
     if (!node->left)
     {
-      fprintf(svg_fp, "<text x=\"%f\" y=\"%f\" "
+      fprintf(svg_fp, "<text x=\"%s\" y=\"%s\" "
                       "font-size=\"%ld\" font-family=\"Arial;\">%s</text>\n",
-              x+5,
-              y+opt_svg_fontsize/3.0,
+              COORD(x+5),
+              COORD(y+opt_svg_fontsize/3.0),
               opt_svg_fontsize,
               node->label);
     }
@@ -302,6 +358,19 @@ static void svg_rtree_plot(rtree_t * node)
   }
 }
 
+static void svg_rtree_plot(rtree_t * root)
+{
+  trav_stack_t stack = {NULL, 0, 0};
+
+  /* traverse tree in post-order */
+  TRAVERSE_BINARY(&stack, rtree_t, root, node,
+                  !node->left, node->left, node->right,
+                  1,
+                  svg_rtree_plot_node(node));
+
+  trav_stack_free(&stack);
+}
+
 static void utree_scaler_init(utree_t * root, int tip_count)
 {
   double len = 0;
@@ -432,11 +501,12 @@ void svg_utree_init(utree_t * root, int tip_count)
              10,
              3);
 
-    fprintf(svg_fp, "<text x=\"%f\" y=\"%f\" font-size=\"%ld\" "
-            "font-family=\"Arial;\">%.*f</text>\n",
-            (canvas_width - max_font_len)*opt_svg_legend_ratio + opt_svg_marginleft + 5,
-            20-opt_svg_fontsize/3.0,
-            (long)opt_svg_fontsize, opt_precision, max_tree_len * opt_svg_legend_ratio);
+    fprintf(svg_fp, "<text x=\"%s\" y=\"%s\" font-size=\"%ld\" "
+            "font-family=\"Arial;\">%s</text>\n",
+            COORD((canvas_width - max_font_len)*opt_svg_legend_ratio + opt_svg_marginleft + 5),
+            COORD(20-opt_svg_fontsize/3.0),
+            (long)opt_svg_fontsize,
+            svg_number(max_tree_len * opt_svg_legend_ratio, opt_precision));
   }
 
   /* uncomment to print a dashed border to indicate margins */
@@ -490,11 +560,12 @@ void svg_rtree_init(rtree_t * root)
              10,
              3);
 
-    fprintf(svg_fp, "<text x=\"%f\" y=\"%f\" font-size=\"%ld\" "
-            "font-family=\"Arial;\">%.*f</text>\n",
-            (canvas_width - max_font_len)*opt_svg_legend_ratio + opt_svg_marginleft + 5,
-            20-opt_svg_fontsize/3.0,
-            (long)opt_svg_fontsize, opt_precision, max_tree_len * opt_svg_legend_ratio);
+    fprintf(svg_fp, "<text x=\"%s\" y=\"%s\" font-size=\"%ld\" "
+            "font-family=\"Arial;\">%s</text>\n",
+            COORD((canvas_width - max_font_len)*opt_svg_legend_ratio + opt_svg_marginleft + 5),
+            COORD(20-opt_svg_fontsize/3.0),
+            (long)opt_svg_fontsize,
+            svg_number(max_tree_len * opt_svg_legend_ratio, opt_precision));
   }
 
   /* uncomment to print a dashed border to indicate margins */
@@ -517,10 +588,43 @@ void svg_rtree_init(rtree_t * root)
 }
 
 
+/* the first tree is written to the specified output file, while each of the
+   following trees of a multi-tree file is written to a separate file whose
+   name is the output file name suffixed with the tree number, i.e. for
+   out.svg we get out.svg, out_2.svg, out_3.svg, ... */
+static char * svg_filename(long tree_index)
+{
+  char * filename;
+  char * ext;
+
+  if (tree_index == 1)
+    return xstrdup(opt_outfile);
+
+  ext = strrchr(opt_outfile, '.');
+  if (ext && !strchr(ext, '/'))
+    asprintf(&filename, "%.*s_%ld%s", (int)(ext - opt_outfile), opt_outfile,
+                                      tree_index, ext);
+  else
+    asprintf(&filename, "%s_%ld", opt_outfile, tree_index);
+
+  return filename;
+}
+
+static void svg_reset(void)
+{
+  scaler = 0;
+  max_font_len = 0;
+  max_tree_len = 0;
+  tip_occ = 0;
+}
+
 void cmd_svg(void)
 {
-  utree_t * utree = NULL;
+  rtree_t * rtree;
+  utree_t * utree;
   int tip_count;
+  int tree_type;
+  long tree_count = 0;
 
   if (!opt_outfile)
     fatal("An output file must be specified");
@@ -529,43 +633,50 @@ void cmd_svg(void)
   if (!opt_quiet)
     fprintf(stdout, "Parsing tree file...\n");
 
-  rtree_t * rtree = rtree_parse_newick(opt_treefile);
+  forest_open(opt_treefile);
 
-  if (!rtree)
+  while ((tree_type = forest_next(&rtree, &utree, &tip_count, NULL)))
   {
-    utree = utree_parse_newick(opt_treefile, &tip_count);
-    if (!utree)
+    if (tree_type == TREE_UNROOTED)
+    {
+      if (!opt_quiet)
+        fprintf(stdout, "Loaded unrooted tree...\n");
+    }
+    else if (tree_type == TREE_ROOTED)
+    {
+      if (!opt_quiet)
+        fprintf(stdout, "Loaded rooted tree...\n");
+    }
+    else
       fatal("Tree is neither unrooted nor rooted. Go fix your tree.");
-     
-    if (!opt_quiet)
-      fprintf(stdout, "Loaded unrooted tree...\n");
-  }
-  else
-  {
+
+    char * filename = svg_filename(++tree_count);
+
     if (!opt_quiet)
-      fprintf(stdout, "Loaded rooted tree...\n");
-  }
-  
-  if (!opt_quiet)
-    printf("Creating SVG...\n");
+      printf("Creating SVG...\n");
 
-  svg_fp = fopen(opt_outfile, "w");
-  if (!svg_fp)
-    fatal("Cannot write to file %s", opt_outfile);
+    svg_fp = fopen(filename, "w");
+    if (!svg_fp)
+      fatal("Cannot write to file %s", filename);
 
+    svg_reset();
 
-  if (rtree)
-    svg_rtree_init(rtree);
-  else
-    svg_utree_init(utree, tip_count);
+    if (rtree)
+      svg_rtree_init(rtree);
+    else
+      svg_utree_init(utree, tip_count);
 
-  fclose(svg_fp);
+    fclose(svg_fp);
+    free(filename);
 
-  /* deallocate tree structure */
-  if (utree)
-    utree_destroy(utree);
-  else
-    rtree_destroy(rtree);
+    /* deallocate tree structure */
+    if (utree)
+      utree_destroy(utree);
+    else
+      rtree_destroy(rtree);
+  }
+
+  forest_close();
 
   if (!opt_quiet)
     fprintf(stdout, "\nDone...\n");
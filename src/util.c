@@ -150,7 +150,14 @@ void show_rusage()
 
 FILE * xopen(const char * filename, const char * mode)
 {
-  FILE * out = fopen(filename, mode);
+  size_t len = strlen(filename);
+  FILE * out;
+
+  /* files written with the .gz extension are compressed */
+  if (*mode == 'w' && len > 3 && !strcmp(filename + len - 3, ".gz"))
+    out = writer_fopen_gzip(filename);
+  else
+    out = fopen(filename, mode);
   if (!out)
     fatal("Cannot open file %s", opt_outfile);
 
@@ -177,3 +184,18 @@ void shuffle(void * array, size_t n, size_t size)
 
   free(tmp);
 }
+
+/* grows the stack of an iterative traversal, which starts out empty */
+void trav_stack_grow(trav_stack_t * s)
+{
+  s->alloc = s->alloc ? 2*s->alloc : 64;
+  s->frames = (trav_frame_t *)xrealloc(s->frames,
+                                       s->alloc * sizeof(trav_frame_t));
+}
+
+void trav_stack_free(trav_stack_t * s)
+{
+  free(s->frames);
+  s->frames = NULL;
+  s->top = s->alloc = 0;
+}
@@ -28,21 +28,52 @@
 
 static int indend_space = 4;
 
+/* Allocates the three records of an inner node next to each other and links
+   them into a ring, such that going around the node stays within one block
+   of memory */
+utree_t * utree_inner_create(arena_t * arena)
+{
+  utree_t * node = (utree_t *)arena_alloc(arena, 3 * sizeof(utree_t));
+
+  node[0].next = node + 1;
+  node[1].next = node + 2;
+  node[2].next = node;
+
+  return node;
+}
+
+/* Deallocates the tree. All its nodes come from the same arena, which is
+   freed as a whole, so any node of the tree may be passed */
+void utree_destroy(utree_t * root)
+{
+  if (root)
+    arena_destroy(arena_of(root));
+}
+
 static void print_node_info(FILE * stream, utree_t * tree)
 {
+  char length[FORMAT_BUFFER_SIZE];
+
+  format_double(length, FORMAT_BUFFER_SIZE, tree->length, 6);
+
   fprintf(stream," %s", tree->label);
-  fprintf(stream," %f", tree->length);
+  fprintf(stream," %s", length);
   fprintf(stream,"\n");
 }
 
-static void print_tree_recurse(FILE * stream,
-                               utree_t * tree, 
-                               int indend_level, 
-                               int * active_node_order)
+/* Prints a node of --tree_show, below the lines of the subtrees that are
+   still open at smaller depths. The three subtrees around the root start
+   at depth 1, and the active order of their lines is set by the caller */
+static int print_tree_node(FILE * stream,
+                           utree_t * tree,
+                           const trav_stack_t * stack,
+                           int * active_node_order)
 {
   int i,j;
+  int indend_level = stack->top;
 
-  if (!tree) return;
+  if (indend_level > 1)
+    active_node_order[indend_level-1] = stack->frames[stack->top-2].child;
 
   for (i = 0; i < indend_level; ++i)
   {
@@ -77,125 +108,53 @@ static void print_tree_recurse(FILE * stream,
   if (active_node_order[indend_level-1] == 2) 
     active_node_order[indend_level-1] = 0;
 
-  if (tree->next)
-  {
-    active_node_order[indend_level] = 1;
-    print_tree_recurse(stream,
-                       tree->next->back,
-                       indend_level+1,
-                       active_node_order);
-    active_node_order[indend_level] = 2;
-    print_tree_recurse(stream,
-                       tree->next->next->back, 
-                       indend_level+1,
-                       active_node_order);
-  }
-
+  return 1;
 }
 
-static int tree_indend_level(utree_t * tree, int indend)
+/* returns one more than the number of nodes on the longest path from the
+   root of a subtree */
+static int tree_indend_level(utree_t * tree, trav_stack_t * stack)
 {
-  if (!tree->next) return indend+1;
+  int indend = 0;
 
-  int a = tree_indend_level(tree->next->back,       indend+1);
-  int b = tree_indend_level(tree->next->next->back, indend+1);
+  TRAVERSE_BINARY(stack, utree_t, tree, node,
+                  !node->next, node->next->back, node->next->next->back,
+                  1,
+                  indend = MAX(indend, stack->top + 1));
 
-  return (a > b ? a : b);
+  return indend;
 }
 
 void utree_show_ascii(FILE * stream, utree_t * tree)
 {
-  int a, b;
-  
-  a = tree_indend_level(tree->back,1);
-  b = tree_indend_level(tree,0);
-  int max_indend_level = (a > b ? a : b);
+  int i;
+  trav_stack_t stack = {NULL, 0, 0};
+  utree_t * subtree[3] = {tree->back, tree->next->back, tree->next->next->back};
+  int max_indend_level = 0;
 
+  for (i = 0; i < 3; ++i)
+    max_indend_level = MAX(max_indend_level,
+                           tree_indend_level(subtree[i], &stack));
 
   int * active_node_order = (int *)xmalloc((max_indend_level+1) * sizeof(int));
-  active_node_order[0] = 1;
-  active_node_order[1] = 1;
-
-  print_tree_recurse(stream,tree->back,             1, active_node_order);
-  print_tree_recurse(stream,tree->next->back,       1, active_node_order);
-  active_node_order[0] = 2;
-  print_tree_recurse(stream,tree->next->next->back, 1, active_node_order);
-  free(active_node_order);
-}
-
-static char * newick_utree_recurse(utree_t * root)
-{
-  char * newick;
 
-  if (!root->next)
-    asprintf(&newick, "%s:%f", root->label, root->length);
-  else
+  for (i = 0; i < 3; ++i)
   {
-    char * subtree1 = newick_utree_recurse(root->next->back);
-    char * subtree2 = newick_utree_recurse(root->next->next->back);
-
-    asprintf(&newick, "(%s,%s)%s:%f", subtree1,
-                                      subtree2,
-                                      root->label ? root->label : "",
-                                      root->length);
-    free(subtree1);
-    free(subtree2);
+    active_node_order[0] = i < 2 ? 1 : 2;
+    TRAVERSE_BINARY(&stack, utree_t, subtree[i], node,
+                    !node->next, node->next->back, node->next->next->back,
+                    print_tree_node(stream, node, &stack, active_node_order),
+                    );
   }
-
-  return newick;
-}
-
-char * utree_export_newick(utree_t * root)
-{
-  char * newick;
-
-  if (!root) return NULL;
-
-  char * subtree1 = newick_utree_recurse(root->back);
-  char * subtree2 = newick_utree_recurse(root->next->back);
-  char * subtree3 = newick_utree_recurse(root->next->next->back);
-
-  asprintf(&newick, "(%s,%s,%s)%s:%f;", subtree1,
-                                        subtree2,
-                                        subtree3,
-                                        root->label ? root->label : "",
-                                        root->length);
-  free(subtree1);
-  free(subtree2);
-  free(subtree3);
-
-  return (newick);
-
-}
-
-static void utree_traverse_recursive(utree_t * node,
-                                     int (*cbtrav)(utree_t *),
-                                     int * index,
-                                     utree_t ** outbuffer)
-{
-  if (!node->next)
-  {
-    if (cbtrav(node))
-    {
-      outbuffer[*index] = node;
-      *index = *index + 1;
-    }
-    return;
-  }
-  if (!cbtrav(node))
-    return;
-
-  utree_traverse_recursive(node->next->back, cbtrav, index, outbuffer);
-  utree_traverse_recursive(node->next->next->back, cbtrav, index, outbuffer);
-
-  outbuffer[*index] = node;
-  *index = *index + 1;
+  trav_stack_free(&stack);
+  free(active_node_order);
 }
 
 int utree_traverse(utree_t * root,
                    int (*cbtrav)(utree_t *),
                    utree_t ** outbuffer)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   int index = 0;
 
   if (!root->next) return -1;
@@ -211,9 +170,14 @@ int utree_traverse(utree_t * root,
      at each node the callback function is called to decide whether we
      are going to traversing the subtree rooted at the specific node */
 
-  utree_traverse_recursive(root->back, cbtrav, &index, outbuffer);
-  utree_traverse_recursive(root, cbtrav, &index, outbuffer);
+  /* root waits on the stack until the subtree of 1 has been traversed */
+  TRAV_PUSH(&stack, root);
+  TRAVERSE_BINARY(&stack, utree_t, root->back, node,
+                  !node->next, node->next->back, node->next->next->back,
+                  cbtrav(node),
+                  outbuffer[index++] = node);
 
+  trav_stack_free(&stack);
   return index;
 }
 
@@ -245,80 +209,60 @@ int utree_query_branch_lengths(utree_t * node, double * outbuffer, int node_coun
 }
 
 
-static void utree_query_tipnodes_recursive(utree_t * node,
-                                           utree_t ** node_list,
-                                           int * index)
-{
-  if (!node->next)
-  {
-    node_list[*index] = node;
-    *index = *index + 1;
-    return;
-  }
-
-  utree_query_tipnodes_recursive(node->next->back, node_list, index);
-  utree_query_tipnodes_recursive(node->next->next->back, node_list, index);
-}
-
 int utree_query_tipnodes(utree_t * root,
                          utree_t ** node_list)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   int index = 0;
+  int i;
 
   if (!root) return 0;
 
   if (!root->next) root = root->back;
 
-  utree_query_tipnodes_recursive(root->back, node_list, &index);
-
-  utree_query_tipnodes_recursive(root->next->back, node_list, &index);
-  utree_query_tipnodes_recursive(root->next->next->back, node_list, &index);
+  /* the three subtrees around root, one after the other */
+  for (i = 0; i < 3; ++i, root = root->next)
+    TRAVERSE_BINARY(&stack, utree_t, root->back, node,
+                    !node->next, node->next->back, node->next->next->back,
+                    1,
+                    if (!node->next) node_list[index++] = node);
 
+  trav_stack_free(&stack);
   return index;
 }
 
-static void utree_query_innernodes_recursive(utree_t * node,
-                                             utree_t ** node_list,
-                                             int * index)
-{
-  if (!node->next) return;
-
-  /* postorder traversal */
-
-  utree_query_innernodes_recursive(node->next->back, node_list, index);
-  utree_query_innernodes_recursive(node->next->next->back, node_list, index);
-
-  node_list[*index] = node;
-  *index = *index + 1;
-  return;
-}
-
 int utree_query_innernodes(utree_t * root,
                            utree_t ** node_list)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   int index = 0;
+  int i;
 
   if (!root) return 0;
   if (!root->next) root = root->back;
 
-  utree_query_innernodes_recursive(root->back, node_list, &index);
-
-  utree_query_innernodes_recursive(root->next->back, node_list, &index);
-  utree_query_innernodes_recursive(root->next->next->back, node_list, &index);
+  /* postorder traversal of the three subtrees, and root last */
+  for (i = 0; i < 3; ++i, root = root->next)
+    TRAVERSE_BINARY(&stack, utree_t, root->back, node,
+                    !node->next, node->next->back, node->next->next->back,
+                    node->next,
+                    node_list[index++] = node);
+  trav_stack_free(&stack);
 
   node_list[index++] = root;
 
   return index;
 }
 
-static rtree_t * utree_rtree(utree_t * unode)
+/* creates the rooted node of unode, whose children were created before it
+   and are the two topmost subtrees on the stack built */
+static void utree_rtree_node(arena_t * arena,
+                             utree_t * unode,
+                             trav_stack_t * built)
 {
-  rtree_t * rnode = (rtree_t *)xmalloc(sizeof(rtree_t)); 
+  rtree_t * rnode = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
 
-  if (unode->label)
-    rnode->label = strdup(unode->label);
-  else
-    rnode->label = NULL;
+  rnode->label = unode->label;
   rnode->length = unode->length;
   rnode->data = NULL;
 
@@ -326,15 +270,34 @@ static rtree_t * utree_rtree(utree_t * unode)
   {
     rnode->left = NULL;
     rnode->right = NULL;
-    return rnode;
   }
+  else
+  {
+    rnode->right = (rtree_t *)built->frames[--built->top].node;
+    rnode->left = (rtree_t *)built->frames[--built->top].node;
 
-  rnode->left = utree_rtree(unode->next->back);
-  rnode->right = utree_rtree(unode->next->next->back);
+    rnode->left->parent = rnode;
+    rnode->right->parent = rnode;
+  }
 
-  rnode->left->parent = rnode;
-  rnode->right->parent = rnode;
+  TRAV_PUSH(built, rnode);
+}
 
+static rtree_t * utree_rtree(arena_t * arena, utree_t * unode)
+{
+  trav_stack_t stack = {NULL, 0, 0};
+  trav_stack_t built = {NULL, 0, 0};
+  rtree_t * rnode;
+
+  TRAVERSE_BINARY(&stack, utree_t, unode, node,
+                  !node->next, node->next->back, node->next->next->back,
+                  1,
+                  utree_rtree_node(arena, node, &built));
+
+  rnode = (rtree_t *)built.frames[0].node;
+
+  trav_stack_free(&stack);
+  trav_stack_free(&built);
   return rnode;
 }
 
@@ -376,51 +339,53 @@ static utree_t * find_outgroup_node(utree_t ** node_list, char * outgroup_list,
   return node_list[i];
 }
 
-static int outgroup_node_recursive(utree_t * node, utree_t ** outgroup)
+/* sets the mark of an inner node to whether its subtree has marked tips,
+   given the marks of its two children */
+static void outgroup_node_mark(utree_t * node, utree_t ** outgroup)
 {
-  int outgroup_left, outgroup_right;
-
-  if (!node->next)
-  {
-    return node->mark;
-  }
-
-  outgroup_left  = outgroup_node_recursive(node->next->back, outgroup);
-  outgroup_right = outgroup_node_recursive(node->next->next->back, outgroup);
+  int outgroup_left  = node->next->back->mark;
+  int outgroup_right = node->next->next->back->mark;
 
   if (outgroup_left && outgroup_right)
   {
     if (outgroup_left == SUBTREE_MIXED_MARKED || outgroup_right == SUBTREE_MIXED_MARKED)
-      return SUBTREE_MIXED_MARKED;
+      node->mark = SUBTREE_MIXED_MARKED;
     else
-      return SUBTREE_FULLY_MARKED;
+      node->mark = SUBTREE_FULLY_MARKED;
   }
   else if (outgroup_left && !outgroup_right)
   {
     assert(outgroup_left == SUBTREE_FULLY_MARKED);
     assert(!(*outgroup));
     *outgroup = node->next->next;
-    return SUBTREE_MIXED_MARKED;
+    node->mark = SUBTREE_MIXED_MARKED;
   }
   else if (outgroup_right && !outgroup_left)
   {
     assert(outgroup_right == SUBTREE_FULLY_MARKED);
     assert(!(*outgroup));
     *outgroup = node->next;
-    return SUBTREE_MIXED_MARKED;
+    node->mark = SUBTREE_MIXED_MARKED;
   }
-
-  return SUBTREE_NON_MARKED;
+  else
+    node->mark = SUBTREE_NON_MARKED;
 }
 
 utree_t * outgroup_node(utree_t * node)
 {
+  trav_stack_t stack = {NULL, 0, 0};
   utree_t * outgroup = NULL;
 
   assert(node->next);
 
-  assert(outgroup_node_recursive(node, &outgroup) == SUBTREE_MIXED_MARKED);
+  /* tips keep their marks, and inner nodes are marked in postorder */
+  TRAVERSE_BINARY(&stack, utree_t, node, inner,
+                  !inner->next, inner->next->back, inner->next->next->back,
+                  1,
+                  if (inner->next) outgroup_node_mark(inner, &outgroup));
+  trav_stack_free(&stack);
 
+  assert(node->mark == SUBTREE_MIXED_MARKED);
 
   return outgroup;
 }
@@ -498,9 +463,11 @@ rtree_t * utree_convert_rtree(utree_t * root, int tip_count, char * outgroup_lis
   else
     outgroup = find_outgroup_mrca(node_list, root, outgroup_list, tip_count);
 
-  rtree_t * rnode = (rtree_t *)xmalloc(sizeof(rtree_t));
-  rnode->left = utree_rtree(outgroup);
-  rnode->right = utree_rtree(outgroup->back);
+  /* the rooted tree has its own arena, and outlives the unrooted one */
+  arena_t * arena = arena_create();
+  rtree_t * rnode = (rtree_t *)arena_alloc(arena, sizeof(rtree_t));
+  rnode->left = utree_rtree(arena, outgroup);
+  rnode->right = utree_rtree(arena, outgroup->back);
   rnode->parent = NULL;
 
   rnode->left->parent = rnode;
@@ -527,11 +494,9 @@ utree_t ** utree_tipstring_nodes(utree_t * root,
   unsigned int k;
   unsigned int commas_count = 0;
 
-  char * taxon;
+  int id;
   unsigned int taxon_len;
 
-  ENTRY * found = NULL;
-
   for (i = 0; i < strlen(tipstring); ++i)
     if (tipstring[i] == ',')
       commas_count++;
@@ -542,16 +507,12 @@ utree_t ** utree_tipstring_nodes(utree_t * root,
   utree_t ** out_node_list = (utree_t **)xmalloc((commas_count+1) *
                                                    sizeof(utree_t *));
 
-  /* create a hashtable of tip labels */
-  hcreate(2 * tips_count);
+  /* index the tip nodes by the ids of their interned labels */
+  utree_t ** tip_by_id = (utree_t **)xcalloc(label_count(), sizeof(utree_t *));
 
   for (i = 0; i < tips_count; ++i)
-  {
-    ENTRY entry;
-    entry.key  = node_list[i]->label;
-    entry.data = node_list[i];
-    hsearch(entry,ENTER);
-  }
+    if (node_list[i]->label)
+      tip_by_id[label_id(node_list[i]->label)] = node_list[i];
 
   char * s = tipstring;
   
@@ -563,30 +524,22 @@ utree_t ** utree_tipstring_nodes(utree_t * root,
     if (!taxon_len)
       fatal("Erroneous prune list format (double comma)/taxon missing");
 
-    taxon = strndup(s, taxon_len);
-
-    /* search tip in hash table */
-    ENTRY query;
-    query.key = taxon;
-    found = NULL;
-    found = hsearch(query,FIND);
+    /* look up the taxon id, which exists only if some tree had the label */
+    id = label_find(s, taxon_len);
     
-    if (!found)
-      fatal("Taxon %s in does not appear in the tree", taxon);
+    if (id == -1 || !tip_by_id[id])
+      fatal("Taxon %.*s in does not appear in the tree", taxon_len, s);
 
     /* store pointer in output list */
-    out_node_list[k++] = (utree_t *)(found->data);
+    out_node_list[k++] = tip_by_id[id];
 
-    /* free tip label, and move to the beginning of next tip if available */
-    free(taxon);
+    /* move to the beginning of next tip if available */
     s += taxon_len;
     if (*s == ',') 
       s += 1;
   }
 
-  /* kill the hash table */
-  hdestroy();
-
+  free(tip_by_id);
   free(node_list);
 
   /* return number of tips in the list */
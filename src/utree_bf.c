@@ -22,40 +22,18 @@
 #include "newick-tools.h"
 
 static FILE * out;
+static writer_t * writer;
 
-static utree_t * utree_inner_create()
+/* all nodes are created once and relinked for every generated tree, and
+   are freed together with their arena at the end */
+static utree_t * utree_tip_create(arena_t * arena)
 {
-  utree_t * node = (utree_t *)calloc(1,sizeof(utree_t));
-  
-  node = (utree_t *)calloc(1,sizeof(utree_t));
-  node->next = (utree_t *)calloc(1,sizeof(utree_t));
-  node->next->next = (utree_t *)calloc(1,sizeof(utree_t));
-  node->next->next->next = node;
-
-  return node;
-}
-
-static void utree_inner_destroy(utree_t * node)
-{
-  free(node->next->next);
-  free(node->next);
-  free(node);
-}
-
-static utree_t * utree_tip_create()
-{
-  utree_t * node = (utree_t *)calloc(1,sizeof(utree_t));
+  utree_t * node = (utree_t *)arena_alloc(arena, sizeof(utree_t));
   node->next = NULL;
 
   return node;
 }
 
-static void utree_tip_destroy(utree_t * node)
-{
-  if (node->label)
-  free(node);
-}
-
 static void swap_ptr(void ** a, void ** b)
 {
   void * temp;
@@ -147,9 +125,7 @@ static void utree_exhaust_recursive(utree_t ** edge_list, utree_t ** inner_nodes
   else
   {
     ++tree_counter;
-    char * newick =  utree_export_newick(root);
-    fprintf(out,"%s\n", newick);
-    free(newick);
+    utree_stream_newick(writer, root);
   }
 
   /* fall back to the original setting */
@@ -167,6 +143,7 @@ static void utree_exhaust_recursive(utree_t ** edge_list, utree_t ** inner_nodes
 static void utree_exhaust(unsigned int tips_count, char ** tip_labels)
 {
   unsigned int i;
+  arena_t * arena = arena_create();
 
   assert(tips_count >= 3);
 
@@ -180,20 +157,20 @@ static void utree_exhaust(unsigned int tips_count, char ** tip_labels)
   
   */
 
-  root = utree_inner_create();
+  root = utree_inner_create(arena);
 
   /* create inner node list for (tips_count - 3) inner nodes (root was already
      created, and leave the last slot NULL for termination */
   utree_t ** inner_node_list = (utree_t **)calloc(tips_count - 2, sizeof(utree_t *));
 
   for (i=0; i<tips_count-3; ++i)
-    inner_node_list[i] = utree_inner_create();
+    inner_node_list[i] = utree_inner_create(arena);
 
   /* create tip node list with a terminating NULL element */
   utree_t ** tip_node_list = (utree_t **)calloc(tips_count+1, sizeof(utree_t *));
   for (i=0; i<tips_count; ++i)
   {
-    tip_node_list[i] = utree_tip_create();
+    tip_node_list[i] = utree_tip_create(arena);
     tip_node_list[i]->label = tip_labels[i];
   }
 
@@ -227,24 +204,15 @@ static void utree_exhaust(unsigned int tips_count, char ** tip_labels)
   else
   {
     ++tree_counter;
-    char * newick =  utree_export_newick(root);
-    printf("%s\n", newick);
-    free(newick);
+    utree_stream_newick(writer, root);
   }
   
-  /* deallocate inner nodes */
-  for (i=0; i < tips_count-3; ++i)
-    utree_inner_destroy(inner_node_list[i]);
-
-  /* deallocate tip nodes */
-  for (i=0; i < tips_count; ++i)
-    utree_tip_destroy(tip_node_list[i]);
+  /* deallocate all nodes, including the root */
+  arena_destroy(arena);
 
   free(inner_node_list);
   free(tip_node_list);
-
-  if (!opt_quiet)
-    printf("Total number of topologies: %d\n", tree_counter);
+  free(edge_list);
 }
 
 void cmd_utree_bf()
@@ -289,7 +257,8 @@ void cmd_utree_bf()
 
     line[len] = 0;
 
-    tip_list[tip_count] = xstrdup(line);
+    /* tips get pooled labels, as the tips of parsed trees do */
+    tip_list[tip_count] = label_intern(line, len);
 
     if (!opt_quiet)
       printf("%d: %s\n", tip_count+1, line);
@@ -298,11 +267,13 @@ void cmd_utree_bf()
   if (!opt_quiet)
     printf("\n");
   
+  writer = writer_open(out);
   utree_exhaust(tip_count, tip_list);
+  writer_close(writer);
+
+  if (!opt_quiet)
+    printf("Total number of topologies: %d\n", tree_counter);
 
-  unsigned int i;
-  for (i=0; i<tip_count; ++i);
-    free(tip_list[i]);
   free(tip_list);
   
   if (opt_outfile)
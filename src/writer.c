@@ -0,0 +1,312 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "newick-tools.h"
+
+/* Asynchronous output. The caller fills one of two buffers while a
+   separate thread writes the other one to the file descriptor, such that
+   formatting trees and writing them to disk overlap. A full buffer is
+   handed to the thread once it has finished with the previous one, so
+   data reaches the file in the order it was written.
+
+   Progress messages are printed on stdout, so output written to stdout
+   without --quiet goes through the stdio stream of the caller instead,
+   which keeps the messages and the trees in their original order.
+
+   Output files ending in .gz are stdio streams whose data is handed to a
+   writer that deflates each buffer in its thread before writing it, so
+   compression overlaps with the work of the caller. Such streams have no
+   file descriptor, and the writers of the caller write to them directly */
+
+#define WRITER_BUFFER_SIZE 1048576
+
+/* Compression level of .gz output. The fastest level keeps up with the
+   formatting of trees, and level 6 of gzip only saves about 15% */
+#define WRITER_GZIP_LEVEL Z_BEST_SPEED
+
+struct writer_s
+{
+  FILE * fp;
+  int fd;
+  int async;
+  int nexus;                    /* terminate NEXUS output when closed */
+  z_stream * zstream;           /* compresses the output if not NULL */
+  char * zbuffer;
+
+  char * buffer[2];
+  size_t len;                   /* bytes in the buffer being filled */
+  int fill;                     /* index of the buffer being filled */
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t pending;               /* bytes handed to the thread, 0 if idle */
+  int done;
+  int error;
+};
+
+/* writes the whole block, retrying on short writes and interrupts */
+static int write_all(int fd, const char * data, size_t len)
+{
+  while (len)
+  {
+    ssize_t bytes = write(fd, data, len);
+
+    if (bytes < 0)
+    {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+
+    data += bytes;
+    len -= (size_t)bytes;
+  }
+
+  return 0;
+}
+
+/* writes a block, after compressing it if the writer compresses */
+static int writer_output(writer_t * w,
+                         const char * data,
+                         size_t len,
+                         int flush)
+{
+  z_stream * z = w->zstream;
+  int error;
+
+  if (!z)
+    return write_all(w->fd, data, len);
+
+  z->next_in = (Bytef *)data;
+  z->avail_in = (uInt)len;
+
+  do
+  {
+    z->next_out = (Bytef *)w->zbuffer;
+    z->avail_out = WRITER_BUFFER_SIZE;
+
+    if (deflate(z, flush) == Z_STREAM_ERROR)
+      return EIO;
+
+    error = write_all(w->fd, w->zbuffer, WRITER_BUFFER_SIZE - z->avail_out);
+    if (error)
+      return error;
+  }
+  while (!z->avail_out);
+
+  return 0;
+}
+
+static void * writer_thread(void * arg)
+{
+  writer_t * w = (writer_t *)arg;
+
+  pthread_mutex_lock(&w->lock);
+  while (1)
+  {
+    while (!w->pending && !w->done)
+      pthread_cond_wait(&w->cond, &w->lock);
+
+    if (!w->pending)
+      break;
+
+    /* the handed buffer is the one not being filled */
+    const char * data = w->buffer[1 - w->fill];
+    size_t len = w->pending;
+    pthread_mutex_unlock(&w->lock);
+
+    int error = w->error ? 0 : writer_output(w, data, len, Z_NO_FLUSH);
+
+    pthread_mutex_lock(&w->lock);
+    if (error)
+      w->error = error;
+    w->pending = 0;
+    pthread_cond_broadcast(&w->cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  /* the end of the compressed stream */
+  if (w->zstream && !w->error)
+    w->error = writer_output(w, NULL, 0, Z_FINISH);
+
+  return NULL;
+}
+
+/* hands the filled buffer to the thread and continues with the other one */
+static void writer_handoff(writer_t * w)
+{
+  pthread_mutex_lock(&w->lock);
+  while (w->pending)
+    pthread_cond_wait(&w->cond, &w->lock);
+
+  if (w->len)
+  {
+    w->pending = w->len;
+    w->fill = 1 - w->fill;
+    w->len = 0;
+    pthread_cond_broadcast(&w->cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* starts the thread of an asynchronous writer to fd */
+static void writer_start(writer_t * w, int fd)
+{
+  w->async = 1;
+  w->fd = fd;
+
+  w->buffer[0] = (char *)xmalloc(WRITER_BUFFER_SIZE);
+  w->buffer[1] = (char *)xmalloc(WRITER_BUFFER_SIZE);
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+
+  if (pthread_create(&w->thread, NULL, writer_thread, w))
+    fatal("Unable to create output thread");
+}
+
+writer_t * writer_open(FILE * fp)
+{
+  writer_t * w = (writer_t *)xcalloc(1, sizeof(writer_t));
+
+  w->fp = fp;
+  w->nexus = opt_nexus;
+
+  if ((fp == stdout && !opt_quiet) || fileno(fp) == -1)
+    return w;
+
+  /* anything already printed on the stream must precede our output */
+  fflush(fp);
+  writer_start(w, fileno(fp));
+
+  return w;
+}
+
+void writer_write(writer_t * w, const char * data, size_t len)
+{
+  if (!w->async)
+  {
+    if (fwrite(data, 1, len, w->fp) != len)
+      fatal("Unable to write output");
+    return;
+  }
+
+  while (len)
+  {
+    size_t n = MIN(len, WRITER_BUFFER_SIZE - w->len);
+
+    memcpy(w->buffer[w->fill] + w->len, data, n);
+    w->len += n;
+    data += n;
+    len -= n;
+
+    if (w->len == WRITER_BUFFER_SIZE)
+      writer_handoff(w);
+  }
+}
+
+/* Writes out the remaining data and stops the thread. The stream itself
+   is left open for the caller to close */
+void writer_close(writer_t * w)
+{
+  int error = 0;
+
+  /* terminate the TREES block of NEXUS output */
+  if (w->nexus)
+    nexus_write_end(w);
+
+  if (w->async)
+  {
+    writer_handoff(w);
+
+    pthread_mutex_lock(&w->lock);
+    w->done = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+
+    error = w->error;
+    free(w->buffer[0]);
+    free(w->buffer[1]);
+  }
+
+  if (w->zstream)
+  {
+    deflateEnd(w->zstream);
+    free(w->zstream);
+    free(w->zbuffer);
+  }
+
+  free(w);
+
+  if (error)
+    fatal("Unable to write output (%s)", strerror(error));
+}
+
+static ssize_t gzip_write(void * cookie, const char * data, size_t len)
+{
+  writer_write((writer_t *)cookie, data, len);
+
+  return (ssize_t)len;
+}
+
+static int gzip_close(void * cookie)
+{
+  writer_t * w = (writer_t *)cookie;
+  int fd = w->fd;
+
+  writer_close(w);
+
+  return close(fd);
+}
+
+/* Creates filename and returns a stream whose output is written to it in
+   gzip format, or NULL if the file cannot be created */
+FILE * writer_fopen_gzip(const char * filename)
+{
+  cookie_io_functions_t io = { NULL, gzip_write, NULL, gzip_close };
+  writer_t * w;
+  FILE * fp;
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  if (fd == -1)
+    return NULL;
+
+  w = (writer_t *)xcalloc(1, sizeof(writer_t));
+  w->zstream = (z_stream *)xcalloc(1, sizeof(z_stream));
+  w->zbuffer = (char *)xmalloc(WRITER_BUFFER_SIZE);
+
+  /* a window of 2^15 bytes, plus 16 for a gzip instead of a zlib header */
+  if (deflateInit2(w->zstream, WRITER_GZIP_LEVEL, Z_DEFLATED, 15 + 16,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK)
+    fatal("Unable to initialize compression");
+
+  writer_start(w, fd);
+
+  fp = fopencookie(w, "w", io);
+  if (!fp)
+    fatal("Unable to create output stream");
+
+  return fp;
+}